@@ -0,0 +1,218 @@
+/* mkstemp() */
+#define _XOPEN_SOURCE 600
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "sndc.h"
+
+/* Sample storage of buffers
+ *
+ * Samples are allocated on the heap until settings.memLimit bytes of them are
+ * live there. Large buffers are then backed by unlinked temporary files
+ * mapped in memory, which the kernel can page out to disk instead of the
+ * render failing, as are the buffers malloc() can't allocate. Modules fill
+ * and read buffers front to back, the mappings are advised so.
+ *
+ * A header in front of the samples records where they live, and how many
+ * buffers share them: nodes passing a signal through, or trimming it, output
+ * the samples of their input instead of a copy, a buffer viewing the first
+ * samples of a longer one. Shared samples are immutable, buffer_own() copies
+ * them for a node to write to.
+ *
+ * Once written, the samples are also mapped in blocks of SILENT_BLOCK
+ * samples, recording the blocks that are all zeros: sequenced tracks are
+ * mostly silence, which the nodes reading them can skip. Samples a node
+ * wrote its output over are mapped again.
+ */
+
+/* bytes, smaller buffers always stay on the heap */
+#define SPILL_MIN_SIZE  (1UL << 20)
+
+union Header {
+    struct {
+        unsigned long size;     /* bytes, header included */
+        int refs;               /* atomic, buffers sharing the samples */
+        char mapped;
+        unsigned char* silent;  /* a byte per block, 1 if all zeros */
+        unsigned int numBlocks; /* blocks mapped, 0 if unknown */
+    } h;
+    char align[64];
+};
+
+#define HEADER(data)    ((union Header*) (data) - 1)
+
+/* atomic, bytes of samples live on the heap */
+static unsigned long heapBytes = 0;
+
+#define ADD(x, v)   __sync_fetch_and_add(&(x), (v))
+#define SUB(x, v)   __sync_fetch_and_sub(&(x), (v))
+
+static union Header* spill(unsigned long size) {
+    const char* dir = getenv("TMPDIR");
+    char* name;
+    void* map = MAP_FAILED;
+    int fd;
+
+    if (!dir || !*dir) dir = "/tmp";
+    if (!(name = malloc(strlen(dir) + sizeof("/sndc-XXXXXX")))) return NULL;
+    strcpy(name, dir);
+    strcat(name, "/sndc-XXXXXX");
+    if ((fd = mkstemp(name)) >= 0) {
+        unlink(name);
+        if (!ftruncate(fd, size)) {
+            map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+    }
+    free(name);
+    if (map == MAP_FAILED) return NULL;
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+    return map;
+}
+
+static void forget_silence(union Header* h) {
+    free(h->h.silent);
+    h->h.silent = NULL;
+    h->h.numBlocks = 0;
+}
+
+#define ALLOC_SIZE(n) \
+    (sizeof(union Header) + (unsigned long) (n) * sizeof(float))
+
+/* mapped files read as zeros, no need to clear them */
+static float* alloc(unsigned int n, int zero) {
+    unsigned long size = ALLOC_SIZE(n);
+    union Header* h = NULL;
+    char mapped = 0;
+
+    if (size >= SPILL_MIN_SIZE && settings.memLimit
+            && ADD(heapBytes, 0) + size > settings.memLimit) {
+        mapped = (h = spill(size)) != NULL;
+    }
+    if (!h && (h = zero ? calloc(1, size) : malloc(size))) {
+        ADD(heapBytes, size);
+    }
+    /* out of memory, there may still be room on disk */
+    if (!h && size >= SPILL_MIN_SIZE) {
+        mapped = (h = spill(size)) != NULL;
+    }
+    if (!h) return NULL;
+    h->h.size = size;
+    h->h.refs = 1;
+    h->h.mapped = mapped;
+    h->h.silent = NULL;
+    h->h.numBlocks = 0;
+    return (float*) (h + 1);
+}
+
+float* buffer_alloc(unsigned int n) {
+    return alloc(n, 0);
+}
+
+float* buffer_calloc(unsigned int n) {
+    return alloc(n, 1);
+}
+
+float* buffer_realloc(float* data, unsigned int n) {
+    union Header* h;
+    float* new;
+    unsigned long size = ALLOC_SIZE(n);
+
+    if (!data) return buffer_alloc(n);
+    h = HEADER(data);
+    /* shared samples stay where the other buffers read them */
+    if (       !h->h.mapped
+            && ADD(h->h.refs, 0) == 1
+            && (!settings.memLimit
+                || ADD(heapBytes, 0) - h->h.size + size
+                   <= settings.memLimit)) {
+        unsigned long old = h->h.size;
+        union Header* tmp;
+
+        forget_silence(h);
+        if ((tmp = realloc(h, size))) {
+            tmp->h.size = size;
+            ADD(heapBytes, size);
+            SUB(heapBytes, old);
+            return (float*) (tmp + 1);
+        }
+    }
+    if (!(new = buffer_alloc(n))) return NULL;
+    memcpy(new, data, (h->h.size < size ? h->h.size : size)
+                      - sizeof(union Header));
+    buffer_free(data);
+    return new;
+}
+
+float* buffer_share(float* data) {
+    if (data) ADD(HEADER(data)->h.refs, 1);
+    return data;
+}
+
+float* buffer_own(float* data, unsigned int n) {
+    float* copy;
+
+    if (!data || ADD(HEADER(data)->h.refs, 0) == 1) return data;
+    if (!(copy = buffer_alloc(n))) return NULL;
+    memcpy(copy, data, (unsigned long) n * sizeof(float));
+    buffer_free(data);
+    return copy;
+}
+
+void buffer_free(float* data) {
+    union Header* h;
+
+    if (!data) return;
+    h = HEADER(data);
+    if (SUB(h->h.refs, 1) > 1) return;
+    forget_silence(h);
+    if (h->h.mapped) {
+        munmap(h, h->h.size);
+    } else {
+        SUB(heapBytes, h->h.size);
+        free(h);
+    }
+}
+
+void buffer_map_silence(float* data, unsigned int n) {
+    union Header* h;
+    unsigned int numBlocks = (n + SILENT_BLOCK - 1) / SILENT_BLOCK, b, i;
+
+    if (!data) return;
+    h = HEADER(data);
+    /* samples shared by a buffer passing them through are mapped already */
+    if (h->h.numBlocks >= numBlocks && ADD(h->h.refs, 0) > 1) return;
+    forget_silence(h);
+    /* unknown, nothing is skipped */
+    if (!(h->h.silent = malloc(numBlocks + 1))) return;
+    for (b = 0; b < numBlocks; b++) {
+        unsigned int end = n - b * SILENT_BLOCK > SILENT_BLOCK
+                         ? (b + 1) * SILENT_BLOCK : n;
+
+        for (i = b * SILENT_BLOCK; i < end && data[i] == 0; i++);
+        h->h.silent[b] = i == end;
+    }
+    h->h.numBlocks = numBlocks;
+}
+
+unsigned int buffer_silent_run(const float* data,
+                               unsigned int start, unsigned int end,
+                               int* silent) {
+    const union Header* h;
+    unsigned int b, numBlocks;
+
+    *silent = 0;
+    if (!data || start >= end) return end;
+    h = HEADER(data);
+    if ((b = start / SILENT_BLOCK) >= h->h.numBlocks) return end;
+    *silent = h->h.silent[b];
+    numBlocks = (end - 1) / SILENT_BLOCK + 1;
+    if (numBlocks > h->h.numBlocks) numBlocks = h->h.numBlocks;
+    while (++b < numBlocks && h->h.silent[b] == *silent);
+    return b * SILENT_BLOCK < end ? b * SILENT_BLOCK : end;
+}
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+
+#include "sndc.h"
+
+/* Control rate
+ *
+ * Envelopes, cutoff curves and other parameters change slowly, yet are
+ * rendered at audio rates. When settings.controlRatio is set, the nodes of
+ * MOD_CONTROL modules whose outputs are only read as control signals render
+ * at their default sampling rate divided by it, unless their sampling rate
+ * is given. Their readers interpolate them at any rate.
+ *
+ * An output is read as a control signal by DESC_CONTROL and DESC_INTERP
+ * inputs, and by any input of a node itself at the control rate, such as a
+ * binop scaling an envelope. Nodes are planned from the last, so that the
+ * readers of a node are planned before it. The last node, exported outputs
+ * and outputs no node reads are results, rendered at full rate.
+ *
+ * Nodes at the control rate whose readers all accept DATA_CURVE inputs may
+ * output curves instead of buffers, when their module can.
+ */
+
+#define READ_CONTROL    (1 << 0)
+#define READ_SIGNAL     (1 << 1)
+#define READ_DENSE      (1 << 2)    /* by an input not accepting curves */
+
+int stack_plan_control(struct Stack* stack, const struct SNDCFile* file) {
+    unsigned char* read;
+    unsigned int i, j;
+
+    if (settings.controlRatio <= 1 || !stack->numNodes) {
+        return 1;
+    }
+    if (!(read = calloc(stack->numNodes, 1))) {
+        fprintf(stderr, "Error: can't allocate control plan\n");
+        return 0;
+    }
+    for (i = 0; i < file->numExport; i++) {
+        const struct Export* e = file->exports + i;
+        int r;
+
+        if (       e->type == EXP_OUTPUT
+                && (r = symtab_get(&stack->nodeIndex, e->ref.name)) >= 0) {
+            read[r] |= READ_SIGNAL;
+        }
+    }
+    read[stack->numNodes - 1] |= READ_SIGNAL;
+
+    /* nodes are created in the order of the file's entries */
+    for (i = stack->numNodes; i--;) {
+        struct Node* n = stack->nodes[i];
+        const struct Module* mod = n->module;
+        int slot;
+
+        n->control = (read[i] & ~READ_DENSE) == READ_CONTROL
+                  && (mod->flags & MOD_CONTROL)
+                  && ((slot = module_get_input_slot(mod, "sampling")) < 0
+                      || !n->inputs[slot]);
+        n->curve = n->control && !(read[i] & READ_DENSE);
+        if (i >= file->numEntries) continue;
+        for (j = 0; j < file->entries[i].numFields; j++) {
+            const struct Field* f = file->entries[i].fields + j;
+            int r, in;
+
+            if (       f->type != FIELD_REF
+                    || (r = symtab_get(&stack->nodeIndex,
+                                       f->data.ref.name)) < 0
+                    || (in = module_get_input_slot(mod, f->name)) < 0) {
+                continue;
+            }
+            read[r] |= n->control
+                    || (mod->inputs[in].flags & (DESC_CONTROL | DESC_INTERP))
+                     ? READ_CONTROL : READ_SIGNAL;
+            if (!(mod->inputs[in].type & DATA_CURVE)) {
+                read[r] |= READ_DENSE;
+            }
+        }
+    }
+    free(read);
+    return 1;
+}
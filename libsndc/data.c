@@ -12,16 +12,50 @@ void data_free(struct Data* data) {
     if (data) {
         switch (data->type) {
             case DATA_BUFFER:
-                free(data->content.buf.data);
+                buffer_free(data->content.buf.data);
+                buffer_free(data->packed.data);
                 data->content.buf.data = NULL;
+                data->packed.data = NULL;
                 data->content.buf.size = 0;
                 return;
             case DATA_STRING:
                 free(data->content.str);
                 data->content.str = NULL;
+                data->enumSet = NULL;
+                return;
+            case DATA_CURVE:
+                free(data->content.curve.points);
+                data->content.curve.points = NULL;
+                data->content.curve.numPoints = 0;
                 return;
             default:
                 return;
         }
     }
 }
+
+/* parses a string against the values accepted by desc once, so that modules
+ * don't have to compare strings each time they are processed
+ */
+int data_parse_enum(struct Data* data,
+                    const struct DataDesc* desc,
+                    const char* ctx) {
+    unsigned int i;
+
+    if (!desc->values || data->type != DATA_STRING || !data->content.str) {
+        return 1;
+    }
+    for (i = 0; desc->values[i]; i++) {
+        if (!strcmp(data->content.str, desc->values[i])) {
+            data->enumSet = desc->values;
+            data->enumVal = i;
+            return 1;
+        }
+    }
+    fprintf(stderr, "Error: %s: %s must be one of:", ctx, desc->name);
+    for (i = 0; desc->values[i]; i++) {
+        fprintf(stderr, " %s", desc->values[i]);
+    }
+    fprintf(stderr, "\n");
+    return 0;
+}
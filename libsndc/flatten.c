@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sndc.h"
+
+/* Import flattening
+ *
+ * Instead of running a sub stack for each node of an imported module, the
+ * entries of the imported file are spliced into the importing stack, so that
+ * the planning passes see through imports. The spliced entries are named
+ * after the import node, "kick.click" for the entry click of an import node
+ * kick. The fields of the import node replace the exported inputs they set,
+ * and references to its exported outputs are replaced by references to the
+ * nodes exporting them. The imports of imported files are flattened too.
+ *
+ * The import nodes the file exports, and the last node, whose first output is
+ * the result of the stack, stay nodes running sub stacks, see import.c.
+ */
+
+#define MAX_DEPTH   64
+
+struct Flatten {
+    struct Stack* stack;
+    struct SNDCFile* flat;
+
+    /* exported outputs of flattened nodes, indexed by "node.symbol" */
+    struct SymTab outputIndex;
+    struct Ref* outputs;
+    unsigned int numOutputs, capOutputs;
+};
+
+static char* join(struct Flatten* fl,
+                  const char* a, const char* b, const char* c) {
+    size_t la = strlen(a), lb = strlen(b), lc = strlen(c);
+    char *tmp, *res;
+
+    if (!(tmp = malloc(la + lb + lc + 1))) return NULL;
+    memcpy(tmp, a, la);
+    memcpy(tmp + la, b, lb);
+    memcpy(tmp + la + lb, c, lc + 1);
+    res = strpool_add(&fl->flat->strings, tmp, la + lb + lc);
+    free(tmp);
+    return res;
+}
+
+/* makes a reference from an entry of the file imported as prefix refer to
+ * the spliced entries
+ */
+static int resolve(struct Flatten* fl, const char* prefix, struct Field* f) {
+    char *name, *key;
+    int i;
+
+    if (f->type != FIELD_REF) return 1;
+    if (       !(name = join(fl, prefix, f->data.ref.name, ""))
+            || !(key = join(fl, name, ".", f->data.ref.field))) {
+        return 0;
+    }
+    if ((i = symtab_get(&fl->outputIndex, key)) >= 0) {
+        f->data.ref = fl->outputs[i];
+    } else {
+        f->data.ref.name = name;
+    }
+    return 1;
+}
+
+static int add_output(struct Flatten* fl, char* key, struct Ref ref) {
+    if (fl->numOutputs >= fl->capOutputs) {
+        unsigned int cap = fl->capOutputs ? 2 * fl->capOutputs : 16;
+        struct Ref* tmp;
+
+        if (!(tmp = realloc(fl->outputs, cap * sizeof(*tmp)))) return 0;
+        fl->outputs = tmp;
+        fl->capOutputs = cap;
+    }
+    if (!symtab_set(&fl->outputIndex, key, fl->numOutputs)) return 0;
+    fl->outputs[fl->numOutputs++] = ref;
+    return 1;
+}
+
+/* fields are linked to their entries once all are added, see parser.c */
+static int add_entry(struct Flatten* fl, const struct Entry* e,
+                     char* name, const char* path,
+                     const struct Field* fields, unsigned int numFields) {
+    struct SNDCFile* flat = fl->flat;
+
+    if (flat->numEntries >= flat->capEntries) {
+        unsigned int cap = flat->capEntries ? 2 * flat->capEntries : 16;
+        struct Entry* tmp;
+
+        if (!(tmp = realloc(flat->entries, cap * sizeof(*tmp)))) return 0;
+        flat->entries = tmp;
+        flat->capEntries = cap;
+    }
+    if (flat->numFields + numFields > flat->capFields) {
+        unsigned int cap = flat->capFields ? 2 * flat->capFields : 16;
+        struct Field* tmp;
+
+        while (cap < flat->numFields + numFields) cap *= 2;
+        if (!(tmp = realloc(flat->fields, cap * sizeof(*tmp)))) return 0;
+        flat->fields = tmp;
+        flat->capFields = cap;
+    }
+    memcpy(flat->fields + flat->numFields, fields,
+           numFields * sizeof(*fields));
+    flat->numFields += numFields;
+    flat->entries[flat->numEntries].name = name;
+    flat->entries[flat->numEntries].type = e->type;
+    flat->entries[flat->numEntries].fields = NULL;
+    flat->entries[flat->numEntries].numFields = numFields;
+    flat->entries[flat->numEntries].path = path;
+    flat->numEntries++;
+    return 1;
+}
+
+static int exported(const struct SNDCFile* f, const char* name) {
+    unsigned int i;
+
+    for (i = 0; i < f->numExport; i++) {
+        if (!strcmp(f->exports[i].ref.name, name)) return 1;
+    }
+    return 0;
+}
+
+/* the field of the import node setting the exported input node.field */
+static const struct Field* find_input(const struct SNDCFile* f,
+                                      const struct Field* inputs,
+                                      unsigned int numInputs,
+                                      const char* node,
+                                      const char* field) {
+    unsigned int i, j;
+
+    for (i = 0; i < f->numExport; i++) {
+        const struct Export* e = f->exports + i;
+
+        if (       e->type != EXP_INPUT
+                || strcmp(e->ref.name, node)
+                || strcmp(e->ref.field, field)) {
+            continue;
+        }
+        for (j = 0; j < numInputs; j++) {
+            if (!strcmp(inputs[j].name, e->symbol)) return inputs + j;
+        }
+    }
+    return NULL;
+}
+
+static int check_inputs(const struct SNDCFile* f, const char* module,
+                        const struct Field* inputs, unsigned int numInputs) {
+    unsigned int i, j;
+
+    for (i = 0; i < numInputs; i++) {
+        for (j = 0; j < f->numExport; j++) {
+            if (       f->exports[j].type == EXP_INPUT
+                    && !strcmp(f->exports[j].symbol, inputs[i].name)) {
+                break;
+            }
+        }
+        if (j == f->numExport) {
+            fprintf(stderr, "Error: module %s has no input '%s'\n",
+                    module, inputs[i].name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* the fields of an entry of f, as set by the import node for exported inputs,
+ * and resolved otherwise
+ */
+static int entry_fields(struct Flatten* fl,
+                        const struct SNDCFile* f,
+                        const struct Entry* e,
+                        const char* prefix,
+                        const struct Field* inputs,
+                        unsigned int numInputs,
+                        struct Field* fields) {
+    const struct Field* in;
+    unsigned int i, j, n = 0;
+
+    for (i = 0; i < e->numFields; i++) {
+        const struct Field* f0 = e->fields + i;
+
+        if ((in = find_input(f, inputs, numInputs, e->name, f0->name))) {
+            fields[n] = *in;
+            fields[n++].name = f0->name;
+        } else {
+            fields[n] = *f0;
+            if (!resolve(fl, prefix, fields + n++)) return -1;
+        }
+    }
+    for (i = 0; i < f->numExport; i++) {
+        const struct Export* x = f->exports + i;
+
+        if (x->type != EXP_INPUT || strcmp(x->ref.name, e->name)) continue;
+        for (j = 0; j < n && strcmp(fields[j].name, x->ref.field); j++);
+        if (       j == n
+                && (in = find_input(f, inputs, numInputs,
+                                    e->name, x->ref.field))) {
+            fields[n] = *in;
+            fields[n++].name = x->ref.field;
+        }
+    }
+    return n;
+}
+
+/* the files imported by f: the stack's imports for the stack's own file,
+ * imported again to keep them cached while the stack is alive otherwise
+ */
+static int import_files(struct Flatten* fl,
+                        const struct SNDCFile* f,
+                        int own,
+                        const struct SNDCFile** files) {
+    struct Stack* stack = fl->stack;
+    unsigned int i;
+
+    for (i = 0; i < f->numImport; i++) {
+        const struct Import* imp = f->imports + i;
+        struct Module* mod;
+        int m;
+
+        if (own) {
+            if ((m = symtab_get(&stack->importIndex, imp->importName)) < 0) {
+                return 0;
+            }
+            mod = stack->imports[m];
+        } else if (       !(mod = stack_import_new(stack))
+                       || !module_import(mod, imp->importName,
+                                         imp->fileName)) {
+            fprintf(stderr, "Error: module import failed\n");
+            return 0;
+        }
+        files[i] = mod->file;
+    }
+    return 1;
+}
+
+static const struct SNDCFile* entry_import(const struct SNDCFile* f,
+                                           const struct SNDCFile** files,
+                                           const char* type) {
+    unsigned int i;
+
+    for (i = 0; i < f->numImport; i++) {
+        if (!strcmp(f->imports[i].importName, type)) return files[i];
+    }
+    return NULL;
+}
+
+/* splices the entries of f, imported by a node whose fields are inputs and
+ * whose entries are prefixed with prefix, or the stack's own file if inputs
+ * is NULL
+ */
+static int flatten_file(struct Flatten* fl,
+                        const struct SNDCFile* f,
+                        const char* prefix,
+                        const struct Field* inputs,
+                        unsigned int numInputs,
+                        unsigned int depth) {
+    const struct SNDCFile** files = NULL;
+    struct Field* fields = NULL;
+    unsigned int i, j;
+    int ok = 0;
+
+    if (depth > MAX_DEPTH) {
+        fprintf(stderr, "Error: %s: imports nested too deep\n", prefix);
+        return 0;
+    } else if (       !(files = malloc(f->numImport * sizeof(*files) + 1))
+                   || !import_files(fl, f, !inputs, files)) {
+        goto exit;
+    }
+    for (i = 0; i < f->numEntries; i++) {
+        const struct Entry* e = f->entries + i;
+        const struct SNDCFile* sub;
+        char *name, *subprefix;
+        int n;
+
+        free(fields);
+        if (       !(fields = malloc((e->numFields + f->numExport)
+                                     * sizeof(*fields) + 1))
+                || (n = entry_fields(fl, f, e, prefix, inputs, numInputs,
+                                     fields)) < 0
+                || !(name = join(fl, prefix, e->name, ""))) {
+            goto exit;
+        }
+        sub = entry_import(f, files, e->type);
+        if (       !sub
+                || (!inputs
+                    && (i + 1 == f->numEntries || exported(f, e->name)))) {
+            if (!add_entry(fl, e, name, inputs ? f->path : NULL, fields, n)) {
+                goto exit;
+            }
+            continue;
+        }
+        if (       !check_inputs(sub, e->type, fields, n)
+                || !(subprefix = join(fl, name, ".", ""))
+                || !flatten_file(fl, sub, subprefix, fields, n, depth + 1)) {
+            goto exit;
+        }
+        for (j = 0; j < sub->numExport; j++) {
+            const struct Export* x = sub->exports + j;
+            struct Field out;
+            char* key;
+
+            if (x->type != EXP_OUTPUT) continue;
+            out.type = FIELD_REF;
+            out.data.ref = x->ref;
+            if (       !resolve(fl, subprefix, &out)
+                    || !(key = join(fl, name, ".", x->symbol))
+                    || !add_output(fl, key, out.data.ref)) {
+                goto exit;
+            }
+        }
+    }
+    ok = 1;
+exit:
+    free(files);
+    free(fields);
+    return ok;
+}
+
+int stack_flatten(struct Stack* stack,
+                  const struct SNDCFile* file,
+                  struct SNDCFile* flat) {
+    struct Flatten fl;
+    unsigned int i, offset = 0;
+    int ok;
+
+    memset(flat, 0, sizeof(*flat));
+    strpool_init(&flat->strings);
+    symtab_init(&flat->entryIndex);
+    fl.stack = stack;
+    fl.flat = flat;
+    symtab_init(&fl.outputIndex);
+    fl.outputs = NULL;
+    fl.numOutputs = fl.capOutputs = 0;
+
+    if ((ok = !!(flat->exports = malloc(file->numExport
+                                        * sizeof(*flat->exports) + 1)))) {
+        if (file->numExport) {
+            memcpy(flat->exports, file->exports,
+                   file->numExport * sizeof(*flat->exports));
+        }
+        flat->numExport = flat->capExport = file->numExport;
+        ok = flatten_file(&fl, file, "", NULL, 0, 0);
+    }
+    if (ok) {
+        for (i = 0; i < flat->numEntries; i++) {
+            flat->entries[i].fields = flat->fields + offset;
+            offset += flat->entries[i].numFields;
+        }
+    } else {
+        fprintf(stderr, "Error: can't flatten imports\n");
+        free_sndc(flat);
+    }
+    symtab_free(&fl.outputIndex);
+    free(fl.outputs);
+    return ok;
+}
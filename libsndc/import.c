@@ -1,8 +1,200 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include "sndc.h"
 
+/* Process-wide cache of parsed files, keyed by resolved path and checked
+ * against the file's mtime and size. Cached files are shared read-only by all
+ * the modules importing them, and stay cached when unused until
+ * import_cache_clear() is called.
+ * The cache is shared by all threads, all accesses go through cacheLock.
+ * Pinned files were not parsed from their path but put in the cache by
+ * import_cache_put() (e.g. loaded from a .sndcb), their source is never read.
+ */
+struct CachedFile {
+    struct SNDCFile file; /* first, so that a SNDCFile* is a CachedFile* */
+    char* key;
+    time_t mtime;
+    off_t size;
+    unsigned int refs;
+    char stale, pinned;
+};
+
+static struct CachedFile** cache;
+static unsigned int numCached, capCached;
+static struct SymTab cacheIndex;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cache_entry_free(struct CachedFile* c) {
+    free_sndc(&c->file);
+    free(c->key);
+    free(c);
+}
+
+static int cache_reindex(void) {
+    unsigned int i;
+
+    symtab_free(&cacheIndex);
+    for (i = 0; i < numCached; i++) {
+        if (!cache[i]->stale && !symtab_set(&cacheIndex, cache[i]->key, i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static struct CachedFile* cache_new(const char* path) {
+    struct CachedFile* new;
+
+    if (numCached >= capCached) {
+        unsigned int size = capCached ? 2 * capCached : 16;
+        void* tmp;
+
+        if (!(tmp = realloc(cache, size * sizeof(*cache)))) {
+            return NULL;
+        }
+        cache = tmp;
+        capCached = size;
+    }
+    if (!(new = calloc(1, sizeof(*new)))) {
+        return NULL;
+    } else if (!(new->key = str_cpy(path))) {
+        free(new);
+        return NULL;
+    }
+    return new;
+}
+
+static int cache_insert(struct CachedFile* new) {
+    int i;
+
+    if ((i = symtab_get(&cacheIndex, new->key)) >= 0) {
+        cache[i]->stale = 1;
+    }
+    if (!symtab_set(&cacheIndex, new->key, numCached)) {
+        return 0;
+    }
+    cache[numCached++] = new;
+    return 1;
+}
+
+static struct CachedFile* cache_add(const char* path, struct stat* st) {
+    struct CachedFile* new;
+
+    if (!(new = cache_new(path))) {
+        return NULL;
+    } else if (!parse_sndc(&new->file, path)) {
+        fprintf(stderr, "Error: %s: parsing failed\n", path);
+        free(new->key);
+        free(new);
+        return NULL;
+    }
+    new->mtime = st->st_mtime;
+    new->size = st->st_size;
+    if (!cache_insert(new)) {
+        cache_entry_free(new);
+        return NULL;
+    }
+    return new;
+}
+
+static struct SNDCFile* cache_get(const char* path) {
+    struct CachedFile* c = NULL;
+    struct stat st;
+    int i;
+
+    if ((i = symtab_get(&cacheIndex, path)) >= 0 && cache[i]->pinned) {
+        c = cache[i];
+    } else if (stat(path, &st)) {
+        fprintf(stderr, "Error: can't stat file: %s\n", path);
+        return NULL;
+    } else if (i >= 0) {
+        c = cache[i];
+        if (c->mtime != st.st_mtime || c->size != st.st_size) {
+            /* changed on disk, importers still using it keep the old one */
+            c->stale = 1;
+            c = NULL;
+        }
+    }
+    if (!c && !(c = cache_add(path, &st))) {
+        return NULL;
+    }
+    c->refs++;
+    return &c->file;
+}
+
+static struct SNDCFile* import_cache_get(const char* path) {
+    struct SNDCFile* file;
+
+    pthread_mutex_lock(&cacheLock);
+    file = cache_get(path);
+    pthread_mutex_unlock(&cacheLock);
+    return file;
+}
+
+int import_cache_put(const char* path, struct SNDCFile* file) {
+    struct CachedFile* new;
+    int ok = 0;
+
+    pthread_mutex_lock(&cacheLock);
+    if ((new = cache_new(path))) {
+        new->file = *file;
+        new->pinned = 1;
+        if (!(ok = cache_insert(new))) {
+            free(new->key);
+            free(new);
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+    return ok;
+}
+
+const struct SNDCFile* import_cache_file(unsigned int i, const char** path) {
+    const struct SNDCFile* file = NULL;
+
+    pthread_mutex_lock(&cacheLock);
+    if (i < numCached) {
+        *path = cache[i]->key;
+        file = &cache[i]->file;
+    }
+    pthread_mutex_unlock(&cacheLock);
+    return file;
+}
+
+static void import_cache_release(struct SNDCFile* file) {
+    struct CachedFile* c = (struct CachedFile*) file;
+
+    pthread_mutex_lock(&cacheLock);
+    c->refs--;
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void import_cache_clear(void) {
+    unsigned int i, n = 0;
+
+    pthread_mutex_lock(&cacheLock);
+    for (i = 0; i < numCached; i++) {
+        if (cache[i]->refs) {
+            cache[n++] = cache[i];
+        } else {
+            cache_entry_free(cache[i]);
+        }
+    }
+    numCached = n;
+    if (!numCached) {
+        free(cache);
+        cache = NULL;
+        capCached = 0;
+        symtab_free(&cacheIndex);
+    } else {
+        cache_reindex();
+    }
+    pthread_mutex_unlock(&cacheLock);
+}
+
 static int import_setup(struct Node* node) {
     struct Stack* stack = NULL;
     const struct Module* mod = node->module;
@@ -42,8 +234,18 @@ static int import_setup(struct Node* node) {
                                 node->name, e->ref.name, e->ref.field);
                         ok = 0;
                     } else {
-                        if (node->inputs[ni]) {
-                            ref->inputs[refslot] = node->inputs[ni];
+                        struct Data* in = node->inputs[ni];
+
+                        if (in) {
+                            ref->inputs[refslot] = in;
+                            ref->isValid = 0;
+                            /* read by the nodes of the importing stack too */
+                            ref->inplace &= ~(1U << refslot);
+                            if (!data_parse_enum(in,
+                                                 ref->module->inputs + refslot,
+                                                 node->name)) {
+                                ok = 0;
+                            }
                         }
                         ni++;
                     }
@@ -93,12 +295,10 @@ static int import_teardown(struct Node* node) {
 }
 
 int module_import(struct Module* module, const char* name, const char* file) {
-    int sndcOk = 0, ok = 0;
+    int ok = 0;
 
-    if (!(module->file = malloc(sizeof(struct SNDCFile)))) {
-        fprintf(stderr, "Error: %s: can't allocate sndc file\n", file);
-    } else if (!(sndcOk = parse_sndc(module->file, file))) {
-        fprintf(stderr, "Error: %s: parsing failed\n", file);
+    if (!(module->file = import_cache_get(file))) {
+        fprintf(stderr, "Error: %s: can't load file\n", file);
     } else {
         struct SNDCFile* f = module->file;
         unsigned int i, ni = 0, no = 0;
@@ -124,7 +324,7 @@ int module_import(struct Module* module, const char* name, const char* file) {
                     break;
                 case EXP_OUTPUT:
                     if (no < MAX_OUTPUTS) {
-                        module->inputs[no].type = 0;
+                        module->outputs[no].type = 0;
                         module->outputs[no++].name = f->exports[i].symbol;
                     } else {
                         fprintf(stderr, "Error: %s: too many input exports\n",
@@ -135,21 +335,16 @@ int module_import(struct Module* module, const char* name, const char* file) {
             }
         }
     }
-    if (!ok) {
-        if (module->file) {
-            if (sndcOk) {
-                free_sndc(module->file);
-            }
-            free(module->file);
-            module->file = NULL;
-        }
+    if (!ok && module->file) {
+        import_cache_release(module->file);
+        module->file = NULL;
     }
     return ok;
 }
 
 void module_free_import(struct Module* module) {
     if (module->file) {
-        free_sndc(module->file);
-        free(module->file);
+        import_cache_release(module->file);
+        module->file = NULL;
     }
 }
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "sndc.h"
+
+/* SIMD kernels
+ *
+ * The bodies in kernels.h are compiled once per instruction set through
+ * target attributes, and the best variant the CPU supports is picked on first
+ * use. Contraction to FMA is off in C89 mode, so all the variants compute the
+ * same results, only faster.
+ */
+
+#define KERNEL_PI       3.14159265358979
+/* scratch size of the kernels working in several passes */
+#define KERNEL_CHUNK    64
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#endif
+
+/* generic variant, SSE2 being the baseline on x86_64 */
+#define KERNEL(name) name##_generic
+#define KERNEL_TARGET
+#ifdef __SSE2__
+#define KERNEL_NAME "sse2"
+#else
+#define KERNEL_NAME "generic"
+#endif
+#include "kernels.h"
+#undef KERNEL
+#undef KERNEL_TARGET
+#undef KERNEL_NAME
+
+#ifdef KERNELS_X86
+#define KERNEL(name) name##_avx2
+#define KERNEL_TARGET __attribute__((target("avx2")))
+#define KERNEL_NAME "avx2"
+#include "kernels.h"
+#undef KERNEL
+#undef KERNEL_TARGET
+#undef KERNEL_NAME
+
+#define KERNEL(name) name##_avx512
+#define KERNEL_TARGET __attribute__((target("avx512f")))
+#define KERNEL_NAME "avx512f"
+#include "kernels.h"
+#undef KERNEL
+#undef KERNEL_TARGET
+#undef KERNEL_NAME
+#endif
+
+static const struct Kernels* selected = NULL;
+static pthread_once_t selectOnce = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void) {
+    selected = &kernels_generic;
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        selected = &kernels_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        selected = &kernels_avx2;
+    }
+#endif
+}
+
+const struct Kernels* kernels_get(void) {
+    pthread_once(&selectOnce, select_kernels);
+    return selected;
+}
+
+void kernels_info(FILE* f) {
+    const struct Kernels* k = kernels_get();
+
+    fprintf(f, "CPU features:");
+#ifdef KERNELS_X86
+    if (__builtin_cpu_supports("sse2")) fprintf(f, " sse2");
+    if (__builtin_cpu_supports("avx2")) fprintf(f, " avx2");
+    if (__builtin_cpu_supports("avx512f")) fprintf(f, " avx512f");
+#else
+    fprintf(f, " none detected");
+#endif
+    fprintf(f, "\nKernels: %s (add, mix, binop, interp, interp_at, "
+               "segment, cscale, encode_f32, encode_int, range, pack_f16, "
+               "unpack_f16, pack_s16, unpack_s16, fir)\n", k->name);
+}
@@ -0,0 +1,415 @@
+/* Kernel bodies, included by kernels.c once per instruction set with
+ * KERNEL(name) giving the variant's function name and KERNEL_TARGET its
+ * target attribute. Loops are written for the auto-vectorizer: no calls, no
+ * early exits, in-bounds loads in every lane.
+ */
+
+#define KERNEL_LOOP(expr) for (i = 0; i < n; i++) dest[i] = (expr)
+
+static KERNEL_TARGET void KERNEL(add)(float* dest,
+                                      const float* src,
+                                      unsigned int n) {
+    unsigned int i;
+
+    KERNEL_LOOP(dest[i] + src[i]);
+}
+
+static KERNEL_TARGET void KERNEL(mix)(float* dest,
+                                      const float* src,
+                                      const float* gains,
+                                      float gain,
+                                      unsigned int n) {
+    unsigned int i;
+
+    if (gains) {
+        KERNEL_LOOP(dest[i] + gains[i] * src[i]);
+    } else {
+        KERNEL_LOOP(dest[i] + gain * src[i]);
+    }
+}
+
+static KERNEL_TARGET void KERNEL(binop)(int op,
+                                        float* dest,
+                                        const float* a,
+                                        const float* b,
+                                        float c,
+                                        unsigned int n) {
+    unsigned int i;
+
+    if (b) {
+        switch (op) {
+            case KERNEL_ADD: KERNEL_LOOP(a[i] + b[i]); break;
+            case KERNEL_SUB: KERNEL_LOOP(a[i] - b[i]); break;
+            case KERNEL_MUL: KERNEL_LOOP(a[i] * b[i]); break;
+            case KERNEL_DIV: KERNEL_LOOP(a[i] / b[i]); break;
+            case KERNEL_MIN: KERNEL_LOOP(a[i] < b[i] ? a[i] : b[i]); break;
+            case KERNEL_MAX: KERNEL_LOOP(a[i] > b[i] ? a[i] : b[i]); break;
+        }
+    } else {
+        switch (op) {
+            case KERNEL_ADD: KERNEL_LOOP(a[i] + c); break;
+            case KERNEL_SUB: KERNEL_LOOP(a[i] - c); break;
+            case KERNEL_MUL: KERNEL_LOOP(a[i] * c); break;
+            case KERNEL_DIV: KERNEL_LOOP(a[i] / c); break;
+            case KERNEL_MIN: KERNEL_LOOP(a[i] < c ? a[i] : c); break;
+            case KERNEL_MAX: KERNEL_LOOP(a[i] > c ? a[i] : c); break;
+        }
+    }
+}
+
+/* m <= KERNEL_CHUNK values of buf between samples idx and idx + 1, at
+ * fractions r
+ */
+static KERNEL_TARGET void KERNEL(lookup)(float* dest,
+                                         const struct Buffer* buf,
+                                         const unsigned int* idx,
+                                         const float* r,
+                                         unsigned int m) {
+    const float* data = buf->data;
+    float lo[KERNEL_CHUNK], hi[KERNEL_CHUNK];
+    unsigned int i, last = buf->size - 1;
+
+    for (i = 0; i < m; i++) {
+        lo[i] = data[idx[i]];
+        hi[i] = data[idx[i] < last ? idx[i] + 1 : idx[i]];
+    }
+    switch (buf->interp) {
+        case INTERP_STEP:
+            for (i = 0; i < m; i++) {
+                dest[i] = lo[i];
+            }
+            break;
+        case INTERP_LINEAR:
+            for (i = 0; i < m; i++) {
+                dest[i] = lo[i] * (1 - r[i]) + hi[i] * r[i];
+            }
+            break;
+        case INTERP_SINE:
+            for (i = 0; i < m; i++) {
+                dest[i] = (lo[i] - hi[i]) / 2. * cos(KERNEL_PI * r[i])
+                        + (lo[i] + hi[i]) / 2.;
+            }
+            break;
+    }
+}
+
+/* same results as interp(), in passes over chunks so that all but the
+ * lookups vectorize: positions out of ]0, 1[ are looked up at 0 so that all
+ * the indices are inside the buffer, and their values selected at the end
+ */
+static KERNEL_TARGET void KERNEL(interp)(float* dest,
+                                         const struct Buffer* buf,
+                                         const float* t,
+                                         unsigned int n) {
+    float last = buf->size - 1, first = buf->data[0];
+    float end = buf->data[buf->size - 1], r[KERNEL_CHUNK];
+    unsigned int idx[KERNEL_CHUNK], c, i, m;
+
+    for (c = 0; c < n; c += m, t += m, dest += m) {
+        m = n - c < KERNEL_CHUNK ? n - c : KERNEL_CHUNK;
+
+        for (i = 0; i < m; i++) {
+            float a = t[i] > 0 ? t[i] : 0;
+
+            a = (a < 1 ? a : 0) * last;
+            idx[i] = a;
+            r[i] = a - (float) idx[i];
+        }
+        KERNEL(lookup)(dest, buf, idx, r, m);
+        for (i = 0; i < m; i++) {
+            float v = idx[i] + 1 < buf->size ? dest[i] : end;
+
+            v = t[i] >= 1 ? end : v;
+            dest[i] = t[i] <= 0 ? first : v;
+        }
+    }
+}
+
+/* interp_at() likewise, positions being computed in double */
+static KERNEL_TARGET void KERNEL(interp_at)(float* dest,
+                                            const struct Buffer* buf,
+                                            unsigned int start,
+                                            unsigned int size,
+                                            unsigned int n) {
+    double step = (double) (buf->size - 1) / size;
+    float first = buf->data[0], end = buf->data[buf->size - 1];
+    float r[KERNEL_CHUNK];
+    unsigned int idx[KERNEL_CHUNK], c, i, m;
+
+    for (c = 0; c < n; c += m, start += m, dest += m) {
+        m = n - c < KERNEL_CHUNK ? n - c : KERNEL_CHUNK;
+
+        for (i = 0; i < m; i++) {
+            double a = start + i < size ? (start + i) * step : 0;
+
+            idx[i] = a;
+            r[i] = a - idx[i];
+        }
+        KERNEL(lookup)(dest, buf, idx, r, m);
+        for (i = 0; i < m; i++) {
+            float v = idx[i] + 1 < buf->size ? dest[i] : end;
+
+            v = start + i >= size ? end : v;
+            dest[i] = start + i ? v : first;
+        }
+    }
+}
+
+/* groups of KERNEL_LANES samples, the anchors varying per group and the
+ * tables per lane
+ */
+static KERNEL_TARGET void KERNEL(segment)(float* dest,
+                                          const float* a,
+                                          const float* b,
+                                          const float* p,
+                                          const float* q,
+                                          float c,
+                                          unsigned int n) {
+    unsigned int g, j;
+
+    for (g = 0; g < n; g++, dest += KERNEL_LANES) {
+        for (j = 0; j < KERNEL_LANES; j++) {
+            dest[j] = a[g] * p[j] + b[g] * q[j] + c;
+        }
+    }
+}
+
+/* interleaved complex values times real gains, the index is wide so that
+ * 2 * i can't wrap and the accesses stay affine
+ */
+static KERNEL_TARGET void KERNEL(cscale)(float* dest,
+                                         const float* gains,
+                                         unsigned int n) {
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        dest[2 * i] *= gains[i];
+        dest[2 * i + 1] *= gains[i];
+    }
+}
+
+/* WAV samples are little endian whatever the host */
+static KERNEL_TARGET void KERNEL(encode_f32)(unsigned char* dest,
+                                             const float* src,
+                                             unsigned int n) {
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t v;
+
+        memcpy(&v, src + i, sizeof(v));
+        dest[4 * i] = v;
+        dest[4 * i + 1] = v >> 8;
+        dest[4 * i + 2] = v >> 16;
+        dest[4 * i + 3] = v >> 24;
+    }
+}
+
+/* float to integer with TPDF dither: the sum of two uniform noises of 1 LSB,
+ * drawn from independent LCGs per lane so that the lanes loop vectorizes.
+ */
+static KERNEL_TARGET void KERNEL(encode_int)(unsigned char* dest,
+                                             const float* src,
+                                             unsigned int n,
+                                             unsigned int bytes,
+                                             uint32_t* state) {
+    float scale = bytes == 2 ? 32768. : 8388608.;
+    float vmax = scale - 1, vmin = -scale;
+    float pad[KERNEL_DITHER_LANES];
+    int32_t q[KERNEL_DITHER_LANES];
+    unsigned int i, j, k;
+
+    for (i = 0; i < n; i += KERNEL_DITHER_LANES) {
+        const float* s = src + i;
+        unsigned int m = n - i < KERNEL_DITHER_LANES
+                       ? n - i : KERNEL_DITHER_LANES;
+
+        if (m < KERNEL_DITHER_LANES) {
+            memset(pad, 0, sizeof(pad));
+            memcpy(pad, s, m * sizeof(*s));
+            s = pad;
+        }
+        for (j = 0; j < KERNEL_DITHER_LANES; j++) {
+            uint32_t a, b;
+            float v;
+
+            a = state[j] = state[j] * 1664525U + 1013904223U;
+            b = state[j] = state[j] * 1664525U + 1013904223U;
+            v = s[j] * scale
+              + ((float)(a >> 8) - (float)(b >> 8)) * (1.f / 16777216.f);
+            v = v > vmax ? vmax : v;
+            v = v < vmin ? vmin : v;
+            q[j] = v + (v >= 0 ? .5f : -.5f);
+        }
+        for (j = 0; j < m; j++) {
+            for (k = 0; k < bytes; k++) {
+                dest[bytes * (i + j) + k] = (uint32_t) q[j] >> (8 * k);
+            }
+        }
+    }
+}
+
+/* min and max per lane, so that the selects vectorize */
+static KERNEL_TARGET void KERNEL(range)(const float* src,
+                                        unsigned int n,
+                                        float* min,
+                                        float* max) {
+    float lo[KERNEL_LANES], hi[KERNEL_LANES];
+    unsigned int i, j;
+
+    for (j = 0; j < KERNEL_LANES; j++) {
+        lo[j] = hi[j] = src[0];
+    }
+    for (i = 0; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (j = 0; j < KERNEL_LANES; j++) {
+            lo[j] = src[i + j] < lo[j] ? src[i + j] : lo[j];
+            hi[j] = src[i + j] > hi[j] ? src[i + j] : hi[j];
+        }
+    }
+    for (j = 0; i + j < n; j++) {
+        lo[j] = src[i + j] < lo[j] ? src[i + j] : lo[j];
+        hi[j] = src[i + j] > hi[j] ? src[i + j] : hi[j];
+    }
+    for (j = 1; j < KERNEL_LANES; j++) {
+        lo[0] = lo[j] < lo[0] ? lo[j] : lo[0];
+        hi[0] = hi[j] > hi[0] ? hi[j] : hi[0];
+    }
+    *min = lo[0];
+    *max = hi[0];
+}
+
+/* round to nearest even on the bits, magnitudes saturated to 65504, NaN
+ * included. The normal and subnormal half results are both computed and
+ * selected by masks: a float of exponent 126 (.5) plus a small value rounds
+ * its mantissa to the subnormal half's one.
+ */
+static KERNEL_TARGET void KERNEL(pack_f16)(uint16_t* dest,
+                                           const float* src,
+                                           unsigned int n) {
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t u, m, sign, norm, sub, small;
+        float f = src[i];
+
+        memcpy(&u, &f, sizeof(u));
+        sign = (u >> 16) & 0x8000;
+        u &= 0x7fffffff;
+        memcpy(&f, &u, sizeof(f));
+        f += .5f;
+        memcpy(&sub, &f, sizeof(sub));
+        sub -= 0x3f000000;
+        m = u > 0x477fe000 ? 0x477fe000 : u;
+        norm = (m - 0x38000000 + 0xfff + ((m >> 13) & 1)) >> 13;
+        small = -(uint32_t) (u < 0x38800000);
+        dest[i] = sign | (sub & small) | (norm & ~small);
+    }
+}
+
+/* packed halves are never infinite nor NaN. Subnormal halves are made normal
+ * floats then offset, not to depend on float subnormals, which render
+ * threads flush.
+ */
+static KERNEL_TARGET void KERNEL(unpack_f16)(float* dest,
+                                             const uint16_t* src,
+                                             unsigned int n) {
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t u = (uint32_t) (src[i] & 0x7fff) << 13, v, sub, small;
+        float f;
+
+        u += 0x38000000;
+        v = u + 0x00800000;
+        memcpy(&f, &v, sizeof(f));
+        f -= 6.103515625e-05f;
+        memcpy(&sub, &f, sizeof(sub));
+        small = -(uint32_t) (u < 0x38800000);
+        u = (sub & small) | (u & ~small);
+        u |= (uint32_t) (src[i] & 0x8000) << 16;
+        memcpy(dest + i, &u, sizeof(u));
+    }
+}
+
+/* the comparisons are all made on v, for the selects to if-convert */
+static KERNEL_TARGET void KERNEL(pack_s16)(int16_t* dest,
+                                           const float* src,
+                                           float step,
+                                           float offset,
+                                           unsigned int n) {
+    float scale = step ? 1 / step : 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        float v = (src[i] - offset) * scale;
+        float r = v >= 0 ? .5f : -.5f;
+        float lo = v < -32767 ? -32767 : v;
+
+        dest[i] = (int32_t) ((v > 32767 ? 32767 : lo) + r);
+    }
+}
+
+static KERNEL_TARGET void KERNEL(unpack_s16)(float* dest,
+                                             const int16_t* src,
+                                             float step,
+                                             float offset,
+                                             unsigned int n) {
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        dest[i] = src[i] * step + offset;
+    }
+}
+
+/* taps a multiple of KERNEL_LANES, the lanes summed in the same order by
+ * every variant
+ */
+static KERNEL_TARGET void KERNEL(fir)(float* dest,
+                                      const float* src,
+                                      const float* bank,
+                                      unsigned int taps,
+                                      const uint32_t* offsets,
+                                      const uint32_t* phases,
+                                      unsigned int n) {
+    float acc[KERNEL_LANES];
+    unsigned int i, j, t;
+
+    for (i = 0; i < n; i++) {
+        const float* s = src + offsets[i];
+        const float* h = bank + (unsigned long) phases[i] * taps;
+
+        for (j = 0; j < KERNEL_LANES; j++) {
+            acc[j] = 0;
+        }
+        for (t = 0; t < taps; t += KERNEL_LANES) {
+            for (j = 0; j < KERNEL_LANES; j++) {
+                acc[j] += s[t + j] * h[t + j];
+            }
+        }
+        for (j = 1; j < KERNEL_LANES; j++) {
+            acc[0] += acc[j];
+        }
+        dest[i] = acc[0];
+    }
+}
+
+static const struct Kernels KERNEL(kernels) = {
+    KERNEL_NAME,
+    KERNEL(add),
+    KERNEL(mix),
+    KERNEL(binop),
+    KERNEL(interp),
+    KERNEL(interp_at),
+    KERNEL(segment),
+    KERNEL(cscale),
+    KERNEL(encode_f32),
+    KERNEL(encode_int),
+    KERNEL(range),
+    KERNEL(pack_f16),
+    KERNEL(unpack_f16),
+    KERNEL(pack_s16),
+    KERNEL(unpack_s16),
+    KERNEL(fir)
+};
+
+#undef KERNEL_LOOP
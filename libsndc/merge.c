@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sndc.h"
+
+/* Merging of identical nodes
+ *
+ * Files built from imports often hold the same node several times: the same
+ * noise, the same envelope, or two imports of a drum with the same
+ * parameters, which once flattened are identical nodes all the way down.
+ * Before the nodes are created, each entry is keyed by its module and its
+ * fields sorted by name, and an entry with the same key as an earlier one is
+ * dropped, the references to it pointing to the earlier one instead. As
+ * entries are in processing order, the fields of an entry are rewritten
+ * before it is keyed, and chains of identical nodes merge entirely.
+ *
+ * Nodes of MOD_UNIQUE modules, the nodes the file exports and the last node
+ * are never dropped, nor are other entries merged into them: they are
+ * referred to by name, set through the patch API or have side effects.
+ */
+
+struct Key {
+    char* s;
+    size_t len, cap;
+};
+
+/* components are prefixed by their length, so that keys can't collide */
+static int key_add(struct Key* k, const char* s) {
+    size_t len = strlen(s);
+    char num[32];
+    int n;
+
+    n = sprintf(num, "%lu:", (unsigned long) len);
+    if (k->len + n + len + 1 > k->cap) {
+        size_t cap = k->cap ? 2 * k->cap : 256;
+        char* tmp;
+
+        while (cap < k->len + n + len + 1) cap *= 2;
+        if (!(tmp = realloc(k->s, cap))) return 0;
+        k->s = tmp;
+        k->cap = cap;
+    }
+    memcpy(k->s + k->len, num, n);
+    memcpy(k->s + k->len + n, s, len + 1);
+    k->len += n + len;
+    return 1;
+}
+
+static int field_comp(const void* a, const void* b) {
+    const struct Field *f1 = *(const struct Field**) a;
+    const struct Field *f2 = *(const struct Field**) b;
+
+    return strcmp(f1->name, f2->name);
+}
+
+static const struct Module* entry_module(struct Stack* stack,
+                                         const struct Entry* e) {
+    int m;
+
+    /* spliced entries only use builtin modules, see flatten.c */
+    if (!e->path && (m = symtab_get(&stack->importIndex, e->type)) >= 0) {
+        return stack->imports[m];
+    }
+    return module_find(e->type);
+}
+
+static int entry_key(struct Key* k, const struct Entry* e,
+                     const struct Module* mod,
+                     const struct Field** sorted) {
+    char num[32];
+    unsigned int i;
+    int ok;
+
+    k->len = 0;
+    for (i = 0; i < e->numFields; i++) {
+        sorted[i] = e->fields + i;
+    }
+    qsort(sorted, e->numFields, sizeof(*sorted), field_comp);
+    /* modules can read data files relative to the entry's path */
+    ok =       key_add(k, mod->file ? "import" : "")
+            && key_add(k, e->type)
+            && key_add(k, e->path ? e->path : "");
+    for (i = 0; ok && i < e->numFields; i++) {
+        const struct Field* f = sorted[i];
+
+        ok = key_add(k, f->name);
+        switch (f->type) {
+            case FIELD_FLOAT:
+                sprintf(num, "%.9g", f->data.f);
+                ok = ok && key_add(k, "f") && key_add(k, num);
+                break;
+            case FIELD_STRING:
+                ok = ok && key_add(k, "s") && key_add(k, f->data.str);
+                break;
+            case FIELD_REF:
+                ok = ok && key_add(k, "r")
+                        && key_add(k, f->data.ref.name)
+                        && key_add(k, f->data.ref.field);
+                break;
+        }
+    }
+    return ok;
+}
+
+/* nodes whose names are used by the file, by the patch API or for their
+ * side effects
+ */
+static int entry_unique(const struct SNDCFile* file,
+                        const struct Module* mod,
+                        unsigned int i) {
+    unsigned int j;
+
+    if (!mod || (mod->flags & MOD_UNIQUE) || i + 1 == file->numEntries) {
+        return 1;
+    }
+    for (j = 0; j < file->numExport; j++) {
+        if (!strcmp(file->exports[j].ref.name, file->entries[i].name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int stack_merge(struct Stack* stack, struct SNDCFile* file) {
+    struct SymTab keys, merged;
+    struct Key k = {NULL, 0, 0};
+    const struct Field** sorted = NULL;
+    unsigned int i, j, n = 0, maxFields = 0;
+    int ok = 1;
+
+    symtab_init(&keys);
+    symtab_init(&merged);
+    for (i = 0; i < file->numEntries; i++) {
+        if (file->entries[i].numFields > maxFields) {
+            maxFields = file->entries[i].numFields;
+        }
+    }
+    if (!(sorted = malloc(maxFields * sizeof(*sorted) + 1))) {
+        ok = 0;
+    }
+    for (i = 0; ok && i < file->numEntries; i++) {
+        struct Entry* e = file->entries + i;
+        const struct Module* mod = entry_module(stack, e);
+        char* key;
+        int r;
+
+        for (j = 0; j < e->numFields; j++) {
+            struct Field* f = e->fields + j;
+
+            if (       f->type == FIELD_REF
+                    && (r = symtab_get(&merged, f->data.ref.name)) >= 0) {
+                f->data.ref.name = file->entries[r].name;
+            }
+        }
+        if (entry_unique(file, mod, i)) {
+            file->entries[n++] = *e;
+        } else if (       !entry_key(&k, e, mod, sorted)
+                       || !(key = strpool_add(&file->strings, k.s, k.len))) {
+            ok = 0;
+        } else if ((r = symtab_get(&keys, key)) >= 0) {
+            ok = symtab_set(&merged, e->name, r);
+        } else {
+            file->entries[n] = *e;
+            ok = symtab_set(&keys, key, n++);
+        }
+    }
+    if (ok) {
+        file->numEntries = n;
+    } else {
+        fprintf(stderr, "Error: can't merge nodes\n");
+    }
+    free(k.s);
+    free(sorted);
+    symtab_free(&keys);
+    symtab_free(&merged);
+    return ok;
+}
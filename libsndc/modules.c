@@ -1,13 +1,33 @@
 #include <string.h>
+#include <pthread.h>
 
 #include "sndc.h"
 
+static struct SymTab moduleIndex;
+static pthread_once_t moduleIndexOnce = PTHREAD_ONCE_INIT;
+
+static void build_index(void) {
+    unsigned int j;
+
+    for (j = 0; j < numModules; j++) {
+        if (!symtab_set(&moduleIndex, modules[j]->name, j)) {
+            symtab_free(&moduleIndex);
+            return;
+        }
+    }
+}
+
+/* the index is built on first use, the builtin module list never changes
+ * after that (only sndc -l sorts it, and it doesn't load any file)
+ */
 const struct Module* module_find(const char* name) {
-    unsigned int i;
-    for (i = 0; i < numModules; i++) {
-        if (!strcmp(modules[i]->name, name)) return modules[i];
+    int i;
+
+    pthread_once(&moduleIndexOnce, build_index);
+    if ((i = symtab_get(&moduleIndex, name)) < 0) {
+        return NULL;
     }
-    return NULL;
+    return modules[i];
 }
 
 int module_get_input_slot(const struct Module* module, const char* name) {
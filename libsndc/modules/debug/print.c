@@ -18,12 +18,19 @@ const struct Module print = {
     {{0}},
     NULL,
     print_process,
-    NULL
+    NULL,
+    MOD_UNIQUE
+};
+
+enum PrintInputType {
+    INP,
+    FIL,
+
+    NUM_INPUTS
 };
 
 static int print_valid(struct Node* n) {
-    if (!data_valid(n->inputs[0], print.inputs, n->name)) return 0;
-    if (!data_valid(n->inputs[1], print.inputs + 1, n->name)) return 0;
+    GENERIC_CHECK_INPUTS(n, print);
     return 1;
 }
 
@@ -34,16 +41,16 @@ static int print_process(struct Node* n) {
 
     if (!print_valid(n)) return 0;
 
-    if (n->inputs[1]) {
-        if (!(f = fopen(n->inputs[1]->content.str, "w"))) {
+    if (n->inputs[FIL]) {
+        if (!(f = fopen(n->inputs[FIL]->content.str, "w"))) {
             fprintf(stderr, "Error: %s: can't open file: %s\n",
-                    n->name, n->inputs[1]->content.str);
+                    n->name, n->inputs[FIL]->content.str);
             return 0;
         }
     } else {
         f = stdout;
     }
-    in = &n->inputs[0]->content.buf;
+    in = &n->inputs[INP]->content.buf;
     for (i = 0; i < in->size; i++) {
         fprintf(f, "%d %f\n", i, in->data[i]);
     }
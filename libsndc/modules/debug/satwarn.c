@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <sndc.h>
 #include <modules/utils.h>
@@ -17,7 +18,8 @@ const struct Module satwarn = {
     },
     NULL,
     satwarn_process,
-    NULL
+    NULL,
+    MOD_UNIQUE
 };
 
 enum SatwarnInputType {
@@ -29,12 +31,18 @@ enum SatwarnInputType {
 static int satwarn_process(struct Node* n) {
     unsigned int i, size, numSat = 0;
     float* data;
+    struct Data* out = n->outputs[0];
 
     GENERIC_CHECK_INPUTS(n, satwarn);
 
-    n->outputs[0] = n->inputs[0];
-    size = n->inputs[0]->content.buf.size;
-    data = n->inputs[0]->content.buf.data;
+    /* consumers hold the output Data from load time, it can't be swapped for
+     * the input here, but it can share its samples
+     */
+    size = n->inputs[INP]->content.buf.size;
+    data = n->inputs[INP]->content.buf.data;
+    out->type = DATA_BUFFER;
+    out->content.buf = n->inputs[INP]->content.buf;
+    out->content.buf.data = buffer_share(data);
 
     for (i = 0; i < size; i++) {
         if (data[i] > 1. || data[i] < -1.) {
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sndc.h>
+#include <modules/utils.h>
+
+static int curve_process(struct Node* n);
+
+/* DECLARE_MODULE(curve) */
+const struct Module curve = {
+    "curve", "generator", "Breakpoint curve, for automation",
+    {
+        {"points",      DATA_STRING,    REQUIRED,
+                        "breakpoints 'time:value[:shape] ...', time in "
+                        "seconds, shape of the segment reaching the point "
+                        "'step', 'linear', 'sine' or 'exp', def 'linear'"},
+
+        {"duration",    DATA_FLOAT,     OPTIONAL,
+                        "duration of resulting signal, def time of the last "
+                        "point"}
+    },
+    {
+        {"out",         DATA_CURVE,     REQUIRED,
+                        "resulting curve, for inputs read as control signals"}
+    },
+    NULL,
+    curve_process,
+    NULL
+};
+
+enum CurveInputType {
+    PTS,
+    DUR,
+
+    NUM_INPUTS
+};
+
+/* matches enum CurveShape */
+static const char* shapeNames[] = {"step", "linear", "sine", "exp", NULL};
+
+static int parse_shape(const char* s, size_t len) {
+    unsigned int i;
+
+    for (i = 0; shapeNames[i]; i++) {
+        if (strlen(shapeNames[i]) == len && !strncmp(shapeNames[i], s, len)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const char* skip_space(const char* s) {
+    while (*s == ' ' || *s == '\t' || *s == '\n') s++;
+    return s;
+}
+
+static int parse_point(const char** str, struct CurvePoint* p) {
+    const char* cur = *str;
+    char* end;
+    size_t len;
+    int shape = CURVE_LINEAR;
+
+    p->time = strtod(cur, &end);
+    if (end == cur || *end != ':') return 0;
+    cur = end + 1;
+    p->value = strtod(cur, &end);
+    if (end == cur) return 0;
+    cur = end;
+    if (*cur == ':') {
+        cur++;
+        len = strcspn(cur, " \t\n");
+        if ((shape = parse_shape(cur, len)) < 0) return 0;
+        cur += len;
+    }
+    if (*cur && *cur != ' ' && *cur != '\t' && *cur != '\n') return 0;
+    p->shape = shape;
+    *str = cur;
+    return 1;
+}
+
+static int curve_process(struct Node* n) {
+    struct Data* out = n->outputs[0];
+    struct Curve* c = &out->content.curve;
+    const char* cur;
+    unsigned int num = 0, i;
+
+    GENERIC_CHECK_INPUTS(n, curve);
+
+    for (cur = skip_space(n->inputs[PTS]->content.str); *cur; num++) {
+        cur = skip_space(cur + strcspn(cur, " \t\n"));
+    }
+    if (!num) {
+        fprintf(stderr, "Error: %s: curve has no points\n", n->name);
+        return 0;
+    }
+    out->type = DATA_CURVE;
+    c->numPoints = 0;
+    if (!(c->points = malloc(num * sizeof(*c->points)))) {
+        fprintf(stderr, "Error: %s: can't allocate curve\n", n->name);
+        return 0;
+    }
+    cur = skip_space(n->inputs[PTS]->content.str);
+    for (i = 0; i < num; i++, cur = skip_space(cur)) {
+        struct CurvePoint* p = c->points + i;
+
+        if (!parse_point(&cur, p)) {
+            fprintf(stderr, "Error: %s: invalid point %u, "
+                    "expected 'time:value[:shape]'\n", n->name, i);
+            return 0;
+        } else if (p->time < 0 || (i && p->time < p[-1].time)) {
+            fprintf(stderr, "Error: %s: point %u: "
+                    "times must be positive and sorted\n", n->name, i);
+            return 0;
+        }
+        c->numPoints++;
+    }
+    c->duration = data_float(n->inputs[DUR], 0, c->points[num - 1].time);
+    if (c->duration < 0) {
+        fprintf(stderr, "Error: %s: invalid duration\n", n->name);
+        return 0;
+    }
+    out->ready = 1;
+    return 1;
+}
@@ -22,7 +22,8 @@ const struct Module noise = {
 
         {"interp",      DATA_STRING,    OPTIONAL,
                         "interpolation of resulting buffer, "
-                        "'step', 'linear' or 'sine'"}
+                        "'step', 'linear' or 'sine'",
+                        0, 0, interpNames}
     },
     {
         {"out",         DATA_BUFFER,    REQUIRED, "output signal"}
@@ -32,24 +33,30 @@ const struct Module noise = {
     NULL
 };
 
+enum NoiseInputType {
+    DUR,
+    SPL,
+    ITP,
+
+    NUM_INPUTS
+};
+
 static int noise_valid(struct Node* n) {
-    unsigned int i;
     struct Data* out;
     struct Buffer* buf;
 
-    for (i = 0; i < 3; i++) {
-        if (!data_valid(n->inputs[i], noise.inputs + i, n->name)) {
-            return 0;
-        }
-    }
+    GENERIC_CHECK_INPUTS(n, noise);
 
     out = n->outputs[0];
     buf = &out->content.buf;
 
     out->type = DATA_BUFFER;
-    buf->samplingRate = data_float(n->inputs[1], 0, 44100);
-    buf->size = n->inputs[0]->content.f * buf->samplingRate;
-    if ((buf->interp = data_parse_interp(n->inputs[2])) < 0) {
+    buf->samplingRate = node_rate(n, n->inputs[SPL], 44100, 0);
+    if (!node_size(n, n->inputs[DUR]->content.f, buf->samplingRate,
+                   &buf->size)) {
+        return 0;
+    }
+    if ((buf->interp = data_parse_interp(n->inputs[ITP])) < 0) {
         buf->interp = INTERP_STEP;
     }
     buf->data = NULL;
@@ -65,7 +72,7 @@ static int noise_process(struct Node* n) {
     mt_rand_init(&rng, 1);
 
     out = &n->outputs[0]->content.buf;
-    if (!(out->data = malloc(out->size * sizeof(float)))) {
+    if (!(out->data = buffer_alloc(out->size))) {
         return 0;
     }
     for (i = 0; i < out->size; i++) {
@@ -16,24 +16,38 @@
 
 #define OSC_MAX_PARAMS 6
 
+/* samples per period at least, at the control rate */
+#define CTL_PERIOD 16
+
 static int osc_process(struct Node* n);
 
+static const char* funNames[] = {
+    "sin",
+    "square",
+    "saw",
+    "input",
+    NULL
+};
+
 /* DECLARE_MODULE(osc) */
 const struct Module osc = {
     "osc", "generator", "A generator for sine, saw and square waves",
     {
         {"function",    DATA_STRING,                REQUIRED,
-                        "waveform: 'sin', 'square', 'saw' or 'input'"},
+                        "waveform: 'sin', 'square', 'saw' or 'input'",
+                        0, 0, funNames},
 
         {"waveform",    DATA_BUFFER,                OPTIONAL,
                         "buffer containing waveform, "
                         "used when 'input' is specified in 'function'"},
 
-        {"freq",        DATA_FLOAT | DATA_BUFFER,   REQUIRED,
-                        "frequency in Hz"},
+        {"freq",        DATA_CONTROL,               REQUIRED,
+                        "frequency in Hz",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
 
-        {"amplitude",   DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                        "amplitude in unit"},
+        {"amplitude",   DATA_CONTROL,               OPTIONAL,
+                        "amplitude in unit",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
 
         {"p_offset",    DATA_FLOAT,                 OPTIONAL,
                         "period offset, in period (1. = full period)"},
@@ -50,25 +64,32 @@ const struct Module osc = {
 
         {"interp",      DATA_STRING,                OPTIONAL,
                         "interpolation of the resulting buffer, "
-                        "'step', 'linear' or 'sine'"},
+                        "'step', 'linear' or 'sine'",
+                        0, 0, interpNames},
 
-        {"param0",      DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                        "wave parameter 0"},
+        {"param0",      DATA_CONTROL,               OPTIONAL,
+                        "wave parameter 0",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
 
-        {"param1",      DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                        "wave parameter 1"},
+        {"param1",      DATA_CONTROL,               OPTIONAL,
+                        "wave parameter 1",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
 
-        {"param2",      DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                        "wave parameter 2"},
+        {"param2",      DATA_CONTROL,               OPTIONAL,
+                        "wave parameter 2",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
 
-        {"param3",      DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                        "wave parameter 3"},
+        {"param3",      DATA_CONTROL,               OPTIONAL,
+                        "wave parameter 3",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
 
-        {"param4",      DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                        "wave parameter 4"},
+        {"param4",      DATA_CONTROL,               OPTIONAL,
+                        "wave parameter 4",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
 
-        {"param5",      DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                        "wave parameter 5"}
+        {"param5",      DATA_CONTROL,               OPTIONAL,
+                        "wave parameter 5",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED}
     },
     {
         {"out",         DATA_BUFFER,                REQUIRED,
@@ -76,7 +97,8 @@ const struct Module osc = {
     },
     NULL,
     osc_process,
-    NULL
+    NULL,
+    MOD_CONTROL | MOD_RANGED
 };
 
 enum OscInputType {
@@ -100,8 +122,14 @@ enum OscInputType {
     NUM_INPUTS
 };
 
+enum OscFunctionType {
+    FUN_SIN,
+    FUN_SQUARE,
+    FUN_SAW,
+    FUN_INPUT
+};
+
 struct OscFunction {
-    const char* name;
     float (*func)(float, float[]);
     unsigned int numParams;
 };
@@ -132,13 +160,22 @@ static float osc_saw(float t, float params[]) {
     return sign * (t - 0.5) / (t1 - 0.5);
 }
 
+/* indexed by OscFunctionType */
 static struct OscFunction functions[] = {
-    { "sin",    osc_sin,    0 },
-    { "square", osc_square, 1 },
-    { "saw",    osc_saw,    1 }
+    { osc_sin,    0 },
+    { osc_square, 1 },
+    { osc_saw,    1 }
 };
 
-static const int numFunctions = sizeof(functions) / sizeof(struct OscFunction);
+/* faster oscillations, or modulated ones, stay at full rate */
+static float osc_rate(struct Node* n) {
+    struct Data* freq = n->inputs[FRQ];
+    int slow = freq->type == DATA_FLOAT
+            && fabs(freq->content.f) * CTL_PERIOD
+               <= node_rate(n, n->inputs[SPL], DEF_SPL, 1);
+
+    return node_rate(n, n->inputs[SPL], DEF_SPL, slow);
+}
 
 static int osc_valid(struct Node* n) {
     struct Buffer* out;
@@ -155,99 +192,129 @@ static int osc_valid(struct Node* n) {
     n->outputs[OUT]->type = DATA_BUFFER;
     out = &n->outputs[OUT]->content.buf;
 
-    if (n->inputs[SPL]) out->samplingRate = n->inputs[SPL]->content.f;
-    else out->samplingRate = 44100;
+    out->samplingRate = osc_rate(n);
 
     if (!n->inputs[ITP]) out->interp = INTERP_LINEAR;
     else if ((out->interp = data_parse_interp(n->inputs[ITP])) < 0) return 0;
 
-    if (!strcmp(n->inputs[FUN]->content.str, "input") && !n->inputs[WAV]) {
+    if (       data_which_string(n->inputs[FUN], funNames) == FUN_INPUT
+            && !n->inputs[WAV]) {
         fprintf(stderr, "Error: %s: "
                         "function 'input' requires to set 'waveform'\n",
                         n->name);
         return 0;
     }
 
-    out->size = n->inputs[DUR]->content.f * out->samplingRate;
+    if (!node_size(n, n->inputs[DUR]->content.f, out->samplingRate,
+                   &out->size)) {
+        return 0;
+    }
     out->data = NULL;
     return 1;
 }
 
-static struct OscFunction* get_fun(const char* name) {
-    unsigned int i;
-    for (i = 0; i < numFunctions; i++) {
-        if (!strcmp(functions[i].name, name)) {
-            return &functions[i];
+static struct OscFunction* get_fun(struct Data* data) {
+    int i;
+
+    if ((i = data_which_string(data, funNames)) < 0 || i == FUN_INPUT) {
+        return NULL;
+    }
+    return &functions[i];
+}
+
+struct OscSlice {
+    struct Node* n;
+    struct OscFunction* fun;
+    float* data;
+    float s, t0, aoff;
+    unsigned int size;
+};
+
+/* the phase only depends on the frequency, it is accumulated up to the start
+ * of the slice without rendering, so that slices match the serial render
+ */
+static int osc_slice(void* ctx, unsigned int warm,
+                     unsigned int start, unsigned int end) {
+    struct OscSlice* o = ctx;
+    struct Node* n = o->n;
+    float f[BLOCK_SIZE], amp[BLOCK_SIZE], params[OSC_MAX_PARAMS][BLOCK_SIZE];
+    float s = o->s, t = o->t0, *data = o->data;
+    unsigned int i, j, m, size = o->size;
+
+    for (i = 0; i < start; i += m) {
+        m = start - i < BLOCK_SIZE ? start - i : BLOCK_SIZE;
+        data_floats(n->inputs[FRQ], f, i, m, size, DEF_FRQ);
+        for (j = 0; j < m; j++) {
+            t += f[j] / s;
+            if (t > 1) t -= 1;
+        }
+    }
+    for (i = start; i < end; i += m) {
+        m = end - i < BLOCK_SIZE ? end - i : BLOCK_SIZE;
+        data_floats(n->inputs[FRQ], f, i, m, size, DEF_FRQ);
+        data_floats(n->inputs[AMP], amp, i, m, size, DEF_AMP);
+        if (!o->fun) {
+            for (j = 0; j < m; j++) {
+                data[i + j] = amp[j] * interp(&n->inputs[WAV]->content.buf, t)
+                            + o->aoff;
+                t += f[j] / s;
+                if (t > 1) t -= 1;
+            }
+        } else {
+            float (*oscf)(float, float[]) = o->fun->func;
+            int k;
+
+            for (k = 0; k < o->fun->numParams; k++) {
+                data_floats(n->inputs[PR0 + k], params[k], i, m, size, 0);
+            }
+            for (j = 0; j < m; j++) {
+                float p[OSC_MAX_PARAMS];
+
+                for (k = 0; k < o->fun->numParams; k++) {
+                    p[k] = params[k][j];
+                }
+                data[i + j] = amp[j] * oscf(t, p) + o->aoff;
+                t += f[j] / s;
+                if (t > 1) t -= 1;
+            }
         }
     }
-    return NULL;
+    return 1;
 }
 
 static int osc_process(struct Node* n) {
     struct Data* out = n->outputs[OUT];
-    float f, s, d, t, amp, aoff, *data;
-    unsigned int i, size;
+    struct OscSlice o;
+    float s;
+    unsigned int size;
     struct OscFunction* fun;
 
     if (!osc_valid(n)) {
         fprintf(stderr, "Error: %s: invalid inputs\n", n->name);
         return 0;
     }
-    if (       !(fun = get_fun(n->inputs[FUN]->content.str))
-            && strcmp(n->inputs[FUN]->content.str, "input")) {
+    if (       !(fun = get_fun(n->inputs[FUN]))
+            && data_which_string(n->inputs[FUN], funNames) != FUN_INPUT) {
         fprintf(stderr, "Error: %s: invalid function: %s\n",
                         n->name,
                         n->inputs[FUN]->content.str);
         return 0;
     }
 
-    d = n->inputs[DUR]->content.f;
-    if (n->inputs[SPL]) {
-        s = n->inputs[SPL]->content.f;
-    } else {
-        s = DEF_SPL;
-    }
-    size = d * s;
-    if (!(data = malloc(size * sizeof(float)))) {
+    s = osc_rate(n);
+    size = out->content.buf.size;
+    if (!(o.data = buffer_alloc(size))) {
         return 0;
     }
 
-    t = data_float(n->inputs[POF], 0, 0);
-    aoff = data_float(n->inputs[AOF], 0, 0);
-    if (!fun) {
-        for (i = 0; i < size; i++) {
-            float x = (float) i / (float) size;
-
-            f = data_float(n->inputs[FRQ], x, DEF_FRQ);
-            amp = data_float(n->inputs[AMP], x, DEF_AMP);
-
-            data[i] = amp * interp(&n->inputs[WAV]->content.buf, t) + aoff;
-
-            t += f / s;
-            if (t > 1) t -= 1;
-        }
-    } else {
-        float (*oscf)(float, float[]) = fun->func;
-        for (i = 0; i < size; i++) {
-            float x = (float) i / (float) size;
-            float params[OSC_MAX_PARAMS];
-            int j;
-
-            f = data_float(n->inputs[FRQ], x, DEF_FRQ);
-            amp = data_float(n->inputs[AMP], x, DEF_AMP);
-            for (j = 0; j < fun->numParams; j++) {
-                params[j] = data_float(n->inputs[PR0 + j], x, 0);
-            }
-
-            data[i] = amp * oscf(t, params) + aoff;
-
-            t += f / s;
-            if (t > 1) t -= 1;
-        }
-    }
-
-    out->content.buf.data = data;
-    out->content.buf.size = d * s;
+    o.n = n;
+    o.fun = fun;
+    o.s = s;
+    o.size = size;
+    o.t0 = data_float(n->inputs[POF], 0, 0);
+    o.aoff = data_float(n->inputs[AOF], 0, 0);
+    out->content.buf.data = o.data;
+    if (!node_slice_run(n, &out->content.buf, 0, osc_slice, &o)) return 0;
     out->ready = 1;
     return 1;
 }
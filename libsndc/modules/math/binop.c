@@ -6,23 +6,38 @@
 
 static int binop_process(struct Node* n);
 
+/* indexed by BinopType */
+static const char* opNames[] = {
+    "add",
+    "sub",
+    "mul",
+    "div",
+    "min",
+    "max",
+    NULL
+};
+
 /* DECLARE_MODULE(binop) */
 const struct Module binop = {
     "binop", "math", "Binary operation between two buffers or numbers",
     {
-        {"input0",      DATA_BUFFER | DATA_FLOAT,   REQUIRED, "input #0"},
-        {"input1",      DATA_BUFFER | DATA_FLOAT,   REQUIRED, "input #1"},
+        {"input0",      DATA_BUFFER | DATA_FLOAT,   REQUIRED, "input #0",
+                        0, 0, NULL, DESC_TIMED},
+        {"input1",      DATA_CONTROL,               REQUIRED, "input #1",
+                        0, 0, NULL, DESC_INTERP},
 
         {"operator",    DATA_STRING,                REQUIRED,
-                        "operator: 'add', 'sub', 'mul', 'div', 'min', 'max'"},
+                        "operator: 'add', 'sub', 'mul', 'div', 'min', 'max'",
+                        0, 0, opNames},
     },
     {
-        {"out",     DATA_BUFFER,                REQUIRED,
+        {"out",     DATA_BUFFER | DATA_FLOAT,   REQUIRED,
                     "result, input0 'operator' input1"}
     },
     NULL,
     binop_process,
-    NULL
+    NULL,
+    MOD_CONTROL | MOD_INPLACE | MOD_RANGED
 };
 
 enum BinopInput {
@@ -32,6 +47,7 @@ enum BinopInput {
     NUM_INPUTS
 };
 
+/* matches enum KernelOp */
 enum BinopType {
     OP_ADD,
     OP_SUB,
@@ -44,40 +60,73 @@ enum BinopType {
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+struct BinopSlice {
+    struct Buffer* out;
+    const float* in0;
+    struct Data* in1;
+    int op;
+};
+
+static void binop_run(const struct BinopSlice* b,
+                      unsigned int start, unsigned int end) {
+    const struct Kernels* k = kernels_get();
+    float v[BLOCK_SIZE];
+    unsigned int i;
+
+    if (b->in1->type == DATA_FLOAT) {
+        k->binop(b->op, b->out->data + start, b->in0 + start,
+                 NULL, b->in1->content.f, end - start);
+        return;
+    }
+    for (i = start; i < end; i += BLOCK_SIZE) {
+        unsigned int m = end - i < BLOCK_SIZE ? end - i : BLOCK_SIZE;
+
+        data_floats(b->in1, v, i, m, b->out->size, 0);
+        k->binop(b->op, b->out->data + i, b->in0 + i, v, 0, m);
+    }
+}
+
+/* products of silent blocks of input0 are silent */
+static int binop_slice(void* ctx, unsigned int warm,
+                       unsigned int start, unsigned int end) {
+    struct BinopSlice* b = ctx;
+    unsigned int i, next;
+    int silent;
+
+    for (i = start; i < end; i = next) {
+        next = end;
+        silent = 0;
+        if (b->op == OP_MUL) next = buffer_silent_run(b->in0, i, end, &silent);
+        if (!silent) {
+            binop_run(b, i, next);
+        } else if (b->out->data != b->in0) {
+            memset(b->out->data + i, 0, (next - i) * sizeof(float));
+        }
+    }
+    return 1;
+}
+
 static int binop_process(struct Node* n) {
     struct Data *in0, *in1, *out;
-    unsigned int i;
+    struct BinopSlice b;
     int op;
-    const char* opstr;
 
     GENERIC_CHECK_INPUTS(n, binop);
 
     in0 = n->inputs[IN0];
     in1 = n->inputs[IN1];
     out = n->outputs[0];
-    opstr = n->inputs[OPE]->content.str;
-
-    if (!strcmp(opstr, "add")) {
-        op = OP_ADD;
-    } else if (!strcmp(opstr, "sub")) {
-        op = OP_SUB;
-    } else if (!strcmp(opstr, "mul")) {
-        op = OP_MUL;
-    } else if (!strcmp(opstr, "div")) {
-        op = OP_DIV;
-    } else if (!strcmp(opstr, "min")) {
-        op = OP_MIN;
-    } else if (!strcmp(opstr, "max")) {
-        op = OP_MAX;
-    } else {
-        fprintf(stderr, "Error: %s: invalid op: %s\n", n->name, opstr);
+
+    if ((op = data_which_string(n->inputs[OPE], opNames)) < 0) {
+        fprintf(stderr, "Error: %s: invalid op: %s\n",
+                n->name, n->inputs[OPE]->content.str);
         return 0;
     }
 
     if (in0->type == DATA_FLOAT) {
         if (in1->type != DATA_FLOAT) {
             fprintf(stderr, "Error: %s: "
-                    "input1 can't be a buffer if input0 is a float\n",
+                    "input1 must be a float if input0 is a float\n",
                     n->name);
             return 0;
         }
@@ -104,61 +153,15 @@ static int binop_process(struct Node* n) {
         out->type = DATA_FLOAT;
         return 1;
     }
-    memcpy(out, in0, sizeof(*out));
-    if (!(out->content.buf.data = malloc(out->content.buf.size
-                                         * sizeof(float)))) {
+    out->type = DATA_BUFFER;
+    out->content.buf = in0->content.buf;
+    b.in0 = in0->content.buf.data;
+    if (       !(out->content.buf.data = node_take_input(n, IN0))
+            && !(out->content.buf.data = buffer_alloc(out->content.buf.size))) {
         return 0;
     }
-
-    switch (op) {
-        case OP_ADD:
-            for (i = 0; i < out->content.buf.size; i++) {
-                float t = (float) i / (float) out->content.buf.size;
-
-                out->content.buf.data[i] = in0->content.buf.data[i]
-                                         + data_float(in1, t, 0);
-            }
-            break;
-        case OP_SUB:
-            for (i = 0; i < out->content.buf.size; i++) {
-                float t = (float) i / (float) out->content.buf.size;
-
-                out->content.buf.data[i] = in0->content.buf.data[i]
-                                         - data_float(in1, t, 0);
-            }
-            break;
-        case OP_MUL:
-            for (i = 0; i < out->content.buf.size; i++) {
-                float t = (float) i / (float) out->content.buf.size;
-
-                out->content.buf.data[i] = in0->content.buf.data[i]
-                                         * data_float(in1, t, 0);
-            }
-            break;
-        case OP_DIV:
-            for (i = 0; i < out->content.buf.size; i++) {
-                float t = (float) i / (float) out->content.buf.size;
-
-                out->content.buf.data[i] = in0->content.buf.data[i]
-                                         / data_float(in1, t, 0);
-            }
-            break;
-        case OP_MIN:
-            for (i = 0; i < out->content.buf.size; i++) {
-                float t = (float) i / (float) out->content.buf.size;
-
-                out->content.buf.data[i] = MIN(in0->content.buf.data[i],
-                                               data_float(in1, t, 0));
-            }
-            break;
-        case OP_MAX:
-            for (i = 0; i < out->content.buf.size; i++) {
-                float t = (float) i / (float) out->content.buf.size;
-
-                out->content.buf.data[i] = MAX(in0->content.buf.data[i],
-                                               data_float(in1, t, 0));
-            }
-            break;
-    }
-    return 1;
+    b.out = &out->content.buf;
+    b.in1 = in1;
+    b.op = op;
+    return node_slice_run(n, b.out, 0, binop_slice, &b);
 }
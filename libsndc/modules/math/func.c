@@ -28,35 +28,49 @@ const struct Module func = {
                         "sampling rate of resulting signal, def 44100"},
 
         {"interp",      DATA_STRING,    OPTIONAL,
-                        "interpolation of resulting buffer, def 'linear'"},
-
-        {"param0",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 0 for mathematical function, '$0'"},
-        {"param1",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 1 for mathematical function, '$1'"},
-        {"param2",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 2 for mathematical function, '$2'"},
-        {"param3",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 3 for mathematical function, '$3'"},
-        {"param4",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 4 for mathematical function, '$4'"},
-        {"param5",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 5 for mathematical function, '$5'"},
-        {"param6",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 6 for mathematical function, '$6'"},
-        {"param7",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 7 for mathematical function, '$7'"},
-        {"param8",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 8 for mathematical function, '$8'"},
-        {"param9",      DATA_FLOAT | DATA_BUFFER,     OPTIONAL,
-                        "param 9 for mathematical function, '$9'"},
+                        "interpolation of resulting buffer, def 'linear'",
+                        0, 0, interpNames},
+
+        {"param0",      DATA_CONTROL,                 OPTIONAL,
+                        "param 0 for mathematical function, '$0'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"param1",      DATA_CONTROL,                 OPTIONAL,
+                        "param 1 for mathematical function, '$1'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"param2",      DATA_CONTROL,                 OPTIONAL,
+                        "param 2 for mathematical function, '$2'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"param3",      DATA_CONTROL,                 OPTIONAL,
+                        "param 3 for mathematical function, '$3'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"param4",      DATA_CONTROL,                 OPTIONAL,
+                        "param 4 for mathematical function, '$4'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"param5",      DATA_CONTROL,                 OPTIONAL,
+                        "param 5 for mathematical function, '$5'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"param6",      DATA_CONTROL,                 OPTIONAL,
+                        "param 6 for mathematical function, '$6'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"param7",      DATA_CONTROL,                 OPTIONAL,
+                        "param 7 for mathematical function, '$7'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"param8",      DATA_CONTROL,                 OPTIONAL,
+                        "param 8 for mathematical function, '$8'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"param9",      DATA_CONTROL,                 OPTIONAL,
+                        "param 9 for mathematical function, '$9'",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
     },
     {
-        {"out",         DATA_BUFFER,    REQUIRED, "resulting signal"}
+        {"out",         DATA_BUFFER | DATA_CURVE,   REQUIRED,
+                        "resulting signal, a curve for linear and "
+                        "exponential expressions at the control rate"}
     },
     NULL,
     func_process,
-    NULL
+    NULL,
+    MOD_CONTROL | MOD_RANGED
 };
 
 enum InputType {
@@ -118,22 +132,25 @@ static const int tkprec[] = {
     0, 0, 4, 4, 3, 3, 2, 1, 7, 7, 6, 6, 6, 6, 0, 0, 0, 0, 0, 0, 0
 };
 
+/* expressions are evaluated in double, $t and $s telling apart the samples
+ * of signals hours long
+ */
 struct FnMathFunc {
     const char* name;
-    float (*func)(float);
+    double (*func)(double);
 };
 
 static const struct FnMathFunc functions[] = {
-    {"exp", expf},
-    {"log", logf},
-    {"sqrt", sqrtf},
+    {"exp", exp},
+    {"log", log},
+    {"sqrt", sqrt},
 
-    {"sin", sinf},
-    {"cos", cosf},
-    {"tan", tanf},
-    {"asin", asinf},
-    {"acos", acosf},
-    {"atan", atanf},
+    {"sin", sin},
+    {"cos", cos},
+    {"tan", tan},
+    {"asin", asin},
+    {"acos", acos},
+    {"atan", atan},
 
     {NULL, NULL}
 };
@@ -142,8 +159,8 @@ struct FnToken {
     enum FnTokenType type;
     union FnTokenValue {
         unsigned int n;
-        float f;
-        float (*func)(float);
+        double f;
+        double (*func)(double);
     } val;
 };
 
@@ -155,13 +172,17 @@ static int func_setup(struct Node* n) {
     n->outputs[0]->type = DATA_BUFFER;
     out = &n->outputs[0]->content.buf;
 
-    if (n->inputs[SPL]) out->samplingRate = n->inputs[SPL]->content.f;
-    else out->samplingRate = 44100;
+    /* sample numbers depend on the rate */
+    out->samplingRate = node_rate(n, n->inputs[SPL], 44100,
+                                  !strstr(n->inputs[FUN]->content.str, "$n"));
 
     if (!n->inputs[ITP]) out->interp = INTERP_LINEAR;
     else if ((out->interp = data_parse_interp(n->inputs[ITP])) < 0) return 0;
 
-    out->size = n->inputs[DUR]->content.f * out->samplingRate;
+    if (!node_size(n, n->inputs[DUR]->content.f, out->samplingRate,
+                   &out->size)) {
+        return 0;
+    }
     out->data = NULL;
     return 1;
 }
@@ -178,7 +199,7 @@ static void print_stack(struct FnToken* stack, unsigned int len) {
     for (i = 0 ; i < len; i++) print_token(stack + i);
 }
 
-static float (*get_func(const char* f, const char* (*end)))(float) {
+static double (*get_func(const char* f, const char* (*end)))(double) {
     const char* cur = f;
     unsigned int i;
 
@@ -268,7 +289,7 @@ static const char* next_token(const char* func,
     }
     if (func[0] >= '0' && func[0] <= '9') {
         tk->type = FN_LIT;
-        tk->val.f = strtof(func, (char**) &end);
+        tk->val.f = strtod(func, (char**) &end);
         return end;
     }
     if ((tk->val.func = get_func(func, &end))) {
@@ -290,13 +311,14 @@ static const char* next_token(const char* func,
 
 static int eval_stack(struct FnToken* expr,
                       unsigned int len,
-                      float s,
-                      float t,
+                      double s,
+                      double t,
                       unsigned int n,
+                      unsigned int size,
                       struct Data* params[10],
                       float* res) {
     unsigned int i = 0;
-    float stack[FN_STACK_SIZE];
+    double stack[FN_STACK_SIZE];
     unsigned int stackLen = 0;
 
     for (i = 0; i < len; i++) {
@@ -315,7 +337,7 @@ static int eval_stack(struct FnToken* expr,
                 break;
             case FN_I:
                 STACK_PUSH(stack,
-                           data_float(params[expr[i].val.n], s, 0),
+                           data_float_at(params[expr[i].val.n], n, size, 0),
                            stackLen);
                 break;
             case FN_NEG:
@@ -396,19 +418,232 @@ static int eval_stack(struct FnToken* expr,
     return 1;
 }
 
+/* Expressions linear or exponential in $s and $t, with constant params,
+ * are output as curves when the node is at the control rate and its
+ * readers accept them, see control.c. Their forms are evaluated like the
+ * expression, constants being linear forms with a null slope.
+ */
+enum FnFormType {
+    FORM_LIN,   /* a * $s + b */
+    FORM_EXP    /* a * exp(b * $s) */
+};
+
+struct FnForm {
+    enum FnFormType type;
+    float a, b;
+};
+
+#define IS_CONST(f) ((f).type == FORM_LIN && (f).a == 0)
+
+static void form_scale(struct FnForm* f, float c) {
+    f->a *= c;
+    if (f->type == FORM_LIN) f->b *= c;
+}
+
+/* x = x op y, 0 if the result has no form */
+static int form_binop(int op, struct FnForm* x, const struct FnForm* y) {
+    int cx = IS_CONST(*x), cy = IS_CONST(*y);
+    int exps = x->type == FORM_EXP && y->type == FORM_EXP;
+    float c;
+
+    if (cx && cy && op >= FN_EQU && op <= FN_GEQ) {
+        switch (op) {
+            case FN_EQU: x->b = x->b == y->b; break;
+            case FN_NEQ: x->b = x->b != y->b; break;
+            case FN_LT: x->b = x->b < y->b; break;
+            case FN_GT: x->b = x->b > y->b; break;
+            case FN_LEQ: x->b = x->b <= y->b; break;
+            case FN_GEQ: x->b = x->b >= y->b; break;
+        }
+        return 1;
+    }
+    switch (op) {
+        case FN_PLUS:
+        case FN_MINUS:
+            if (x->type != FORM_LIN || y->type != FORM_LIN) return 0;
+            c = op == FN_PLUS ? 1 : -1;
+            x->a += c * y->a;
+            x->b += c * y->b;
+            return 1;
+        case FN_MULT:
+            if (cx) {
+                c = x->b;
+                *x = *y;
+                form_scale(x, c);
+            } else if (cy) {
+                form_scale(x, y->b);
+            } else if (exps) {
+                x->a *= y->a;
+                x->b += y->b;
+            } else {
+                return 0;
+            }
+            return 1;
+        case FN_DIV:
+            if (cy) {
+                form_scale(x, 1 / y->b);
+            } else if (exps || (cx && y->type == FORM_EXP)) {
+                x->a = (cx ? x->b : x->a) / y->a;
+                x->b = (cx ? 0 : x->b) - y->b;
+                x->type = FORM_EXP;
+            } else {
+                return 0;
+            }
+            return 1;
+        case FN_POW:
+            if (cx && cy) {
+                x->b = pow(x->b, y->b);
+            } else if (cx && x->b > 0 && y->type == FORM_LIN) {
+                c = x->b;
+                x->type = FORM_EXP;
+                x->a = pow(c, y->b);
+                x->b = y->a * log(c);
+            } else if (cy && x->type == FORM_EXP && x->a > 0) {
+                x->a = pow(x->a, y->b);
+                x->b *= y->b;
+            } else {
+                return 0;
+            }
+            return 1;
+    }
+    return 0;
+}
+
+static int eval_form(struct FnToken* expr,
+                     unsigned int len,
+                     float duration,
+                     struct Data* params[10],
+                     struct FnForm* res) {
+    struct FnForm stack[FN_STACK_SIZE], f;
+    unsigned int i, stackLen = 0;
+
+    for (i = 0; i < len; i++) {
+        struct FnForm* top = stack + stackLen - 1;
+
+        f.type = FORM_LIN;
+        f.a = f.b = 0;
+        switch (expr[i].type) {
+            case FN_LIT:
+                f.b = expr[i].val.f;
+                STACK_PUSH(stack, f, stackLen);
+                break;
+            case FN_S:
+                f.a = 1;
+                STACK_PUSH(stack, f, stackLen);
+                break;
+            case FN_T:
+                f.a = duration;
+                STACK_PUSH(stack, f, stackLen);
+                break;
+            case FN_I:
+                if (       params[expr[i].val.n]
+                        && params[expr[i].val.n]->type != DATA_FLOAT) {
+                    return 0;
+                }
+                f.b = data_float(params[expr[i].val.n], 0, 0);
+                STACK_PUSH(stack, f, stackLen);
+                break;
+            case FN_NEG:
+                if (stackLen < 1) return 0;
+                form_scale(top, -1);
+                break;
+            case FN_FUN:
+                if (stackLen < 1) return 0;
+                if (IS_CONST(*top)) {
+                    top->b = expr[i].val.func(top->b);
+                } else if (top->type == FORM_LIN
+                        && expr[i].val.func == exp) {
+                    f.type = FORM_EXP;
+                    f.a = exp(top->b);
+                    f.b = top->a;
+                    *top = f;
+                } else {
+                    return 0;
+                }
+                break;
+            default:
+                if (stackLen < 2 || !form_binop(expr[i].type, top - 1, top)) {
+                    return 0;
+                }
+                stackLen--;
+                break;
+        }
+    }
+    if (stackLen != 1) return 0;
+    *res = stack[0];
+    return 1;
+}
+
+/* the expression as a curve, 0 if it has no form */
+static int func_curve(struct Node* n, struct FnToken* queue, unsigned int len) {
+    struct Data* out = n->outputs[0];
+    struct CurvePoint* p;
+    struct FnForm f;
+    float duration = n->inputs[DUR]->content.f, v0, v1;
+
+    if (       !(duration > 0)
+            || !eval_form(queue, len, duration, n->inputs + PM0, &f)) {
+        return 0;
+    }
+    if (f.type == FORM_LIN) {
+        v0 = f.b;
+        v1 = f.a + f.b;
+    } else {
+        v0 = f.a;
+        v1 = f.a * exp(f.b);
+        if (!(v0 * v1 > 0) || !(v1 - v1 == 0)) return 0;
+    }
+    if (!(v0 - v0 == 0 && v1 - v1 == 0)) return 0;
+    if (!(p = malloc(2 * sizeof(*p)))) return 0;
+    p[0].time = 0;
+    p[0].value = v0;
+    p[0].shape = CURVE_LINEAR;
+    p[1].time = duration;
+    p[1].value = v1;
+    p[1].shape = f.type == FORM_LIN ? CURVE_LINEAR : CURVE_EXP;
+    out->type = DATA_CURVE;
+    out->content.curve.points = p;
+    out->content.curve.numPoints = 2;
+    out->content.curve.duration = duration;
+    return 1;
+}
+
+struct FuncSlice {
+    struct FnToken* queue;
+    unsigned int queueLen;
+    struct Data** params;
+    struct Buffer* out;
+};
+
+static int func_slice(void* ctx, unsigned int warm,
+                      unsigned int start, unsigned int end) {
+    struct FuncSlice* f = ctx;
+    unsigned int i;
+
+    for (i = start; i < end; i++) {
+        double s = (double) i / f->out->size;
+        double t = (double) i / f->out->samplingRate;
+
+        if (!eval_stack(f->queue, f->queueLen,
+                        s, t, i, f->out->size, f->params,
+                        f->out->data + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 static int func_process(struct Node* n) {
     struct Buffer* out = &n->outputs[0]->content.buf;
+    struct FuncSlice f;
     struct FnToken token, prevToken = {0};
     struct FnToken queue[FN_STACK_SIZE], opStack[FN_STACK_SIZE];
-    unsigned int queueLen = 0, opStackLen = 0, i;
+    unsigned int queueLen = 0, opStackLen = 0;
     int err;
     const char* cur;
 
     if (!func_setup(n)) return 0;
 
-    if (!(out->data = malloc(out->size * sizeof(float)))) {
-        return 0;
-    }
     cur = n->inputs[FUN]->content.str;
 
     /* shunting yard algorithm, see: 
@@ -482,18 +717,21 @@ static int func_process(struct Node* n) {
         }
         STACK_PUSH(queue, opStack[opStackLen - 1], queueLen);
     }
-    for (i = 0; i < out->size; i++) {
-        float s = (float) i / (float) out->size;
-        float t = (float) i / (float) out->samplingRate;
-
-        if (!eval_stack(queue, queueLen,
-                        s, t, i, n->inputs + PM0,
-                        out->data + i)) {
-            fprintf(stderr, "Error: %s: "
-                    "stack error, expression might be incorrect\n",
-                    n->name);
-            return 0;
-        }
+    if (n->curve && func_curve(n, queue, queueLen)) {
+        return 1;
+    }
+    if (!(out->data = buffer_alloc(out->size))) {
+        return 0;
+    }
+    f.queue = queue;
+    f.queueLen = queueLen;
+    f.params = n->inputs + PM0;
+    f.out = out;
+    if (!node_slice_run(n, out, 0, func_slice, &f)) {
+        fprintf(stderr, "Error: %s: "
+                "stack error, expression might be incorrect\n",
+                n->name);
+        return 0;
     }
     return 1;
 }
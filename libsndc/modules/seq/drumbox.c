@@ -16,13 +16,20 @@ const struct Module drumbox = {
         {"divs",        DATA_FLOAT,     OPTIONAL,
                         "number of subdivision per beat, def 4"},
 
-        {"sample0",     DATA_BUFFER,    REQUIRED, "sample #0"},
-        {"sample1",     DATA_BUFFER,    OPTIONAL, "sample #1"},
-        {"sample2",     DATA_BUFFER,    OPTIONAL, "sample #2"},
-        {"sample3",     DATA_BUFFER,    OPTIONAL, "sample #3"},
-        {"sample4",     DATA_BUFFER,    OPTIONAL, "sample #4"},
-        {"sample5",     DATA_BUFFER,    OPTIONAL, "sample #5"},
-        {"sample6",     DATA_BUFFER,    OPTIONAL, "sample #6"},
+        {"sample0",     DATA_BUFFER,    REQUIRED, "sample #0",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample1",     DATA_BUFFER,    OPTIONAL, "sample #1",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample2",     DATA_BUFFER,    OPTIONAL, "sample #2",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample3",     DATA_BUFFER,    OPTIONAL, "sample #3",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample4",     DATA_BUFFER,    OPTIONAL, "sample #4",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample5",     DATA_BUFFER,    OPTIONAL, "sample #5",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample6",     DATA_BUFFER,    OPTIONAL, "sample #6",
+                        0, 0, NULL, DESC_SAME_RATE},
 
         {"seq0",        DATA_STRING,    REQUIRED,
                         "sequence #0, "
@@ -41,7 +48,8 @@ const struct Module drumbox = {
     },
     NULL,
     drumbox_process,
-    NULL
+    NULL,
+    MOD_RANGED
 };
 
 enum DrumboxInputType {
@@ -127,13 +135,12 @@ static int drumbox_valid(struct Node* n) {
     n->outputs[0]->type = DATA_BUFFER;
     out = &n->outputs[0]->content.buf;
     out->samplingRate = rate;
-    divsize = ((float) rate * 60. / (bpm * divs));
-    out->size = sl * divsize + maxl;
-    return 1;
+    return buffer_size(n->name, (float) rate * 60. / (bpm * divs), &divsize)
+        && buffer_size(n->name, (double) sl * divsize + maxl, &out->size);
 }
 
 static int drumbox_process(struct Node* n) {
-    unsigned int i, dx;
+    unsigned int i, dx, lo, hi;
     struct Buffer* out;
     float bpm, divs;
 
@@ -141,7 +148,7 @@ static int drumbox_process(struct Node* n) {
 
     out = &n->outputs[0]->content.buf;
 
-    if (!(out->data = calloc(out->size, sizeof(float)))) {
+    if (!(out->data = buffer_calloc(out->size))) {
         fprintf(stderr, "Error: node %s: can't allocate output buffer\n",
                 n->name);
         return 0;
@@ -150,6 +157,8 @@ static int drumbox_process(struct Node* n) {
     divs = data_float(n->inputs[DIVS], 0, 4);
     bpm = data_float(n->inputs[BPM], 0, 120);
     dx = ((float) out->samplingRate * 60. / (bpm * divs));
+    /* only the hits sounding in the range rendered */
+    node_range(n, out->samplingRate, out->size, &lo, &hi);
 
     for (i = 0; i <= 6; i++) {
         if (n->inputs[SEQ0 + i]) {
@@ -161,12 +170,18 @@ static int drumbox_process(struct Node* n) {
                     case '-':
                         x += dx;
                         break;
-                    case 'x':
-                        addbuf(out->data + x,
-                               n->inputs[SPL0 + i]->content.buf.data,
-                               n->inputs[SPL0 + i]->content.buf.size);
+                    case 'x': {
+                        struct Buffer* spl = &n->inputs[SPL0 + i]->content.buf;
+                        unsigned int a = x > lo ? x : lo;
+                        unsigned int b = x + spl->size < hi
+                                       ? x + spl->size : hi;
+
+                        if (a < b) {
+                            addbuf(out->data + a, spl->data + a - x, b - a);
+                        }
                         x += dx;
                         break;
+                    }
                     default:
                         break;
                 }
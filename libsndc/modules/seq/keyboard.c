@@ -45,13 +45,28 @@ enum KeyboardInputType {
     NUM_INPUTS
 };
 
+enum InstrumentData {
+    INST_FREQ,
+    INST_VELOC,
+    INST_SUS,
+
+    NUM_INST_DATA
+};
+
+/* the instrument node, with its inputs and output resolved once at setup */
+struct Instrument {
+    struct Node node;
+    struct Data data[NUM_INST_DATA];
+    struct Data* out;
+};
+
 static int keyboard_setup(struct Node* n) {
     const char* instPath;
     char* fullInstPath = NULL;
     struct Module* mod = NULL;
-    struct Node* instNode = NULL;
-    struct Data* data = NULL;
-    int mi = 0;
+    struct Instrument* inst = NULL;
+    struct Node* instNode;
+    int mi = 0, i;
 
     if (!n->inputs[INS] || n->inputs[INS]->type != DATA_STRING) {
         fprintf(stderr, "Error: %s:"
@@ -62,19 +77,19 @@ static int keyboard_setup(struct Node* n) {
 
     instPath = n->inputs[INS]->content.str;
 
-    if (       !(mod = malloc(sizeof(*mod)))
-            || !(instNode = malloc(sizeof(*instNode)))
-            || !(data = malloc(4 * sizeof(*data)))
+    if (       !(mod = calloc(1, sizeof(*mod)))
+            || !(inst = malloc(sizeof(*inst)))
             || !(fullInstPath = malloc(   strlen(n->path)
                                         + strlen(instPath) + 1))) {
         fprintf(stderr, "Error: %s: malloc failed\n", n->name);
         goto exit_err;
     }
+    instNode = &inst->node;
     node_init(instNode);
-    data_init(data);
-    data_init(data + 1);
-    data_init(data + 2);
-    data_init(data + 3);
+    instNode->name = NULL;
+    for (i = 0; i < NUM_INST_DATA; i++) {
+        data_init(inst->data + i);
+    }
 
     strcpy(fullInstPath, n->path);
     strcpy(fullInstPath + strlen(n->path), instPath);
@@ -84,6 +99,7 @@ static int keyboard_setup(struct Node* n) {
         goto exit_err;
     }
     free(fullInstPath);
+    fullInstPath = NULL;
 
     if (       module_get_input_slot(mod, "frequency") < 0
             || module_get_input_slot(mod, "velocity") < 0
@@ -108,16 +124,19 @@ static int keyboard_setup(struct Node* n) {
     instNode->process = mod->process;
     instNode->teardown = mod->teardown;
 
-    instNode->inputs[module_get_input_slot(mod, "frequency")] = data;
-    instNode->inputs[module_get_input_slot(mod, "velocity")] = data + 1;
-    instNode->inputs[module_get_input_slot(mod, "sustain")] = data + 2;
-    instNode->outputs[module_get_output_slot(mod, "out")] = data + 3;
+    instNode->inputs[module_get_input_slot(mod, "frequency")] =
+        inst->data + INST_FREQ;
+    instNode->inputs[module_get_input_slot(mod, "velocity")] =
+        inst->data + INST_VELOC;
+    instNode->inputs[module_get_input_slot(mod, "sustain")] =
+        inst->data + INST_SUS;
 
     if (instNode->setup && !instNode->setup(instNode)) {
         fprintf(stderr, "Error: %s: could not setup instrument\n", n->name);
         goto exit_err;
     }
-    n->data = instNode;
+    inst->out = instNode->outputs[module_get_output_slot(mod, "out")];
+    n->data = inst;
     n->isSetup = 1;
     return 1;
 
@@ -126,25 +145,23 @@ exit_err:
         module_free_import(mod);
     }
     free(mod);
-    if (instNode) {
-        free((char*)instNode->name);
+    if (inst) {
+        free((char*)inst->node.name);
     }
-    free(instNode);
-    free(data);
+    free(inst);
     free(fullInstPath);
     return 0;
 }
 
 static int keyboard_teardown(struct Node* n) {
-    struct Node* inst;
+    struct Instrument* inst;
 
     if (n->isSetup) {
         inst = n->data;
 
-        free(inst->inputs[module_get_input_slot(inst->module, "frequency")]);
-        module_free_import((struct Module*)inst->module);
-        free((void*)inst->module);
-        node_free(inst);
+        module_free_import((struct Module*)inst->node.module);
+        free((void*)inst->node.module);
+        node_free(&inst->node);
         free(inst);
     }
     return 1;
@@ -170,6 +187,7 @@ static int load_notes(struct Node* n,
 
     if (!(fullpath = malloc(strlen(n->path) + strlen(filename) + 1))) {
         fprintf(stderr, "Error: load_notes: can't allocate fullpath\n");
+        ok = 0;
     } else {
         strcpy(fullpath, n->path);
         strcpy(fullpath + strlen(n->path), filename);
@@ -179,15 +197,15 @@ static int load_notes(struct Node* n,
     return ok;
 }
 
-static void inst_set_note(struct Node* inst, struct Note* note, float bpm) {
+static void inst_set_note(struct Instrument* inst,
+                          struct Note* note,
+                          float bpm) {
     struct Data *frequency, *velocity, *sustain;
-    const struct Module* mod;
     float dt = 60. / bpm;
 
-    mod = inst->module;
-    frequency = inst->inputs[module_get_input_slot(mod, "frequency")];
-    velocity = inst->inputs[module_get_input_slot(mod, "velocity")];
-    sustain = inst->inputs[module_get_input_slot(mod, "sustain")];
+    frequency = inst->data + INST_FREQ;
+    velocity = inst->data + INST_VELOC;
+    sustain = inst->data + INST_SUS;
 
     frequency->type = DATA_FLOAT;
     frequency->content.f = note->freq;
@@ -200,16 +218,20 @@ static void inst_set_note(struct Node* inst, struct Note* note, float bpm) {
 static int buffer_mix(struct Buffer* dest,
                       struct Buffer* src,
                       unsigned int offset) {
-    if (dest->size < offset + src->size) {
+    unsigned int end;
+
+    if (!buffer_size("buffer_mix", (double) offset + src->size, &end)) {
+        return 0;
+    } else if (dest->size < end) {
         void* tmp;
-        unsigned int newSize = offset + src->size, i;
+        unsigned int newSize = end, i;
 
-        if (!(tmp = realloc(dest->data, newSize * sizeof(float)))) {
+        if (!(tmp = buffer_realloc(dest->data, newSize))) {
             fprintf(stderr, "Error: buffer_mix: can't realloc buffer\n");
             return 0;
         }
         dest->data = tmp;
-        for (i = dest->size; i < offset + src->size; i++) {
+        for (i = dest->size; i < end; i++) {
             dest->data[i] = 0.;
         }
         dest->size = newSize;
@@ -218,24 +240,47 @@ static int buffer_mix(struct Buffer* dest,
     return 1;
 }
 
+/* instruments rendering at another rate are resampled to the output's, notes
+ * are mixed up to the end of their tail, instruments rendering a fixed
+ * duration whatever the sustain
+ */
+static int note_mix(struct Buffer* dest,
+                    struct Buffer* src,
+                    unsigned int offset) {
+    struct Buffer note = *src, tmp;
+    int ok;
+
+    note.size = tail_end(src->data, 0, src->size, src->samplingRate);
+    if (src->samplingRate == dest->samplingRate) {
+        return buffer_mix(dest, &note, offset);
+    }
+    if (!resample_buffer(&tmp, &note, dest->samplingRate, RESAMPLE_BEST)) {
+        return 0;
+    }
+    ok = buffer_mix(dest, &tmp, offset);
+    buffer_free(tmp.data);
+    return ok;
+}
+
 static int keyboard_process(struct Node* n) {
-    struct Node* inst;
-    const struct Module* mod;
+    struct Instrument* inst;
+    struct Node* instNode;
     struct Buffer *outbuf, *instout;
     struct Note* notes;
     unsigned int numNotes, divs;
-    float bpm, dt, divdt;
+    float bpm;
+    /* in double, for notes hours into the sequence to start on their sample */
+    double dt, divdt;
 
     GENERIC_CHECK_INPUTS(n, keyboard);
 
     inst = n->data;
-    mod = inst->module;
-
-    instout = &inst->outputs[module_get_output_slot(mod, "out")]->content.buf;
+    instNode = &inst->node;
+    instout = &inst->out->content.buf;
 
     n->outputs[0]->type = DATA_BUFFER;
     outbuf = &n->outputs[0]->content.buf;
-    outbuf->samplingRate = 44100;
+    outbuf->samplingRate = render_rate(44100);
     outbuf->interp = INTERP_LINEAR;
     outbuf->size = 0;
 
@@ -259,21 +304,19 @@ static int keyboard_process(struct Node* n) {
         for (i = 0; ok && i < numNotes; i++) {
             unsigned int pos;
 
-            pos = (notes[i].beat * dt + notes[i].div * divdt)
-                  * outbuf->samplingRate;
             inst_set_note(inst, notes + i, bpm);
-            if (!inst->process(inst)) {
-                fprintf(stderr, "Error: %s: instrument failed\n", n->name);
+            if (!buffer_size(n->name, (notes[i].beat * dt
+                                       + notes[i].div * divdt)
+                                      * outbuf->samplingRate, &pos)) {
                 ok = 0;
-            } else if (instout->samplingRate != outbuf->samplingRate) {
-                fprintf(stderr, "Error: %s: instrument has bad sampling rate. "
-                                "Needs 44100\n", n->name);
+            } else if (!instNode->process(instNode)) {
+                fprintf(stderr, "Error: %s: instrument failed\n", n->name);
                 ok = 0;
-            } else if (!buffer_mix(outbuf, instout, pos)) {
+            } else if (!note_mix(outbuf, instout, pos)) {
                 fprintf(stderr, "Error: %s: mixing failed\n", n->name);
                 ok = 0;
             } else {
-                node_flush_output(inst);
+                node_flush_output(instNode);
             }
         }
         free(notes);
@@ -21,25 +21,38 @@ const struct Module layout = {
         {"file",        DATA_STRING,    REQUIRED,
                         "sequence layout file"},
 
-        {"sample0",     DATA_BUFFER,    REQUIRED, "sample #0"},
-        {"sample1",     DATA_BUFFER,    OPTIONAL, "sample #1"},
-        {"sample2",     DATA_BUFFER,    OPTIONAL, "sample #2"},
-        {"sample3",     DATA_BUFFER,    OPTIONAL, "sample #3"},
-        {"sample4",     DATA_BUFFER,    OPTIONAL, "sample #4"},
-        {"sample5",     DATA_BUFFER,    OPTIONAL, "sample #5"},
-        {"sample6",     DATA_BUFFER,    OPTIONAL, "sample #6"},
-        {"sample7",     DATA_BUFFER,    OPTIONAL, "sample #7"},
-        {"sample8",     DATA_BUFFER,    OPTIONAL, "sample #8"},
-        {"sample9",     DATA_BUFFER,    OPTIONAL, "sample #9"},
-        {"sample10",    DATA_BUFFER,    OPTIONAL, "sample #10"},
-        {"sample11",    DATA_BUFFER,    OPTIONAL, "sample #11"},
+        {"sample0",     DATA_BUFFER,    REQUIRED, "sample #0",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample1",     DATA_BUFFER,    OPTIONAL, "sample #1",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample2",     DATA_BUFFER,    OPTIONAL, "sample #2",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample3",     DATA_BUFFER,    OPTIONAL, "sample #3",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample4",     DATA_BUFFER,    OPTIONAL, "sample #4",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample5",     DATA_BUFFER,    OPTIONAL, "sample #5",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample6",     DATA_BUFFER,    OPTIONAL, "sample #6",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample7",     DATA_BUFFER,    OPTIONAL, "sample #7",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample8",     DATA_BUFFER,    OPTIONAL, "sample #8",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample9",     DATA_BUFFER,    OPTIONAL, "sample #9",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample10",    DATA_BUFFER,    OPTIONAL, "sample #10",
+                        0, 0, NULL, DESC_SAME_RATE},
+        {"sample11",    DATA_BUFFER,    OPTIONAL, "sample #11",
+                        0, 0, NULL, DESC_SAME_RATE},
     },
     {
         {"out",         DATA_BUFFER,    REQUIRED, "output, full sequence"}
     },
     NULL,
     layout_process,
-    NULL
+    NULL,
+    MOD_RANGED
 };
 
 enum LayoutInput {
@@ -63,9 +76,10 @@ enum LayoutInput {
     NUM_INPUTS
 };
 
+/* in samples, checked against the size of a buffer once all are read */
 struct Layer {
-    unsigned int start;
-    unsigned int end;
+    unsigned long start;
+    unsigned long end;
 };
 
 struct LayerArray {
@@ -145,6 +159,13 @@ static struct Layer* new_layer(struct LayerArray* layers) {
     return NULL;
 }
 
+/* steps are counted rather than summed in samples, so that a beat not
+ * falling on a sample doesn't shift the following ones
+ */
+static unsigned long step_start(const struct Context* ctx, unsigned int step) {
+    return (unsigned long) step * 60 * ctx->sampling / ctx->bpm;
+}
+
 static int parse_layers(struct Context* ctx,
                         FILE* f,
                         struct LayerArray* layers,
@@ -169,22 +190,21 @@ static int parse_layers(struct Context* ctx,
         struct Layer* cur = NULL;
         int token;
         unsigned int pos = array->scope;
-        unsigned int incr = 60 * ctx->sampling / ctx->bpm;
 
         while ((token = next_token(f, NULL))) {
             switch (token) {
                 case LTK_OSB:
-                    if (cur) cur->end = pos;
+                    if (cur) cur->end = step_start(ctx, pos);
                     if (!(cur = new_layer(array))) return 0;
-                    cur->start = pos;
-                    pos += incr;
+                    cur->start = step_start(ctx, pos);
+                    pos++;
                     break;
                 case LTK_MINUS:
                     if (cur) {
-                        cur->end = pos;
+                        cur->end = step_start(ctx, pos);
                         cur = NULL;
                     }
-                    pos += incr;
+                    pos++;
                     break;
                 case LTK_EQUAL:
                     if (!cur) {
@@ -192,14 +212,14 @@ static int parse_layers(struct Context* ctx,
                                         "'=' mut be preceded by '=' or '['\n");
                         return 0;
                     }
-                    pos += incr;
+                    pos++;
                     break;
                 case LTK_NEWLINE:
-                    if (cur) cur->end = pos;
+                    if (cur) cur->end = step_start(ctx, pos);
                     array->scope = pos;
                     return 1;
                 case LTK_EOF:
-                    if (cur) cur->end = pos;
+                    if (cur) cur->end = step_start(ctx, pos);
                     array->scope = pos;
                     *err = 0;
                     return 0;
@@ -240,7 +260,8 @@ static int layout_process(struct Node* n) {
     struct Context ctx = {0};
     struct Buffer* out;
     int ok = 0, i;
-    unsigned int maxsize;
+    unsigned long maxend;
+    unsigned int maxsize, lo, hi;
 
     GENERIC_CHECK_INPUTS(n, layout);
     n->outputs[0]->type = DATA_BUFFER;
@@ -260,19 +281,23 @@ static int layout_process(struct Node* n) {
     ok = load_layers(&ctx, layers, n->path, n->inputs[SFL]->content.str);
     if (!ok) goto exit;
 
-    maxsize = 0;
+    maxend = 0;
     for (i = 0; i < NUM_SAMPLES; i++) {
         int j;
         for (j = 0; j < layers[i].numLayers; j++) {
-            maxsize = layers[i].layers[j].end > maxsize ?
-                      layers[i].layers[j].end : maxsize;
+            maxend = layers[i].layers[j].end > maxend ?
+                     layers[i].layers[j].end : maxend;
         }
     }
-    if ((out->data = calloc(maxsize, sizeof(float)))) {
+    if (!(ok = buffer_size(n->name, maxend, &maxsize))) {
+        goto exit;
+    } else if ((out->data = buffer_calloc(maxsize))) {
         int j;
 
         out->size = maxsize;
         out->samplingRate = ctx.sampling;
+        /* only the layers sounding in the range rendered */
+        node_range(n, out->samplingRate, out->size, &lo, &hi);
         for (i = 0; i < NUM_SAMPLES; i++) {
             struct Buffer* in;
             if (n->inputs[S00 + i]) {
@@ -291,7 +316,10 @@ static int layout_process(struct Node* n) {
                 struct Layer* l = layers[i].layers + j;
                 min = in->size < l->end - l->start
                     ? in->size : l->end - l->start;
-                for (k = 0; k < min; k++) {
+                if (hi < l->start + min) {
+                    min = hi > l->start ? hi - l->start : 0;
+                }
+                for (k = l->start < lo ? lo - l->start : 0; k < min; k++) {
                     out->data[l->start + k] += in->data[k];
                 }
             }
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sndc.h>
 #include <modules/utils.h>
@@ -13,7 +14,8 @@ const struct Module echom = {
     "echo", "effect", "Produces a series of exponentially decaying echoes",
     {
         {"in",      DATA_BUFFER,    REQUIRED,
-                    "input buffer to apply echo to"},
+                    "input buffer to apply echo to",
+                    0, 0, NULL, DESC_TIMED},
         {"wet",     DATA_FLOAT,     OPTIONAL,
                     "wetness of effect"},
         {"delay",   DATA_FLOAT,     OPTIONAL,
@@ -22,8 +24,10 @@ const struct Module echom = {
                     "decay factor of echoes"},
         {"damp",    DATA_FLOAT,     OPTIONAL,
                     "amount of low pass filtering on echoes"},
-        {"duration",DATA_FLOAT,     OPTIONAL,
-                    "duration of output buffer, default to input's duration"},
+        {"duration",DATA_FLOAT | DATA_STRING,   OPTIONAL,
+                    "duration of output buffer, default to input's duration, "
+                    "'auto' to end once the echoes have decayed",
+                    0, 0, durationNames},
     },
     {
         {"out",     DATA_BUFFER,    REQUIRED,
@@ -31,7 +35,8 @@ const struct Module echom = {
     },
     NULL,
     echo_process,
-    NULL
+    NULL,
+    MOD_RANGED | MOD_LOOKBACK
 };
 
 enum EchoInputType {
@@ -49,6 +54,8 @@ struct DelayLine {
     float cache[MAX_DELAYLINE_SIZE];   /* circular buffer */
     unsigned int head;  /* cur position in the circular buffer */
     unsigned int delay; /* in samples, equals size of buffer */
+    unsigned int loud;  /* samples until the last one not QUIET leaves,
+                         * counted while the input is silent */
 };
 
 static float delayline_out(struct DelayLine* dl) {
@@ -56,8 +63,19 @@ static float delayline_out(struct DelayLine* dl) {
     return dl->cache[dl->head];
 }
 
-static void delayline_in(struct DelayLine* dl, float s) {
+static void delayline_in(struct DelayLine* dl, float s, int count) {
     dl->cache[dl->head] = s;
+    if (count) dl->loud = QUIET(s) ? dl->loud - (dl->loud != 0) : dl->delay;
+}
+
+/* the head holds the last sample in */
+static void delayline_count(struct DelayLine* dl) {
+    unsigned int i;
+
+    for (i = 0; i < dl->delay; i++) {
+        if (!QUIET(dl->cache[(dl->head + dl->delay - i) % dl->delay])) break;
+    }
+    dl->loud = i < dl->delay ? dl->delay - i : 0;
 }
 
 struct OnePole {
@@ -66,7 +84,8 @@ struct OnePole {
 };
 
 static float one_pole(struct OnePole* filter, float s) {
-    return (filter->last = filter->a * s - filter->b * filter->last);
+    filter->last = filter->a * s - filter->b * filter->last;
+    return (filter->last = FLUSH_DENORMAL(filter->last));
 }
 
 struct Echo {
@@ -74,20 +93,19 @@ struct Echo {
     struct OnePole filter;
     float decay;
     float wet;
+    char counted, cleared;
 };
 
 static int echo_setup(struct Node* n, struct Echo* echo) {
     float delay = 0.5, decay = 0.4, damp = 0.2, wet = 1.;
     float sr = n->inputs[INP]->content.buf.samplingRate;
-    float duration = (float) n->inputs[INP]->content.buf.size / sr;
-    unsigned int outSize;
+    unsigned int outSize = n->inputs[INP]->content.buf.size;
     struct Buffer* buf = &n->outputs[0]->content.buf;
 
     if (n->inputs[WET]) wet      = n->inputs[WET]->content.f;
     if (n->inputs[DEL]) delay    = n->inputs[DEL]->content.f;
     if (n->inputs[DEC]) decay    = n->inputs[DEC]->content.f;
     if (n->inputs[DMP]) damp     = n->inputs[DMP]->content.f;
-    if (n->inputs[DUR]) duration = n->inputs[DUR]->content.f;
 
     if (delay * sr > MAX_DELAYLINE_SIZE) {
         fprintf(stderr, "Error: %s: delay is too big\n", n->name);
@@ -99,8 +117,23 @@ static int echo_setup(struct Node* n, struct Echo* echo) {
     echo->decay = decay;
     echo->wet = wet;
 
-    outSize = duration * sr;
-    if (!(buf->data = malloc(outSize * sizeof(float)))) {
+    /* defaults to the input's size, cut once rendered if "auto", see
+     * tail_cut()
+     */
+    if (       n->inputs[DUR] && !AUTO_DURATION(n->inputs[DUR])
+            && !node_size(n, n->inputs[DUR]->content.f, sr, &outSize)) {
+        return 0;
+    } else if (AUTO_DURATION(n->inputs[DUR]) && wet != 0
+               && !buffer_size(n->name,
+                               (double) n->inputs[INP]->content.buf.size
+                               + tail_length(decay, echo->dl.delay, sr),
+                               &outSize)) {
+        return 0;
+    }
+    /* dry, the output views the input */
+    if (wet == 0 && outSize <= n->inputs[INP]->content.buf.size) {
+        buf->data = buffer_share(n->inputs[INP]->content.buf.data);
+    } else if (!(buf->data = buffer_alloc(outSize))) {
         fprintf(stderr, "Error: %s: can't malloc output buffer\n", n->name);
         return 0;
     }
@@ -111,38 +144,120 @@ static int echo_setup(struct Node* n, struct Echo* echo) {
     return 1;
 }
 
-static float echo_run(struct Echo* echo, float s) {
+static float echo_run(struct Echo* echo, float s, int count) {
     float out;
 
     out = delayline_out(&echo->dl);
     out = one_pole(&echo->filter, out);
     out = echo->decay * out + s;
-    delayline_in(&echo->dl, out);
+    out = FLUSH_DENORMAL(out);
+    delayline_in(&echo->dl, out, count);
     return echo->wet * out + (1. - echo->wet) * s;
 }
 
-static int echo_process(struct Node* n) {
-    unsigned int inSize, outSize, lim, i;
+/* the delay line and filter are cleared once quiet, their output staying
+ * silent as long as their input. The delay line is read when the input turns
+ * silent, and its samples counted as they go in afterwards.
+ */
+static int echo_quiet(struct Echo* echo) {
+    if (!echo->counted) {
+        delayline_count(&echo->dl);
+        echo->counted = 1;
+    }
+    if (echo->dl.loud || !QUIET(echo->filter.last)) return 0;
+    if (!echo->cleared) {
+        memset(echo->dl.cache, 0, echo->dl.delay * sizeof(float));
+        echo->filter.last = 0;
+        echo->cleared = 1;
+    }
+    return 1;
+}
+
+struct EchoSlice {
+    const struct Echo* echo;
     float *in, *out;
-    struct Echo echo = {0};
+    unsigned int lim;
+};
+
+/* each slice runs its own copy of the echo, fresh from setup */
+static int echo_slice(void* ctx, unsigned int warm,
+                      unsigned int start, unsigned int end) {
+    struct EchoSlice* e = ctx;
+    struct Echo* echo;
+    unsigned int i, j, next;
+    int silent;
+
+    if (!(echo = malloc(sizeof(*echo)))) {
+        fprintf(stderr, "Error: echo: can't allocate delay line\n");
+        return 0;
+    }
+    memcpy(echo, e->echo, sizeof(*echo));
+    for (i = warm; i < start; i++) {
+        echo_run(echo, i < e->lim ? e->in[i] : 0, 0);
+    }
+    for (; i < end; i = next) {
+        next = end;
+        silent = i >= e->lim;
+        if (!silent) {
+            next = buffer_silent_run(e->in, i, end < e->lim ? end : e->lim,
+                                     &silent);
+        }
+        /* the tail decays through silence a block at a time */
+        if (silent && echo_quiet(echo)) {
+            memset(e->out + i, 0, (next - i) * sizeof(float));
+            continue;
+        } else if (silent && next - i > SILENT_BLOCK) {
+            next = i + SILENT_BLOCK;
+        }
+        echo->counted = silent;
+        echo->cleared = 0;
+        for (j = i; j < next && j < e->lim; j++) {
+            e->out[j] = echo_run(echo, e->in[j], silent);
+        }
+        for (; j < next; j++) {
+            e->out[j] = echo_run(echo, 0, silent);
+        }
+    }
+    free(echo);
+    return 1;
+}
+
+static int echo_process(struct Node* n) {
+    unsigned int inSize, outSize;
+    struct EchoSlice e;
+    struct Echo* echo;
+    int ok;
 
     GENERIC_CHECK_INPUTS(n, echom);
 
-    in = n->inputs[INP]->content.buf.data;
+    e.in = n->inputs[INP]->content.buf.data;
     inSize = n->inputs[INP]->content.buf.size;
 
-    if (!echo_setup(n, &echo)) return 0;
+    if (!(echo = calloc(1, sizeof(*echo)))) {
+        fprintf(stderr, "Error: %s: can't allocate delay line\n", n->name);
+        return 0;
+    }
+    if (!echo_setup(n, echo)) {
+        free(echo);
+        return 0;
+    }
 
-    out = n->outputs[0]->content.buf.data;
+    e.echo = echo;
+    e.out = n->outputs[0]->content.buf.data;
     outSize = n->outputs[0]->content.buf.size;
 
-    lim = outSize > inSize ? inSize : outSize;
-
-    for (i = 0; i < lim; i++) {
-        out[i] = echo_run(&echo, in[i]);
+    e.lim = outSize > inSize ? inSize : outSize;
+    if (e.out == e.in) {
+        free(echo);
+        return 1;
     }
-    for (; i < outSize; i++) {
-        out[i] = echo_run(&echo, 0);
+
+    ok = node_slice_run(n, &n->outputs[0]->content.buf,
+                        slice_warmup(echo->decay, echo->dl.delay),
+                        echo_slice, &e);
+    free(echo);
+    if (ok && AUTO_DURATION(n->inputs[DUR])) {
+        ok = tail_cut(n, &n->outputs[0]->content.buf, inSize);
     }
-    return 1;
+    return ok;
 }
@@ -14,7 +14,8 @@ const struct Module env = {
     "envelop", "effect", "Apply envelop to input signal",
     {
         {"in",          DATA_BUFFER,    REQUIRED,
-                        "input buffer upon which to apply envelop"},
+                        "input buffer upon which to apply envelop",
+                        0, 0, NULL, DESC_TIMED},
 
         {"attack",      DATA_FLOAT,     REQUIRED,
                         "attack delay in seconds"},
@@ -27,15 +28,20 @@ const struct Module env = {
 
         {"interp",      DATA_STRING,    OPTIONAL,
                         "interpolation for envelop curve, "
-                        "'step', 'linear' or 'sine', def 'linear'"}
+                        "'step', 'linear' or 'sine', def 'linear'",
+                        0, 0, interpNames}
     },
     {
         {"out",         DATA_BUFFER,    REQUIRED,
-                        "output buffer"}
+                        "output buffer"},
+
+        {"curve",       DATA_CURVE,     REQUIRED,
+                        "envelop curve, over the duration of the input"}
     },
     NULL,
     env_process,
-    NULL
+    NULL,
+    MOD_INPLACE | MOD_RANGED
 };
 
 enum EnvInputType {
@@ -47,38 +53,121 @@ enum EnvInputType {
     NUM_INPUTS
 };
 
+enum EnvOutputType {
+    OUT,
+    CRV
+};
+
 static int env_valid(struct Node* n) {
-    unsigned int i;
     struct Data *in, *out;
 
-    for (i = 0; i < NUM_INPUTS; i++) {
-        if (!data_valid(n->inputs[i], env.inputs + i, n->name)) {
-            return 0;
-        }
-    }
+    GENERIC_CHECK_INPUTS(n, env);
     if (n->inputs[ITP] && data_parse_interp(n->inputs[ITP]) < 0) {
         fprintf(stderr, "Error: %s: invalid interp\n", n->name);
         return 0;
     }
 
     in = n->inputs[INP];
-    out = n->outputs[0];
+    out = n->outputs[OUT];
 
-    memcpy(out, in, sizeof(*out));
+    out->type = DATA_BUFFER;
+    out->content.buf = in->content.buf;
     out->content.buf.data = NULL;
     return 1;
 }
 
+struct EnvSlice {
+    const float* in;
+    struct Buffer* out;
+    unsigned int susi, deci, flati;
+    int interp;
+};
+
+#define CLAMP(x, a, b) ((x) < (a) ? (a) : (x) > (b) ? (b) : (x))
+
+static void env_run(const struct EnvSlice* e,
+                    unsigned int start, unsigned int end) {
+    const float* in = e->in;
+    float* out = e->out->data;
+    unsigned int i, susi, deci, flati;
+
+    susi = CLAMP(e->susi, start, end);
+    deci = CLAMP(e->deci, start, end);
+    flati = CLAMP(e->flati, start, end);
+
+    for (i = start; i < susi; i++) {
+        out[i] = interpf(e->interp,
+                         0, 1, (double) i / e->susi) * in[i];
+    }
+    for (i = susi; i < deci; i++) {
+        out[i] = in[i];
+    }
+    for (i = deci; i < flati; i++) {
+        out[i] = interpf(e->interp, 1, 0,
+                         (double) (i - e->deci) / (e->flati - e->deci))
+               * in[i];
+    }
+    for (i = flati; i < end; i++) {
+        out[i] = 0;
+    }
+}
+
+/* silent blocks of the input stay silent */
+static int env_slice(void* ctx, unsigned int warm,
+                     unsigned int start, unsigned int end) {
+    struct EnvSlice* e = ctx;
+    unsigned int i, next;
+    int silent;
+
+    for (i = start; i < end; i = next) {
+        next = buffer_silent_run(e->in, i, end, &silent);
+        if (!silent) {
+            env_run(e, i, next);
+        } else if (e->out->data != e->in) {
+            memset(e->out->data + i, 0, (next - i) * sizeof(float));
+        }
+    }
+    return 1;
+}
+
+static int env_curve(struct Data* out, const struct Buffer* in, int interp,
+                     float atkt, float sust, float dect) {
+    struct Curve* c = &out->content.curve;
+    static const float values[] = {0, 1, 1, 0};
+    float times[4];
+    unsigned int i;
+
+    out->type = DATA_CURVE;
+    if (!(c->points = malloc(4 * sizeof(*c->points)))) {
+        fprintf(stderr, "Error: env: can't allocate curve\n");
+        return 0;
+    }
+    times[0] = 0;
+    times[1] = atkt;
+    times[2] = atkt + sust;
+    times[3] = atkt + sust + dect;
+    for (i = 0; i < 4; i++) {
+        c->points[i].time = times[i];
+        c->points[i].value = values[i];
+        c->points[i].shape = i == 2 ? CURVE_LINEAR : (enum CurveShape) interp;
+    }
+    c->numPoints = 4;
+    c->duration = (float) in->size / (float) in->samplingRate;
+    out->ready = 1;
+    return 1;
+}
+
 static int env_process(struct Node* n) {
+    struct EnvSlice e;
     struct Buffer *in, *out;
-    unsigned int i, susi, deci, flati;
+    unsigned int susi, deci, flati;
     float atkt, sust, dect;
     int interp;
 
     if (!env_valid(n)) return 0;
 
     in = &n->inputs[INP]->content.buf;
-    out = &n->outputs[0]->content.buf;
+    out = &n->outputs[OUT]->content.buf;
 
     atkt = n->inputs[ATK]->content.f;
     sust = n->inputs[SUS]->content.f;
@@ -97,24 +186,17 @@ static int env_process(struct Node* n) {
     } else if ((interp = data_parse_interp(n->inputs[ITP])) < 0) {
         return 0;
     }
-    if (!(out->data = malloc(out->size * sizeof(float)))) {
+    e.in = in->data;
+    if (       !(out->data = node_take_input(n, INP))
+            && !(out->data = buffer_alloc(out->size))) {
         return 0;
     }
-    for (i = 0; i < susi; i++) {
-        out->data[i] = interpf(interp,
-                               0, 1, (float) i / (float) susi) * in->data[i];
-    }
-    for (i = susi; i < deci; i++) {
-        out->data[i] = in->data[i];
-    }
-    for (i = deci; i < flati; i++) {
-        out->data[i] =
-            interpf(interp, 1, 0,
-                    (float) (i - deci) / (float) (flati - deci)) * in->data[i];
-    }
-    for (i = flati; i < out->size; i++) {
-        out->data[i] = 0;
-    }
-    n->outputs[0]->ready = 1;
-    return 1;
+    e.out = out;
+    e.susi = susi;
+    e.deci = deci;
+    e.flati = flati;
+    e.interp = interp;
+    if (!node_slice_run(n, out, 0, env_slice, &e)) return 0;
+    n->outputs[OUT]->ready = 1;
+    return env_curve(n->outputs[CRV], in, interp, atkt, sust, dect);
 }
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <fftw3.h>
 
@@ -9,10 +10,19 @@
 
 #define DEFAULT_ORDER       4
 #define DEFAULT_WIN_SIZE    2048
+/* smallest window of draft renders */
+#define DRAFT_WIN_SIZE      64
 #define GAIN_RESOL          1024
 
 static int filter_process(struct Node* n);
-static int filter_teardown(struct Node* n);
+
+/* indexed by FilterMode */
+static const char* modeNames[] = {
+    "lowpass",
+    "highpass",
+    "custom",
+    NULL
+};
 
 /* DECLARE_MODULE(fftbp) */
 const struct Module fftbp = {
@@ -21,11 +31,13 @@ const struct Module fftbp = {
         {"in",          DATA_BUFFER,                REQUIRED,
                         "input buffer to be filtered"},
 
-        {"cutoff",      DATA_FLOAT | DATA_BUFFER,   REQUIRED,
-                        "frequency cutoff"},
+        {"cutoff",      DATA_CONTROL,               REQUIRED,
+                        "frequency cutoff",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
 
         {"mode",        DATA_STRING,                REQUIRED,
-                        "filter mode, 'lowpass', 'highpass' or 'custom'"},
+                        "filter mode, 'lowpass', 'highpass' or 'custom'",
+                        0, 0, modeNames},
 
         {"order",       DATA_FLOAT,                 OPTIONAL,
                         "Butterworth order, preferably an even, "
@@ -44,7 +56,7 @@ const struct Module fftbp = {
     },
     NULL,
     filter_process,
-    filter_teardown
+    NULL
 };
 
 enum FilterInput {
@@ -58,12 +70,89 @@ enum FilterInput {
     NUM_INPUTS
 };
 
+/* FFTW planning is slow and not thread safe, so plans are made once per
+ * window size and shared by all nodes and threads (executing a plan on other
+ * arrays is thread safe), until exit.
+ */
+struct Plans {
+    unsigned int size;
+    fftwf_plan forward, backward;
+};
+
+static struct Plans* plans;
+static unsigned int numPlans;
+static pthread_mutex_t planLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_plans(void) {
+    unsigned int i;
+
+    for (i = 0; i < numPlans; i++) {
+        fftwf_destroy_plan(plans[i].forward);
+        fftwf_destroy_plan(plans[i].backward);
+    }
+    free(plans);
+    plans = NULL;
+    numPlans = 0;
+    fftwf_cleanup();
+}
+
+static struct Plans* new_plans(unsigned int size) {
+    struct Plans* p = NULL;
+    float* in = NULL;
+    fftwf_complex* out = NULL;
+    void* tmp;
+
+    if (!(tmp = realloc(plans, (numPlans + 1) * sizeof(*plans)))) {
+        return NULL;
+    }
+    plans = tmp;
+    if (       (in = fftwf_malloc(size * sizeof(float)))
+            && (out = fftwf_malloc((size / 2 + 1) * sizeof(*out)))) {
+        p = plans + numPlans;
+        p->size = size;
+        p->forward = fftwf_plan_dft_r2c_1d(size, in, out, 0);
+        p->backward = fftwf_plan_dft_c2r_1d(size, out, in, 0);
+        if (p->forward && p->backward) {
+            if (!numPlans) atexit(free_plans);
+            numPlans++;
+        } else {
+            if (p->forward) fftwf_destroy_plan(p->forward);
+            if (p->backward) fftwf_destroy_plan(p->backward);
+            p = NULL;
+        }
+    }
+    fftwf_free(in);
+    fftwf_free(out);
+    return p;
+}
+
+static int get_plans(unsigned int size,
+                     fftwf_plan* forward,
+                     fftwf_plan* backward) {
+    struct Plans* p = NULL;
+    unsigned int i;
+
+    pthread_mutex_lock(&planLock);
+    for (i = 0; i < numPlans && !p; i++) {
+        if (plans[i].size == size) {
+            p = plans + i;
+        }
+    }
+    if (p || (p = new_plans(size))) {
+        *forward = p->forward;
+        *backward = p->backward;
+    }
+    pthread_mutex_unlock(&planLock);
+    return p != NULL;
+}
+
 static void setup(struct Node* n) {
     struct Data *in, *out;
 
     in = n->inputs[INP];
     out = n->outputs[0];
-    memcpy(out, in, sizeof(*out));
+    out->type = DATA_BUFFER;
+    out->content.buf = in->content.buf;
     out->content.buf.data = NULL;
 }
 
@@ -114,19 +203,23 @@ static void apply_filter(fftwf_complex* spectre,
                          unsigned int samplingRate,
                          float f0,
                          struct Buffer* gain) {
-    unsigned int i;
+    const struct Kernels* k = kernels_get();
+    float t[BLOCK_SIZE], c[BLOCK_SIZE];
+    unsigned int i, j, n = winSize / 2 + 1;
 
     if (f0 < 0) f0 = 0;
     if (f0 > samplingRate / 2) f0 = samplingRate / 2;
 
-    for (i = 0; i < winSize / 2 + 1; i++) {
-        float curfreq = (float) i / (float) winSize * (float) samplingRate;
-        float t1 = curfreq / (10. * f0);
-        float c;
+    for (i = 0; i < n; i += BLOCK_SIZE) {
+        unsigned int m = n - i < BLOCK_SIZE ? n - i : BLOCK_SIZE;
 
-        c = interp(gain, t1);
-        spectre[i][0] *= c;
-        spectre[i][1] *= c;
+        for (j = 0; j < m; j++) {
+            float curfreq = (float) (i + j) / (float) winSize
+                          * (float) samplingRate;
+            t[j] = curfreq / (10. * f0);
+        }
+        k->interp(c, gain, t, m);
+        k->cscale(spectre[i], c, m);
     }
 }
 
@@ -164,15 +257,7 @@ static int make_butterworth_gain(struct Buffer* buf,
 }
 
 static int get_mode(struct Node* n, int* mode) {
-    const char* modestr = n->inputs[MOD]->content.str;
-
-    if (!strcmp(modestr, "lowpass")) {
-        *mode = LOW_PASS;
-    } else if (!strcmp(modestr, "highpass")) {
-        *mode = HIGH_PASS;
-    } else if (!strcmp(modestr, "custom")) {
-        *mode = CUSTOM;
-    } else {
+    if ((*mode = data_which_string(n->inputs[MOD], modeNames)) < 0) {
         fprintf(stderr, "Error: %s: 'mode' must be 'lowpass' or 'highpass'\n",
                         n->name);
         return 0;
@@ -199,6 +284,10 @@ static int filter_process(struct Node* n) {
 
     winSize = data_float(n->inputs[FTW], 0, DEFAULT_WIN_SIZE);
     order = data_float(n->inputs[ORD], 0, DEFAULT_ORDER);
+    /* the same frequency resolution at a lower rate, and cheaper */
+    if (settings.draft > 1 && winSize / settings.draft >= DRAFT_WIN_SIZE) {
+        winSize /= settings.draft;
+    }
     stride = winSize / 2;
 
     if (n->inputs[GNB]) {
@@ -211,35 +300,27 @@ static int filter_process(struct Node* n) {
     }
 
     if (       (win = malloc(winSize * sizeof(float)))
-            && (out->data = calloc(in->size, sizeof(float)))
+            && (out->data = buffer_calloc(in->size))
             && (fftin = fftwf_malloc(winSize * sizeof(float)))
             && (fftout = fftwf_malloc((winSize / 2 + 1) * sizeof(*fftout)))
-            && (forward = fftwf_plan_dft_r2c_1d(winSize, fftin, fftout, 0))
-            && (backward = fftwf_plan_dft_c2r_1d(winSize, fftout, fftin, 0))) {
+            && get_plans(winSize, &forward, &backward)) {
         int i;
         float f0;
 
         make_window(win, winSize);
         for (i = -stride; i < (int) in->size; i += stride) {
-            f0 = data_float(cutoffdata, (float) i / (float) in->size, 0);
+            f0 = data_float_at(cutoffdata, i > 0 ? i : 0, in->size, 0);
             load_fftin(fftin, in->data, in->size, win, winSize, i);
-            fftwf_execute(forward);
+            fftwf_execute_dft_r2c(forward, fftin, fftout);
             apply_filter(fftout, winSize, in->samplingRate, f0, gain);
-            fftwf_execute(backward);
+            fftwf_execute_dft_c2r(backward, fftout, fftin);
             export_fftin(fftin, out->data, out->size, win, winSize, i);
         }
         ok = 1;
     }
     free(win);
     free(bw.data);
-    if (forward) fftwf_destroy_plan(forward);
-    if (backward) fftwf_destroy_plan(backward);
     fftwf_free(fftin);
     fftwf_free(fftout);
     return ok;
 }
-
-int filter_teardown(struct Node* n) {
-    fftwf_cleanup();
-    return 1;
-}
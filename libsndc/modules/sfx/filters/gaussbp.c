@@ -17,11 +17,13 @@ const struct Module gaussbp = {
         {"in",          DATA_BUFFER,                REQUIRED,
                         "input buffer to be filtered"},
 
-        {"lfcutoff",    DATA_FLOAT | DATA_BUFFER,   REQUIRED,
-                        "low frequency cutoff"},
+        {"lfcutoff",    DATA_CONTROL,               REQUIRED,
+                        "low frequency cutoff",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED},
 
-        {"hfcutoff",    DATA_FLOAT | DATA_BUFFER,   REQUIRED,
-                        "high frequency cutoff"}
+        {"hfcutoff",    DATA_CONTROL,               REQUIRED,
+                        "high frequency cutoff",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED}
     },
     {
         {"out",         DATA_BUFFER,                REQUIRED,
@@ -52,19 +54,15 @@ enum FilterOutput {
 };
 
 static int filter_valid(struct Node* n) {
-    unsigned int i;
     struct Data *in, *out;
 
-    for (i = 0; i < NUM_INPUTS; i++) {
-        if (!data_valid(n->inputs[i], gaussbp.inputs + i, n->name)) {
-            return 0;
-        }
-    }
+    GENERIC_CHECK_INPUTS(n, gaussbp);
 
     in = n->inputs[INP];
     out = n->outputs[OUT];
 
-    memcpy(out, in, sizeof(*out));
+    out->type = DATA_BUFFER;
+    out->content.buf = in->content.buf;
     out->content.buf.data = NULL;
 #ifdef DEBUG
     {
@@ -89,9 +87,77 @@ static void load_gaussian(float* buf, unsigned int size) {
     }
 }
 
+/* Draft renders approximate the gaussian convolutions, which cost the mask
+ * size per sample, with recursive low passes: two forward and backward
+ * passes of a one pole filter, zero phase like the gaussian, of the same
+ * variance. A negative pole means no cutoff.
+ */
+static float smooth_pole(unsigned int rate, float cutoff) {
+    double w;
+
+    if (cutoff <= 0) return -1;
+    /* the mask spans 6 standard deviations, the variance is split between
+     * the two passes, each of variance 2a / (1 - a)^2 for a pole a
+     */
+    w = rate / cutoff / 6.;
+    w = w * w / 2;
+    if (w < 1e-6) return 0;
+    return (w + 1 - sqrt(2 * w + 1)) / w;
+}
+
+static void smooth(float* dest, const float* src, const float* poles,
+                   unsigned int size) {
+    unsigned int i, pass;
+    float y;
+
+    memcpy(dest, src, size * sizeof(float));
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0, y = dest[0]; i < size; i++) {
+            float a = poles[i] > 0 ? poles[i] : 0;
+
+            dest[i] = y = a * y + (1 - a) * dest[i];
+        }
+        for (i = size, y = dest[size - 1]; i--;) {
+            float a = poles[i] > 0 ? poles[i] : 0;
+
+            dest[i] = y = a * y + (1 - a) * dest[i];
+        }
+    }
+}
+
+static int draft_process(struct Node* n,
+                         struct Buffer* in,
+                         struct Buffer* out) {
+    float *poles, *low;
+    unsigned int i;
+
+    if (       !(poles = malloc(out->size * sizeof(float)))
+            || !(low = malloc(out->size * sizeof(float)))) {
+        fprintf(stderr, "Error: %s: can't allocate draft filters\n", n->name);
+        free(poles);
+        return 0;
+    }
+    for (i = 0; i < out->size; i++) {
+        poles[i] = smooth_pole(out->samplingRate,
+                               data_float_at(n->inputs[HCO], i, out->size, 0));
+    }
+    smooth(out->data, in->data, poles, out->size);
+    for (i = 0; i < out->size; i++) {
+        poles[i] = smooth_pole(out->samplingRate,
+                               data_float_at(n->inputs[LCO], i, out->size, 0));
+    }
+    smooth(low, in->data, poles, out->size);
+    for (i = 0; i < out->size; i++) {
+        if (poles[i] >= 0) out->data[i] -= low[i];
+    }
+    free(poles);
+    free(low);
+    return 1;
+}
+
 static int filter_process(struct Node* n) {
     struct Buffer *in, *out, mask;
-    float win[W_SIZE], lf, hf, t;
+    float win[W_SIZE], lf, hf;
     unsigned int i, ms;
 #ifdef DEBUG
     struct Buffer* outmask = &n->outputs[MSK]->content.buf;
@@ -101,7 +167,7 @@ static int filter_process(struct Node* n) {
         return 0;
     }
 #ifdef DEBUG
-    if (!(outmask->data = malloc(outmask->size * sizeof(float)))) {
+    if (!(outmask->data = buffer_alloc(outmask->size))) {
         return 0;
     }
 #endif
@@ -109,9 +175,15 @@ static int filter_process(struct Node* n) {
     in = &n->inputs[INP]->content.buf;
     out = &n->outputs[0]->content.buf;
 
-    if (!(out->data = malloc(out->size * sizeof(float)))) {
+    if (!(out->data = buffer_alloc(out->size))) {
         return 0;
     }
+    if (settings.draft > 1 && out->size) {
+#ifdef DEBUG
+        memset(outmask->data, 0, outmask->size * sizeof(float));
+#endif
+        return draft_process(n, in, out);
+    }
 
     load_gaussian(win, W_SIZE);
     mask.data = win;
@@ -119,18 +191,18 @@ static int filter_process(struct Node* n) {
     mask.interp = INTERP_LINEAR;
 
     for (i = 0; i < out->size; i++) {
-        t = (float) i / (float) out->size;
-        hf = data_float(n->inputs[HCO], t, 0);
-        lf = data_float(n->inputs[LCO], t, 0);
+        hf = data_float_at(n->inputs[HCO], i, out->size, 0);
+        lf = data_float_at(n->inputs[LCO], i, out->size, 0);
 
+        /* masks of a sample at least, for cutoffs over the sampling rate */
         if (hf > 0) {
-            ms = out->samplingRate / hf;
+            ms = hf < out->samplingRate ? out->samplingRate / hf : 1;
             out->data[i] = convol(in, &mask, ms, i);
         } else {
             out->data[i] = in->data[i];
         }
         if (lf > 0) {
-            ms = out->samplingRate / lf;
+            ms = lf < out->samplingRate ? out->samplingRate / lf : 1;
             out->data[i] -= convol(in, &mask, ms, i);
         }
 #ifdef DEBUG
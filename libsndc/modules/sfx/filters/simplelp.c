@@ -13,10 +13,12 @@ const struct Module simplelp = {
     "simplelp", "filter", "Low pass filter using simple and fast diff equation",
     {
         {"in",          DATA_BUFFER,                REQUIRED,
-                        "input buffer to be filtered"},
+                        "input buffer to be filtered",
+                        0, 0, NULL, DESC_TIMED},
 
-        {"cutoff",      DATA_FLOAT | DATA_BUFFER,   REQUIRED,
-                        "frequency cutoff"}
+        {"cutoff",      DATA_CONTROL,               REQUIRED,
+                        "frequency cutoff",
+                        0, 0, NULL, DESC_CONTROL | DESC_PACKED}
     },
     {
         {"out",         DATA_BUFFER,                REQUIRED,
@@ -24,7 +26,8 @@ const struct Module simplelp = {
     },
     NULL,
     filter_process,
-    NULL
+    NULL,
+    MOD_INPLACE | MOD_RANGED | MOD_LOOKBACK
 };
 
 enum FilterInputType {
@@ -46,37 +49,115 @@ static int filter_valid(struct Node* n) {
     in = n->inputs[INP];
     out = n->outputs[OUT];
 
-    memcpy(out, in, sizeof(*out));
+    out->type = DATA_BUFFER;
+    out->content.buf = in->content.buf;
     out->content.buf.data = NULL;
     return 1;
 }
 
-static int filter_process(struct Node* n) {
-    struct Buffer *in, *out;
+struct FilterSlice {
+    const float* in;
+    struct Buffer* out;
     struct Data* cutoff;
-    float t = 0, dt, sr;
-    unsigned int i;
+    float sr;
+};
 
-    if (!filter_valid(n)) return 0;
+/* the filter is stable for u in [0, 1], cutoffs over the sampling rate, which
+ * draft renders lower, passing the input through
+ */
+static float filter_coef(const struct FilterSlice* f, unsigned int i) {
+    float u = data_float_at(f->cutoff, i, f->out->size, 0) / f->sr;
 
-    in = &n->inputs[INP]->content.buf;
-    out = &n->outputs[0]->content.buf;
-    cutoff = n->inputs[CUT];
-    sr = in->samplingRate;
+    return u < 0 ? 0 : u > 1 ? 1 : u;
+}
 
-    if (!(out->data = malloc(out->size * sizeof(float)))) {
-        return 0;
+static int filter_slice(void* ctx, unsigned int warm,
+                        unsigned int start, unsigned int end) {
+    struct FilterSlice* f = ctx;
+    const float* in = f->in;
+    float* out = f->out->data;
+    float u, last;
+    unsigned int i, next;
+    int silent;
+
+    last = filter_coef(f, warm) * in[warm];
+    if (warm >= start) out[warm] = last;
+    for (i = warm + 1; i < end; ) {
+        next = buffer_silent_run(in, i, end, &silent);
+        /* the filter decays through silence a block at a time, and stays
+         * silent once settled
+         */
+        if (silent && last == 0) {
+            for (; i < next; i++) {
+                if (i >= start) out[i] = 0;
+            }
+            continue;
+        } else if (silent && next - i > SILENT_BLOCK) {
+            next = i + SILENT_BLOCK;
+        }
+        for (; i < next; i++) {
+            u = filter_coef(f, i);
+            last = (1. - u) * last + u * in[i];
+            last = FLUSH_DENORMAL(last);
+            if (i >= start) out[i] = last;
+        }
     }
+    return 1;
+}
 
-    out->data[0] = data_float(cutoff, 0, 0) / sr * in->data[0];
+/* the lowest cutoff gives the longest memory */
+static float min_cutoff(struct Data* cutoff) {
+    float min, block[BLOCK_SIZE];
+    const float* s;
+    unsigned int i, j, n;
+
+    if (cutoff->type == DATA_FLOAT) return cutoff->content.f;
+    /* segments are monotonic */
+    if (cutoff->type == DATA_CURVE) {
+        const struct Curve* c = &cutoff->content.curve;
+
+        min = c->numPoints ? c->points[0].value : 0;
+        for (i = 1; i < c->numPoints; i++) {
+            if (c->points[i].value < min) min = c->points[i].value;
+        }
+        return min;
+    }
+    min = HUGE_VAL;
+    for (i = 0; i < cutoff->content.buf.size; i += n) {
+        n = cutoff->content.buf.size - i;
+        n = n < BLOCK_SIZE ? n : BLOCK_SIZE;
+        s = cutoff->content.buf.data + i;
+        if (cutoff->packed.data) {
+            data_unpack_range(cutoff, block, i, n);
+            s = block;
+        }
+        for (j = 0; j < n; j++) {
+            if (s[j] < min) min = s[j];
+        }
+    }
+    return cutoff->content.buf.size ? min : 0;
+}
+
+static int filter_process(struct Node* n) {
+    struct FilterSlice f;
+
+    if (!filter_valid(n)) return 0;
 
-    dt = 1. / (float) out->size;
-    for (i = 1; i < out->size; i++) {
-        float u;
-        t += dt;
-        u = data_float(cutoff, t, 0) / sr;
-        out->data[i] = (1. - u) * out->data[i - 1] + u * in->data[i];
+    f.in = n->inputs[INP]->content.buf.data;
+    f.out = &n->outputs[0]->content.buf;
+    f.cutoff = n->inputs[CUT];
+    f.sr = f.out->samplingRate;
+
+    /* slices warm up on samples the previous slice would have overwritten */
+    if (settings.sliceThreads <= 1) {
+        f.out->data = node_take_input(n, INP);
+    }
+    if (!f.out->data && !(f.out->data = buffer_alloc(f.out->size))) {
+        return 0;
     }
+    if (!f.out->size) return 1;
 
-    return 1;
+    return node_slice_run(n, f.out,
+                          slice_warmup(1. - min_cutoff(f.cutoff) / f.sr, 1),
+                          filter_slice, &f);
 }
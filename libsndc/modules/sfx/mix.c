@@ -13,45 +13,62 @@ const struct Module mix = {
     "mix", "effect", "Mixer for up to 8 input buffers",
     {
         {"input0",  DATA_BUFFER,                REQUIRED,
-                    "input #0"},
+                    "input #0",
+                    0, 0, NULL, DESC_SAME_RATE | DESC_TIMED},
         {"input1",  DATA_BUFFER,                OPTIONAL,
-                    "input #1"},
+                    "input #1",
+                    0, 0, NULL, DESC_SAME_RATE | DESC_TIMED},
         {"input2",  DATA_BUFFER,                OPTIONAL,
-                    "input #2"},
+                    "input #2",
+                    0, 0, NULL, DESC_SAME_RATE | DESC_TIMED},
         {"input3",  DATA_BUFFER,                OPTIONAL,
-                    "input #3"},
+                    "input #3",
+                    0, 0, NULL, DESC_SAME_RATE | DESC_TIMED},
         {"input4",  DATA_BUFFER,                OPTIONAL,
-                    "input #4"},
+                    "input #4",
+                    0, 0, NULL, DESC_SAME_RATE | DESC_TIMED},
         {"input5",  DATA_BUFFER,                OPTIONAL,
-                    "input #5"},
+                    "input #5",
+                    0, 0, NULL, DESC_SAME_RATE | DESC_TIMED},
         {"input6",  DATA_BUFFER,                OPTIONAL,
-                    "input #6"},
+                    "input #6",
+                    0, 0, NULL, DESC_SAME_RATE | DESC_TIMED},
         {"input7",  DATA_BUFFER,                OPTIONAL,
-                    "input #7"},
-
-        {"gain0",   DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                    "gain #0, def 1"},
-        {"gain1",   DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                    "gain #1, def 1"},
-        {"gain2",   DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                    "gain #2, def 1"},
-        {"gain3",   DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                    "gain #3, def 1"},
-        {"gain4",   DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                    "gain #4, def 1"},
-        {"gain5",   DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                    "gain #5, def 1"},
-        {"gain6",   DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                    "gain #6, def 1"},
-        {"gain7",   DATA_FLOAT | DATA_BUFFER,   OPTIONAL,
-                    "gain #7, def 1"},
+                    "input #7",
+                    0, 0, NULL, DESC_SAME_RATE | DESC_TIMED},
+
+        {"gain0",   DATA_CONTROL,               OPTIONAL,
+                    "gain #0, def 1",
+                    0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"gain1",   DATA_CONTROL,               OPTIONAL,
+                    "gain #1, def 1",
+                    0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"gain2",   DATA_CONTROL,               OPTIONAL,
+                    "gain #2, def 1",
+                    0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"gain3",   DATA_CONTROL,               OPTIONAL,
+                    "gain #3, def 1",
+                    0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"gain4",   DATA_CONTROL,               OPTIONAL,
+                    "gain #4, def 1",
+                    0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"gain5",   DATA_CONTROL,               OPTIONAL,
+                    "gain #5, def 1",
+                    0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"gain6",   DATA_CONTROL,               OPTIONAL,
+                    "gain #6, def 1",
+                    0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"gain7",   DATA_CONTROL,               OPTIONAL,
+                    "gain #7, def 1",
+                    0, 0, NULL, DESC_CONTROL | DESC_PACKED},
     },
     {
         {"out",     DATA_BUFFER,    REQUIRED}
     },
     NULL,
     mix_process,
-    NULL
+    NULL,
+    MOD_INPLACE | MOD_RANGED
 };
 
 enum MixInputType {
@@ -103,37 +120,111 @@ static int mix_valid(struct Node* n) {
     return 1;
 }
 
+struct MixSlice {
+    struct Data* gains[8];
+    float* bufs[8];
+    unsigned int sizes[8];
+    float* res;
+};
+
+static void mix_gain(struct MixSlice* m, unsigned int i,
+                     unsigned int start, unsigned int end) {
+    const struct Kernels* k = kernels_get();
+    float g[BLOCK_SIZE];
+    unsigned int j;
+
+    if (m->gains[i]->type == DATA_FLOAT) {
+        if (m->gains[i]->content.f != 1.) {
+            k->binop(KERNEL_MUL, m->res + start, m->res + start, NULL,
+                     m->gains[i]->content.f, end - start);
+        }
+        return;
+    }
+    for (j = start; j < end; j += BLOCK_SIZE) {
+        unsigned int n = end - j < BLOCK_SIZE ? end - j : BLOCK_SIZE;
+
+        data_floats(m->gains[i], g, j, n, m->sizes[i], 1.);
+        k->binop(KERNEL_MUL, m->res + j, m->res + j, g, 0, n);
+    }
+}
+
+/* adds samples start to end - 1 of input i to the result */
+static void mix_add(struct MixSlice* m, unsigned int i,
+                    unsigned int start, unsigned int end) {
+    const struct Kernels* k = kernels_get();
+    float g[BLOCK_SIZE];
+    unsigned int j;
+
+    /* the result already holds the first input */
+    if (m->bufs[i] == m->res) {
+        if (m->gains[i]) mix_gain(m, i, start, end);
+        return;
+    }
+    if (!m->gains[i] || m->gains[i]->type == DATA_FLOAT) {
+        k->mix(m->res + start, m->bufs[i] + start, NULL,
+               data_float(m->gains[i], 0, 1.), end - start);
+        return;
+    }
+    for (j = start; j < end; j += BLOCK_SIZE) {
+        unsigned int n = end - j < BLOCK_SIZE ? end - j : BLOCK_SIZE;
+
+        data_floats(m->gains[i], g, j, n, m->sizes[i], 1.);
+        k->mix(m->res + j, m->bufs[i] + j, g, 0, n);
+    }
+}
+
+/* silent blocks of the inputs add nothing */
+static int mix_slice(void* ctx, unsigned int warm,
+                     unsigned int start, unsigned int end) {
+    struct MixSlice* m = ctx;
+    unsigned int i;
+
+    for (i = 0; i < 8; i++) {
+        unsigned int j, next, lim = m->sizes[i] < end ? m->sizes[i] : end;
+        int silent;
+
+        for (j = start; j < lim; j = next) {
+            next = buffer_silent_run(m->bufs[i], j, lim, &silent);
+            if (!silent) mix_add(m, i, j, next);
+        }
+    }
+    return 1;
+}
+
 static int mix_process(struct Node* n) {
     struct Data* out = n->outputs[OUT];
-    struct Data* gains[8] = {NULL};
-    float *bufs[8] = {NULL};
-    float* res;
-    unsigned int sizes[8] = {0}, i;
+    struct MixSlice m = {{NULL}, {NULL}, {0}, NULL};
+    unsigned int i;
     unsigned int size = 0;
 
     if (!mix_valid(n)) return 0;
 
     for (i = 0; i < 8; i++) {
         if (n->inputs[IN0 + i]) {
-            bufs[i] = n->inputs[IN0 + i]->content.buf.data;
-            sizes[i] = n->inputs[IN0 + i]->content.buf.size;
+            m.bufs[i] = n->inputs[IN0 + i]->content.buf.data;
+            m.sizes[i] = n->inputs[IN0 + i]->content.buf.size;
         }
         if (n->inputs[GN0 + i]) {
-            gains[i] = n->inputs[GN0 + i];
+            m.gains[i] = n->inputs[GN0 + i];
         }
     }
     size = n->outputs[0]->content.buf.size;
-    if (!(res = calloc(size, sizeof(float)))) return 0;
-
-    for (i = 0; i < 8; i++) {
-        unsigned int j;
-        float t;
-        for (j = 0; j < sizes[i]; j++) {
-            t = (float) j / (float) sizes[i];
-            res[j] += data_float(gains[i], t, 1.) * bufs[i][j];
-        }
+    /* a single input at unit gain passes through */
+    for (i = 1; i < 8 && !m.bufs[i]; i++);
+    if (       i == 8
+            && (!m.gains[0] || (m.gains[0]->type == DATA_FLOAT
+                                && m.gains[0]->content.f == 1.))) {
+        out->type = DATA_BUFFER;
+        out->content.buf.data = buffer_share(m.bufs[0]);
+        return 1;
+    }
+    if (m.sizes[0] == size && (m.res = node_take_input(n, IN0))) {
+        m.bufs[0] = m.res;
+    } else if (!(m.res = buffer_calloc(size))) {
+        return 0;
     }
+
     out->type = DATA_BUFFER;
-    out->content.buf.data = res;
-    return 1;
+    out->content.buf.data = m.res;
+    return node_slice_run(n, &out->content.buf, 0, mix_slice, &m);
 }
@@ -6,7 +6,7 @@
 #include <sndc.h>
 #include <modules/utils.h>
 
-#define MAX_DELAYLINE_SIZE  2048
+#define MAX_DELAYLINE_SIZE  8192
 
 static int reverb_process(struct Node* n);
 
@@ -15,16 +15,18 @@ const struct Module reverb = {
     "reverb", "effect", "Implementation of the Freeverb algorithm",
     {
         {"in",      DATA_BUFFER,                REQUIRED,
-                    "input buffer to apply reverb to, "
-                    "sampling rate must be 44100 Hz."},
+                    "input buffer to apply reverb to",
+                    0, 0, NULL, DESC_TIMED},
         {"wet",     DATA_FLOAT,                 OPTIONAL,
                     "wetness of effect"},
         {"roomsize",DATA_FLOAT,                 OPTIONAL,
                     "amount of feedback"},
         {"damp",    DATA_FLOAT,                 OPTIONAL,
                     "dampness, low pass filtering of feedback"},
-        {"duration",DATA_FLOAT,                 OPTIONAL,
-                    "duration of output signal, defaults to input's duration"}
+        {"duration",DATA_FLOAT | DATA_STRING,   OPTIONAL,
+                    "duration of output signal, defaults to input's duration, "
+                    "'auto' to end once the tail has decayed",
+                    0, 0, durationNames}
     },
     {
         {"out",     DATA_BUFFER,                REQUIRED,
@@ -34,7 +36,8 @@ const struct Module reverb = {
     },
     NULL,
     reverb_process,
-    NULL
+    NULL,
+    MOD_RANGED | MOD_LOOKBACK
 };
 
 enum ReverbInputType {
@@ -57,6 +60,8 @@ struct DelayLine {
     float cache[MAX_DELAYLINE_SIZE];   /* circular buffer */
     unsigned int head;  /* cur position in the circular buffer */
     unsigned int delay; /* in samples, equals size of buffer */
+    unsigned int loud;  /* samples until the last one not QUIET leaves,
+                         * counted while the input is silent */
 };
 
 static float delayline_out(struct DelayLine* dl) {
@@ -66,8 +71,19 @@ static float delayline_out(struct DelayLine* dl) {
     return res;
 }
 
-static void delayline_in(struct DelayLine* dl, float s) {
+static void delayline_in(struct DelayLine* dl, float s, int count) {
     dl->cache[dl->head] = s;
+    if (count) dl->loud = QUIET(s) ? dl->loud - (dl->loud != 0) : dl->delay;
+}
+
+/* the head holds the last sample in */
+static void delayline_count(struct DelayLine* dl) {
+    unsigned int i;
+
+    for (i = 0; i < dl->delay; i++) {
+        if (!QUIET(dl->cache[(dl->head + dl->delay - i) % dl->delay])) break;
+    }
+    dl->loud = i < dl->delay ? dl->delay - i : 0;
 }
 
 struct OnePole {
@@ -76,7 +92,8 @@ struct OnePole {
 };
 
 static float one_pole(struct OnePole* filter, float s) {
-    return (filter->last = filter->a * s - filter->b * filter->last);
+    filter->last = filter->a * s - filter->b * filter->last;
+    return (filter->last = FLUSH_DENORMAL(filter->last));
 }
 
 struct Freeverb {
@@ -88,118 +105,249 @@ struct Freeverb {
     struct DelayLine ffs[4];
     struct DelayLine fbs2[4];
 
+    unsigned int numCombs;
+    float combGain;     /* keeps the energy of the tail */
+
     float wet, f, d, g;
+    char counted, cleared;
+};
+
+/* delays are tuned for 44100Hz, and scaled to other rates */
+static const unsigned int combDelays[8] = {
+    1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617
 };
+static const unsigned int allpassDelays[4] = {225, 556, 441, 341};
+
+/* draft renders run every other comb */
+#define DRAFT_COMBS 4
+
+static unsigned int scale_delay(unsigned int delay, unsigned int rate) {
+    return (delay * (double) rate) / 44100. + 0.5;
+}
 
-static void setup_freeverb(struct Freeverb* fv,
-                           float wet, float roomsize, float damp, float g) {
-    int i;
+static int setup_freeverb(struct Freeverb* fv, unsigned int rate,
+                          float wet, float roomsize, float damp, float g) {
+    unsigned int i;
 
     memset(fv, 0, sizeof(*fv));
 
+    /* the same damping per second */
+    if (rate != 44100) damp = pow(damp, 44100. / rate);
     for (i = 0; i < 8; i++) {
         fv->lps[i].a = 1. - damp;
         fv->lps[i].b = - damp;
     }
-    fv->fbs[0].delay = 1116;
-    fv->fbs[1].delay = 1188;
-    fv->fbs[2].delay = 1277;
-    fv->fbs[3].delay = 1356;
-    fv->fbs[4].delay = 1422;
-    fv->fbs[5].delay = 1491;
-    fv->fbs[6].delay = 1557;
-    fv->fbs[7].delay = 1617;
-
-    fv->ffs[0].delay    = 225;
-    fv->fbs2[0].delay   = 225;
-    fv->ffs[1].delay    = 556;
-    fv->fbs2[1].delay   = 556;
-    fv->ffs[2].delay    = 441;
-    fv->fbs2[2].delay   = 441;
-    fv->ffs[3].delay    = 341;
-    fv->fbs2[3].delay   = 341;
+    fv->numCombs = settings.draft > 1 ? DRAFT_COMBS : 8;
+    fv->combGain = 1. / sqrt(8 * fv->numCombs);
+    for (i = 0; i < fv->numCombs; i++) {
+        fv->fbs[i].delay = scale_delay(combDelays[i * 8 / fv->numCombs], rate);
+    }
+    for (i = 0; i < 4; i++) {
+        fv->ffs[i].delay = scale_delay(allpassDelays[i], rate);
+        fv->fbs2[i].delay = fv->ffs[i].delay;
+    }
+    if (       fv->fbs[fv->numCombs - 1].delay > MAX_DELAYLINE_SIZE
+            || !fv->ffs[0].delay) {
+        return 0;
+    }
 
     fv->wet = wet;
     fv->f = roomsize;
     fv->d = damp;
     fv->g = g;
+    return 1;
 }
 
-static float freeverb_run(struct Freeverb* fv, float s) {
-    int i;
+static float freeverb_run(struct Freeverb* fv, float s, int count) {
+    unsigned int i;
     float out = 0;
 
-    for (i = 0; i < 8; i++) {
+    for (i = 0; i < fv->numCombs; i++) {
         float d;
         d = delayline_out(&fv->fbs[i]);
         d = one_pole(&fv->lps[i], d) * fv->f + s;
-        delayline_in(&fv->fbs[i], d);
-        out += d / 8;
+        d = FLUSH_DENORMAL(d);
+        delayline_in(&fv->fbs[i], d, count);
+        out += d * fv->combGain;
     }
     for (i = 0; i < 4; i++) {
         float d1, d2;
         d1 = delayline_out(&fv->ffs[i]);
         d2 = delayline_out(&fv->fbs2[i]);
-        delayline_in(&fv->ffs[i], out);
+        delayline_in(&fv->ffs[i], out, count);
         out = fv->g * d2 - out + (1. + fv->g) * d1;
-        delayline_in(&fv->fbs2[i], out);
+        out = FLUSH_DENORMAL(out);
+        delayline_in(&fv->fbs2[i], out, count);
     }
     return out / 8;
 }
 
 static int reverb_setup(struct Node* n, struct Freeverb* fv) {
     float wet = 1., roomsize = 0.84, damp = 0.2, g = 0.5;
-    float duration = (float) n->inputs[INP]->content.buf.size / 44100.;
-    unsigned int size;
+    unsigned int sr = n->inputs[INP]->content.buf.samplingRate;
+    unsigned int size = n->inputs[INP]->content.buf.size;
     struct Buffer* out = &n->outputs[OUT]->content.buf;
 
-    if (n->inputs[INP]->content.buf.samplingRate != 44100) {
-        fprintf(stderr, "Error: %s: "
-                "input buffer must have a sampling rate equal to 44100Hz\n",
-                n->name);
-        return 0;
-    }
     if (n->inputs[WET]) wet      = n->inputs[WET]->content.f;
     if (n->inputs[RSZ]) roomsize = n->inputs[RSZ]->content.f;
     if (n->inputs[DMP]) damp     = n->inputs[DMP]->content.f;
-    if (n->inputs[DUR]) duration = n->inputs[DUR]->content.f;
 
-    size = duration * 44100;
-    if (!(out->data = malloc(size * sizeof(float)))) {
+    if (!setup_freeverb(fv, sr, wet, roomsize, damp, g)) {
+        fprintf(stderr, "Error: %s: "
+                "unsupported input sampling rate %uHz\n", n->name, sr);
+        return 0;
+    }
+
+    /* the longest comb decays the slowest, cut once rendered */
+    if (       n->inputs[DUR] && !AUTO_DURATION(n->inputs[DUR])
+            && !node_size(n, n->inputs[DUR]->content.f, sr, &size)) {
+        return 0;
+    } else if (AUTO_DURATION(n->inputs[DUR]) && wet != 0
+               && !buffer_size(n->name,
+                               (double) n->inputs[INP]->content.buf.size
+                               + tail_length(roomsize,
+                                             fv->fbs[fv->numCombs - 1].delay,
+                                             sr),
+                               &size)) {
+        return 0;
+    }
+    /* dry, the output views the input */
+    if (wet == 0 && size <= n->inputs[INP]->content.buf.size) {
+        out->data = buffer_share(n->inputs[INP]->content.buf.data);
+    } else if (!(out->data = buffer_alloc(size))) {
         fprintf(stderr, "Error: %s: can't malloc output buffer\n", n->name);
         return 0;
     }
     n->outputs[OUT]->type = DATA_BUFFER;
     out->size = size;
-    out->samplingRate = 44100;
+    out->samplingRate = sr;
 
-    setup_freeverb(fv, wet, roomsize, damp, g);
+    return 1;
+}
 
+/* the delay lines and filters are cleared once quiet, their output staying
+ * silent as long as their input. The delay lines are read when the input
+ * turns silent, and their samples counted as they go in afterwards.
+ */
+static int freeverb_quiet(struct Freeverb* fv) {
+    unsigned int i;
+
+    if (!fv->counted) {
+        for (i = 0; i < fv->numCombs; i++) {
+            delayline_count(fv->fbs + i);
+        }
+        for (i = 0; i < 4; i++) {
+            delayline_count(fv->ffs + i);
+            delayline_count(fv->fbs2 + i);
+        }
+        fv->counted = 1;
+    }
+    for (i = 0; i < fv->numCombs; i++) {
+        if (!QUIET(fv->lps[i].last) || fv->fbs[i].loud) return 0;
+    }
+    for (i = 0; i < 4; i++) {
+        if (fv->ffs[i].loud || fv->fbs2[i].loud) return 0;
+    }
+    if (fv->cleared) return 1;
+    for (i = 0; i < fv->numCombs; i++) {
+        memset(fv->fbs[i].cache, 0, fv->fbs[i].delay * sizeof(float));
+        fv->lps[i].last = 0;
+    }
+    for (i = 0; i < 4; i++) {
+        memset(fv->ffs[i].cache, 0, fv->ffs[i].delay * sizeof(float));
+        memset(fv->fbs2[i].cache, 0, fv->fbs2[i].delay * sizeof(float));
+    }
+    fv->cleared = 1;
     return 1;
 }
 
-static int reverb_process(struct Node* n) {
-    unsigned int inSize, outSize, i, lim;
+struct ReverbSlice {
+    const struct Freeverb* fv;
     float *in, *out;
-    struct Freeverb fv;
+    unsigned int lim;
+};
+
+/* each slice runs its own copy of the reverb, fresh from setup */
+static int reverb_slice(void* ctx, unsigned int warm,
+                        unsigned int start, unsigned int end) {
+    struct ReverbSlice* r = ctx;
+    struct Freeverb* fv;
+    unsigned int i, j, next;
+    int silent;
+
+    if (!(fv = malloc(sizeof(*fv)))) {
+        fprintf(stderr, "Error: reverb: can't allocate delay lines\n");
+        return 0;
+    }
+    memcpy(fv, r->fv, sizeof(*fv));
+    for (i = warm; i < start; i++) {
+        freeverb_run(fv, i < r->lim ? r->in[i] : 0, 0);
+    }
+    for (; i < end; i = next) {
+        next = end;
+        silent = i >= r->lim;
+        if (!silent) {
+            next = buffer_silent_run(r->in, i, end < r->lim ? end : r->lim,
+                                     &silent);
+        }
+        /* the tail decays through silence a block at a time */
+        if (silent && freeverb_quiet(fv)) {
+            memset(r->out + i, 0, (next - i) * sizeof(float));
+            continue;
+        } else if (silent && next - i > SILENT_BLOCK) {
+            next = i + SILENT_BLOCK;
+        }
+        fv->counted = silent;
+        fv->cleared = 0;
+        for (j = i; j < next && j < r->lim; j++) {
+            r->out[j] = fv->wet * freeverb_run(fv, r->in[j], silent)
+                      + (1. - fv->wet) * r->in[j];
+        }
+        for (; j < next; j++) {
+            r->out[j] = fv->wet * freeverb_run(fv, 0, silent);
+        }
+    }
+    free(fv);
+    return 1;
+}
+
+static int reverb_process(struct Node* n) {
+    unsigned int inSize, outSize, warmup;
+    struct ReverbSlice r;
+    struct Freeverb* fv;
+    int ok;
 
     GENERIC_CHECK_INPUTS(n, reverb);
 
-    in = n->inputs[INP]->content.buf.data;
+    r.in = n->inputs[INP]->content.buf.data;
     inSize = n->inputs[INP]->content.buf.size;
 
-    if (!reverb_setup(n, &fv)) return 0;
+    if (!(fv = malloc(sizeof(*fv)))) {
+        fprintf(stderr, "Error: %s: can't allocate delay lines\n", n->name);
+        return 0;
+    }
+    if (!reverb_setup(n, fv)) {
+        free(fv);
+        return 0;
+    }
 
-    out = n->outputs[OUT]->content.buf.data;
+    r.fv = fv;
+    r.out = n->outputs[OUT]->content.buf.data;
     outSize = n->outputs[OUT]->content.buf.size;
 
-    lim = inSize < outSize ? inSize : outSize;
-    for (i = 0; i < lim; i++) {
-        out[i] = fv.wet * freeverb_run(&fv, in[i]) + (1. - fv.wet) * in[i];
-    }
-    for (; i < outSize; i++) {
-        out[i] = fv.wet * freeverb_run(&fv, 0);
+    r.lim = inSize < outSize ? inSize : outSize;
+    if (r.out == r.in) {
+        free(fv);
+        return 1;
     }
 
-    return 1;
+    /* the combs' feedback dominates, the allpasses settle much sooner */
+    warmup = slice_warmup(fv->f, fv->fbs[fv->numCombs - 1].delay);
+    ok = node_slice_run(n, &n->outputs[OUT]->content.buf, warmup,
+                        reverb_slice, &r);
+    free(fv);
+    if (ok && AUTO_DURATION(n->inputs[DUR])) {
+        ok = tail_cut(n, &n->outputs[OUT]->content.buf, inSize);
+    }
+    return ok;
 }
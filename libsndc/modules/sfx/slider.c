@@ -10,10 +10,14 @@ const struct Module slider = {
     "slider", "effect",
     "Mix 2 input buffers according to a specified gain profile",
     {
-        {"input0",  DATA_BUFFER,                REQUIRED, "input #0"},
-        {"input1",  DATA_BUFFER,                REQUIRED, "input #1"},
-        {"slider",  DATA_FLOAT | DATA_BUFFER,   REQUIRED, "slider"},
-        {"profile", DATA_BUFFER,                OPTIONAL, "mix profile"}
+        {"input0",  DATA_BUFFER,                REQUIRED, "input #0",
+                    0, 0, NULL, DESC_SAME_RATE},
+        {"input1",  DATA_BUFFER,                REQUIRED, "input #1",
+                    0, 0, NULL, DESC_SAME_RATE},
+        {"slider",  DATA_CONTROL,               REQUIRED, "slider",
+                    0, 0, NULL, DESC_CONTROL | DESC_PACKED},
+        {"profile", DATA_BUFFER,                OPTIONAL, "mix profile",
+                    0, 0, NULL, DESC_CONTROL}
     },
     {
         {"out",     DATA_BUFFER,                REQUIRED, "output buffer"}
@@ -65,18 +69,18 @@ static int slider_process(struct Node* n) {
     out->samplingRate = in0->samplingRate;
     out->interp = in0->interp;
     out->size = in0->size >= in1->size ? in0->size : in1->size;
-    if (!(out->data = calloc(out->size, sizeof(float)))) {
+    if (!(out->data = buffer_calloc(out->size))) {
         fprintf(stderr, "Error: %s: can't malloc output buffer\n", n->name);
         return 0;
     }
 
     for (i = 0; i < in0->size; i++) {
-        float t = (float) i / (float) out->size;
-        out->data[i] = interp(profile, data_float(slide, t, 0)) * in0->data[i];
+        out->data[i] = interp(profile, data_float_at(slide, i, out->size, 0))
+                     * in0->data[i];
     }
     for (i = 0; i < in1->size; i++) {
-        float t = (float) i / (float) out->size;
-        out->data[i] += interp(profile, (1 - data_float(slide, t, 0)))
+        out->data[i] += interp(profile,
+                               1 - data_float_at(slide, i, out->size, 0))
                         * in1->data[i];
     }
     return 1;
@@ -10,6 +10,11 @@ const char* interpNames[] = {
     NULL
 };
 
+const char* durationNames[] = {
+    "auto",
+    NULL
+};
+
 int data_valid(struct Data* data,
                const struct DataDesc* desc,
                const char* ctx) {
@@ -35,15 +40,13 @@ int data_parse_interp(struct Data* data) {
     if (!data) return -1;
     if (data->type != DATA_STRING) return -1;
     if (!data->content.str) return -1;
-    if (!strcmp(data->content.str, "step")) return INTERP_STEP;
-    if (!strcmp(data->content.str, "linear")) return INTERP_LINEAR;
-    if (!strcmp(data->content.str, "sine")) return INTERP_SINE;
-    return -1;
+    return data_which_string(data, interpNames);
 }
 
 int data_which_string(struct Data* data, const char* strings[]) {
     unsigned int i;
 
+    if (data->enumSet == strings) return data->enumVal;
     for (i = 0; strings[i]; i++) {
         if (!strcmp(data->content.str, strings[i])) return i;
     }
@@ -70,30 +73,308 @@ int data_string_valid(struct Data* data, const char* strings[],
     return 0;
 }
 
+/* Curves
+ *
+ * Segments have closed forms, evaluated a block at a time with a libm call
+ * or two per group of KERNEL_LANES samples, anchored on absolute sample
+ * numbers so that slices read the same values.
+ */
+
+#define CURVE_GROUPS    (BLOCK_SIZE / KERNEL_LANES + 2)
+
+static float segment_value(const struct CurvePoint* p, float u) {
+    float v0 = p[0].value, v1 = p[1].value;
+
+    switch (p[1].shape) {
+        case CURVE_STEP:
+            return v0;
+        case CURVE_EXP:
+            if (v0 * v1 > 0) return v0 * pow(v1 / v0, u);
+        case CURVE_LINEAR:
+            return v0 * (1 - u) + v1 * u;
+        case CURVE_SINE:
+            return (v0 - v1) / 2. * cos(M_PI * u) + (v0 + v1) / 2.;
+    }
+    return 0;
+}
+
+/* first point after time, numPoints if none */
+static unsigned int curve_next(const struct Curve* curve, double time) {
+    unsigned int lo = 0, hi = curve->numPoints;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (curve->points[mid].time <= time) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+float curve_value(const struct Curve* curve, double time) {
+    const struct CurvePoint* p = curve->points;
+    unsigned int k;
+
+    if (!curve->numPoints) return 0;
+    if ((k = curve_next(curve, time)) == 0) return p[0].value;
+    if (k == curve->numPoints) return p[k - 1].value;
+    p += k - 1;
+    return segment_value(p, (time - p[0].time) / (p[1].time - p[0].time));
+}
+
+/* samples [first, end[ of the segment starting at p, sample i being at
+ * i * dt seconds, into dest
+ */
+static void curve_segment(float* dest, const struct CurvePoint* p,
+                          unsigned int first, unsigned int end, double dt) {
+    float a[CURVE_GROUPS], b[CURVE_GROUPS], lp[KERNEL_LANES], lq[KERNEL_LANES];
+    float tmp[CURVE_GROUPS * KERNEL_LANES];
+    float v0 = p[0].value, v1 = p[1].value, c = 0;
+    double len = p[1].time - p[0].time, step = dt / len;
+    double offset = p[0].time / len, r = 0;
+    unsigned int g0 = first / KERNEL_LANES, g, j, n;
+    int shape = p[1].shape;
+
+    if (shape == CURVE_STEP) {
+        for (j = 0; j < end - first; j++) {
+            dest[j] = v0;
+        }
+        return;
+    }
+    if (shape == CURVE_EXP && !(v0 * v1 > 0)) {
+        shape = CURVE_LINEAR;
+    } else if (shape == CURVE_EXP) {
+        r = log(v1 / v0);
+    }
+    n = (end - 1) / KERNEL_LANES - g0 + 1;
+    for (g = 0; g < n; g++) {
+        double u = (double) (g0 + g) * KERNEL_LANES * step - offset;
+
+        switch (shape) {
+            case CURVE_LINEAR:
+                a[g] = v0 + (v1 - v0) * u;
+                b[g] = 1;
+                break;
+            case CURVE_SINE:
+                a[g] = (v0 - v1) / 2. * cos(M_PI * u);
+                b[g] = (v1 - v0) / 2. * sin(M_PI * u);
+                break;
+            default:
+                a[g] = v0 * exp(r * u);
+                b[g] = 0;
+                break;
+        }
+    }
+    for (j = 0; j < KERNEL_LANES; j++) {
+        switch (shape) {
+            case CURVE_LINEAR:
+                lp[j] = 1;
+                lq[j] = (v1 - v0) * step * j;
+                break;
+            case CURVE_SINE:
+                lp[j] = cos(M_PI * step * j);
+                lq[j] = sin(M_PI * step * j);
+                c = (v0 + v1) / 2.;
+                break;
+            default:
+                lp[j] = exp(r * step * j);
+                lq[j] = 0;
+                break;
+        }
+    }
+    kernels_get()->segment(tmp, a, b, lp, lq, c, n);
+    memcpy(dest, tmp + (first - g0 * KERNEL_LANES),
+           (end - first) * sizeof(float));
+}
+
+/* first sample from i on, below lim, at time or later */
+static unsigned int curve_reach(double time, double dt,
+                                unsigned int i, unsigned int lim) {
+    double e = ceil(time / dt);
+    unsigned int end = e >= lim ? lim : e > i ? e : i;
+
+    while (end < lim && end * dt < time) end++;
+    while (end > i && (end - 1) * dt >= time) end--;
+    return end;
+}
+
+static void curve_floats(const struct Curve* curve, float* dest,
+                         unsigned int start, unsigned int n,
+                         unsigned int size) {
+    const struct CurvePoint* p = curve->points;
+    double dt = (double) curve->duration / (double) size;
+    unsigned int i, end, k, lim = start + n;
+
+    if (curve->numPoints < 2 || !(dt > 0)) {
+        float v = curve_value(curve, 0);
+
+        for (i = 0; i < n; i++) {
+            dest[i] = v;
+        }
+        return;
+    }
+    k = curve_next(curve, start * dt);
+    for (i = start; i < lim; i = end) {
+        while (k < curve->numPoints && p[k].time <= i * dt) k++;
+        if (k == curve->numPoints) {
+            for (end = i; end < lim; end++) {
+                dest[end - start] = p[k - 1].value;
+            }
+            break;
+        }
+        end = curve_reach(p[k].time, dt, i, lim);
+        if (k == 0) {
+            unsigned int j;
+
+            for (j = i; j < end; j++) {
+                dest[j - start] = p[0].value;
+            }
+        } else {
+            curve_segment(dest + (i - start), p + k - 1, i, end, dt);
+        }
+    }
+}
+
+/* Packed buffers (see storage.c) are read unpacking only the samples
+ * interpolated, a block at a time for data_floats()
+ */
+#define PACKED_BLOCK    256
+
+static float packed_sample(const struct Data* data, unsigned int i) {
+    float v;
+
+    data_unpack_range(data, &v, i, 1);
+    return v;
+}
+
+/* packed interp_sample() */
+static float packed_interp(const struct Data* data, unsigned int i1, float r) {
+    float s[2];
+
+    if (i1 + 1 >= data->content.buf.size) {
+        return packed_sample(data, data->content.buf.size - 1);
+    }
+    data_unpack_range(data, s, i1, 2);
+    return interpf(data->content.buf.interp, s[0], s[1], r);
+}
+
+static float packed_interp_t(const struct Data* data, float t) {
+    float a = t * (data->content.buf.size - 1);
+    float f;
+
+    if (t <= 0) return packed_sample(data, 0);
+    if (t >= 1) return packed_sample(data, data->content.buf.size - 1);
+
+    f = floor(a);
+    return packed_interp(data, f, a - f);
+}
+
+static float packed_interp_at(const struct Data* data,
+                              unsigned int i, unsigned int size) {
+    double a;
+    unsigned int i1;
+
+    if (!i) return packed_sample(data, 0);
+    if (i >= size) return packed_sample(data, data->content.buf.size - 1);
+
+    a = (double) (data->content.buf.size - 1) / size * i;
+    i1 = a;
+    return packed_interp(data, i1, a - i1);
+}
+
+static void packed_floats(const struct Data* data, float* dest,
+                          unsigned int start, unsigned int n,
+                          unsigned int size) {
+    const struct Buffer* buf = &data->content.buf;
+    double step = (double) (buf->size - 1) / size;
+    float s[PACKED_BLOCK];
+    unsigned int lo = 0, hi = 0, i;
+
+    /* s holds the samples lo to hi - 1 */
+    for (i = 0; i < n; i++) {
+        unsigned int j = start + i, i1 = j ? buf->size - 1 : 0;
+        double a = 0;
+
+        if (j && j < size) {
+            a = j * step;
+            i1 = a;
+        }
+        if (i1 < lo || i1 >= hi || (i1 + 1 == hi && hi < buf->size)) {
+            lo = i1;
+            hi = buf->size - lo < PACKED_BLOCK ? buf->size : lo + PACKED_BLOCK;
+            data_unpack_range(data, s, lo, hi - lo);
+        }
+        if (!j || j >= size || i1 + 1 >= buf->size) {
+            dest[i] = s[i1 - lo];
+        } else {
+            dest[i] = interpf(buf->interp, s[i1 - lo], s[i1 + 1 - lo], a - i1);
+        }
+    }
+}
+
 float data_float(struct Data* data, float s, float def) {
     if (!data) return def;
     switch (data->type) {
         case DATA_FLOAT:
             return data->content.f;
         case DATA_BUFFER:
+            if (data->packed.data) return packed_interp_t(data, s);
             return interp(&data->content.buf, s);
+        case DATA_CURVE:
+            return curve_value(&data->content.curve,
+                               s * data->content.curve.duration);
         default:
             return 0;
     }
 }
 
-float interp(struct Buffer* buf, float t) {
-    float a = t * (buf->size - 1);
-    float f, r;
-    unsigned int i1, i2;
+float data_float_at(struct Data* data, unsigned int i, unsigned int size,
+                    float def) {
+    if (!data) return def;
+    switch (data->type) {
+        case DATA_FLOAT:
+            return data->content.f;
+        case DATA_BUFFER:
+            if (data->packed.data) return packed_interp_at(data, i, size);
+            return interp_at(&data->content.buf, i, size);
+        case DATA_CURVE:
+            return curve_value(&data->content.curve,
+                               (double) i / size
+                               * data->content.curve.duration);
+        default:
+            return 0;
+    }
+}
 
-    if (t <= 0) return buf->data[0];
-    if (t >= 1) return buf->data[buf->size - 1];
+void data_floats(struct Data* data, float* dest,
+                 unsigned int start, unsigned int n,
+                 unsigned int size, float def) {
+    unsigned int i;
+
+    if (data && data->type == DATA_CURVE) {
+        curve_floats(&data->content.curve, dest, start, n, size);
+        return;
+    }
+    if (!data || data->type != DATA_BUFFER) {
+        float v = data_float(data, 0, def);
+
+        for (i = 0; i < n; i++) {
+            dest[i] = v;
+        }
+        return;
+    }
+    if (data->packed.data) {
+        packed_floats(data, dest, start, n, size);
+        return;
+    }
+    kernels_get()->interp_at(dest, &data->content.buf, start, size, n);
+}
+
+/* value between samples i1 and i1 + 1, at fraction r */
+static float interp_sample(const struct Buffer* buf, unsigned int i1,
+                           float r) {
+    unsigned int i2 = i1 + 1;
 
-    f = floor(a);
-    r = a - f;
-    i1 = (unsigned int) f;
-    i2 = (i1 + 1);
     if (i1 >= buf->size || i2 >= buf->size) {
         return buf->data[buf->size - 1];
     }
@@ -109,6 +390,29 @@ float interp(struct Buffer* buf, float t) {
     return 0;
 }
 
+float interp(struct Buffer* buf, float t) {
+    float a = t * (buf->size - 1);
+    float f;
+
+    if (t <= 0) return buf->data[0];
+    if (t >= 1) return buf->data[buf->size - 1];
+
+    f = floor(a);
+    return interp_sample(buf, f, a - f);
+}
+
+float interp_at(const struct Buffer* buf, unsigned int i, unsigned int size) {
+    double a;
+    unsigned int i1;
+
+    if (!i) return buf->data[0];
+    if (i >= size) return buf->data[buf->size - 1];
+
+    a = (double) (buf->size - 1) / size * i;
+    i1 = a;
+    return interp_sample(buf, i1, a - i1);
+}
+
 float interpf(int type, float a, float b, float t) {
     switch (type) {
         case INTERP_STEP:
@@ -145,11 +449,53 @@ float convol(struct Buffer* buf,
 }
 
 void addbuf(float* dest, float* src, unsigned int size) {
-    unsigned int i;
+    kernels_get()->add(dest, src, size);
+}
+
+/* the state of the loop is at most 1 / (1 - gain) for a full scale input */
+unsigned int tail_length(float gain, unsigned int period, float rate) {
+    double len, max = TAIL_MAX * rate;
+
+    gain = fabs(gain);
+    if (gain >= 1.) return max;
+    if (gain <= 0.) return period < max ? period : max;
+    len = ceil(log(TAIL_LEVEL * (1. - gain)) / log(gain)) * period;
+    return len < max ? len : max;
+}
+
+unsigned int tail_end(const float* data, unsigned int start,
+                      unsigned int size, float rate) {
+    unsigned int window = TAIL_WINDOW * rate, from, i;
+    double sum;
 
-    for (i = 0; i < size; i++) {
-        dest[i] += src[i];
+    if (!window) window = 1;
+    while (size > start) {
+        from = size - start > window ? size - window : start;
+        for (sum = 0, i = from; i < size; i++) {
+            sum += data[i] * data[i];
+        }
+        if (sum > TAIL_LEVEL * TAIL_LEVEL * (size - from)) break;
+        size = from;
     }
+    return size;
+}
+
+int tail_cut(const struct Node* n, struct Buffer* out, unsigned int start) {
+    unsigned int lo, hi, end;
+    float* data;
+
+    /* the samples outside the range are zero, not the tail */
+    node_range(n, out->samplingRate, out->size, &lo, &hi);
+    if (lo || hi < out->size) return 1;
+    end = tail_end(out->data, start, out->size, out->samplingRate);
+    if (end == out->size) return 1;
+    if (!(data = buffer_realloc(out->data, end))) {
+        fprintf(stderr, "Error: %s: can't cut tail\n", n->name);
+        return 0;
+    }
+    out->data = data;
+    out->size = end;
+    return 1;
 }
 
 /* A4 = 440 Hz */
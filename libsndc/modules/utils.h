@@ -1,12 +1,37 @@
 #ifndef M_UTILS_H
 #define M_UTILS_H
 
+#include <float.h>
+
 #include "../sndc.h"
 
 #define M_PI 3.14159265358979
 
+/* zero for subnormal values, for the state of feedback loops decaying to
+ * silence, which would stall when denormals aren't flushed by the FPU
+ */
+#define FLUSH_DENORMAL(x) ((x) < FLT_MIN && (x) > -FLT_MIN ? 0.f : (x))
+
+/* level under which the tail of a feedback loop running through silence is
+ * cut, under the resolution of 24 bits samples
+ */
+#define SILENT_LEVEL    1e-7
+#define QUIET(x)        ((x) < SILENT_LEVEL && (x) > -SILENT_LEVEL)
+
+/* durations set to "auto" end once the signal stays under TAIL_LEVEL, -96dBFS,
+ * for TAIL_WINDOW seconds, tails being at most TAIL_MAX seconds long
+ */
+#define TAIL_LEVEL      1.5849e-5
+#define TAIL_WINDOW     0.1
+#define TAIL_MAX        60.
+#define AUTO_DURATION(d) ((d) && (d)->type == DATA_STRING)
+
+/* samples processed at a time by modules calling kernels with scratch data */
+#define BLOCK_SIZE  256
+
+/* nodes whose inputs were already checked by stack_load skip validation */
 #define GENERIC_CHECK_INPUTS(n, m) \
-{ \
+if (!(n)->isValid) { \
     unsigned int i; \
     if (NUM_INPUTS > MAX_INPUTS) { \
         fprintf(stderr, \
@@ -22,15 +47,31 @@
 }
 
 extern const char* interpNames[];
+extern const char* durationNames[];
 
 int data_valid(struct Data* data, const struct DataDesc* desc, const char* ctx);
 float data_float(struct Data* data, float s, float def);
+/* data_float() at position i / size, which a float position only gives
+ * for i under 2^24, six minutes at 44100Hz
+ */
+float data_float_at(struct Data* data, unsigned int i, unsigned int size,
+                    float def);
+/* value of a curve at time seconds */
+float curve_value(const struct Curve* curve, double time);
+/* data_float() at positions (start + i) / size for i < n <= BLOCK_SIZE,
+ * buffers interpolated and curves evaluated a block at a time
+ */
+void data_floats(struct Data* data, float* dest,
+                 unsigned int start, unsigned int n,
+                 unsigned int size, float def);
 int data_parse_interp(struct Data* data);
 int data_which_string(struct Data* data, const char* strings[]);
 int data_string_valid(struct Data* data, const char* strings[],
                       const char* inputName, const char* nodeName);
 
 float interp(struct Buffer* buf, float t);
+/* interp() at position i / size */
+float interp_at(const struct Buffer* buf, unsigned int i, unsigned int size);
 float interpf(int type, float a, float b, float t);
 float convol(struct Buffer* buf,
              struct Buffer* fun,
@@ -38,6 +79,18 @@ float convol(struct Buffer* buf,
              unsigned int pos);
 void addbuf(float* dest, float* src, unsigned int size);
 
+/* samples a feedback loop of given gain and period in samples takes to decay
+ * from full scale to TAIL_LEVEL, at most TAIL_MAX seconds at rate
+ */
+unsigned int tail_length(float gain, unsigned int period, float rate);
+/* end of the signal in the size samples of data, not before start */
+unsigned int tail_end(const float* data, unsigned int start,
+                      unsigned int size, float rate);
+/* cuts an output rendered past start to tail_end(), unless the node only
+ * rendered a range of it
+ */
+int tail_cut(const struct Node* n, struct Buffer* out, unsigned int start);
+
 int note_to_freq(const char* note, float* freq);
 
 #endif
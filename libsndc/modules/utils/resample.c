@@ -0,0 +1,60 @@
+#include <stdio.h>
+
+#include <sndc.h>
+#include <modules/utils.h>
+
+static int resample_process(struct Node* n);
+
+static const char* qualityNames[] = {"fast", "best", NULL};
+
+/* DECLARE_MODULE(resample) */
+const struct Module resample = {
+    "resample", "util", "Polyphase resampler, to a new sampling rate",
+    {
+        {"in",          DATA_BUFFER,    REQUIRED,
+                        "input buffer"},
+
+        {"sampling",    DATA_FLOAT,     REQUIRED,
+                        "sampling rate of the output, in Hz"},
+
+        {"quality",     DATA_STRING,    OPTIONAL,
+                        "'fast' or 'best', def 'best'",
+                        0, 0, qualityNames}
+    },
+    {
+        {"out",         DATA_BUFFER,    REQUIRED,
+                        "resampled buffer"}
+    },
+    NULL,
+    resample_process,
+    NULL
+};
+
+enum ResampleInputType {
+    INP,
+    SPL,
+    QUA,
+
+    NUM_INPUTS
+};
+
+static int resample_process(struct Node* n) {
+    struct Buffer* in;
+    struct Data* out = n->outputs[0];
+    int quality = RESAMPLE_BEST;
+    float rate;
+
+    GENERIC_CHECK_INPUTS(n, resample);
+
+    in = &n->inputs[INP]->content.buf;
+    rate = n->inputs[SPL]->content.f;
+    if (n->inputs[QUA]) {
+        quality = data_which_string(n->inputs[QUA], qualityNames);
+    }
+    if (rate < 1) {
+        fprintf(stderr, "Error: %s: invalid sampling rate\n", n->name);
+        return 0;
+    }
+    out->type = DATA_BUFFER;
+    return resample_buffer(&out->content.buf, in, rate, quality);
+}
@@ -26,7 +26,8 @@ const struct Module var = {
     },
     NULL,
     var_process,
-    NULL
+    NULL,
+    MOD_UNIQUE
 };
 
 enum VarInputType {
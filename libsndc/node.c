@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <float.h>
 
 #include "sndc.h"
 
@@ -17,6 +19,12 @@ void node_init(struct Node* node) {
     node->process = NULL;
     node->teardown = NULL;
     node->isSetup = 0;
+    node->isValid = 0;
+    node->control = 0;
+    node->curve = 0;
+    node->inplace = 0;
+    node->from = 0;
+    node->to = FLT_MAX;
 }
 
 void node_free(struct Node* node) {
@@ -43,7 +51,15 @@ void stack_init(struct Stack* stack) {
     stack->numNodes = 0;
     stack->numData = 0;
     stack->numImports = 0;
+    stack->capNodes = 0;
+    stack->capData = 0;
+    stack->capImports = 0;
+    symtab_init(&stack->nodeIndex);
+    symtab_init(&stack->importIndex);
+    stack->path = NULL;
     stack->verbose = 0;
+    stack->profile = 0;
+    stack->range[0] = stack->range[1] = 0;
 }
 
 void stack_free(struct Stack* stack) {
@@ -64,18 +80,38 @@ void stack_free(struct Stack* stack) {
         free(stack->imports[i]);
     }
     free(stack->imports);
+    symtab_free(&stack->nodeIndex);
+    symtab_free(&stack->importIndex);
     free(stack->path);
 }
 
+/* grows the array of elements of size elem whose address is at array
+ * geometrically, so that loading n nodes stays O(n); the address is copied
+ * rather than read through a void**, which would alias its actual type
+ */
+static int grow(void* array, size_t elem, unsigned int num,
+                unsigned int* cap) {
+    void *a, *tmp;
+    unsigned int size;
+
+    if (num < *cap) return 1;
+    size = *cap ? 2 * *cap : 16;
+    memcpy(&a, array, sizeof(a));
+    if (!(tmp = realloc(a, size * elem))) {
+        return 0;
+    }
+    memcpy(array, &tmp, sizeof(tmp));
+    *cap = size;
+    return 1;
+}
+
 struct Node* stack_node_new(struct Stack* stack, const char* name) {
     struct Node* new = NULL;
-    void* tmp;
 
-    if (!(tmp = realloc(stack->nodes,
-                    (stack->numNodes + 1) * sizeof(struct Node)))) {
+    if (!grow(&stack->nodes, sizeof(*stack->nodes),
+              stack->numNodes, &stack->capNodes)) {
         return NULL;
     }
-    stack->nodes = tmp;
     if (!(new = malloc(sizeof(struct Node)))) return NULL;
 
     node_init(new);
@@ -83,6 +119,11 @@ struct Node* stack_node_new(struct Stack* stack, const char* name) {
         free(new);
         return NULL;
     }
+    if (!symtab_set(&stack->nodeIndex, new->name, stack->numNodes)) {
+        free((char*)new->name);
+        free(new);
+        return NULL;
+    }
     stack->nodes[stack->numNodes] = new;
     stack->numNodes++;
     return new;
@@ -111,13 +152,12 @@ int stack_node_set_module(struct Stack* stack,
 }
 
 struct Data* stack_data_new(struct Stack* stack) {
-    void* tmp;
     struct Data* new;
 
-    if (!(tmp = realloc(stack->data, (stack->numData + 1) * sizeof(void*)))) {
+    if (!grow(&stack->data, sizeof(*stack->data),
+              stack->numData, &stack->capData)) {
         return NULL;
     }
-    stack->data = tmp;
     if (!(new = malloc(sizeof(struct Data)))) return NULL;
     stack->data[stack->numData] = new;
     stack->numData++;
@@ -127,14 +167,12 @@ struct Data* stack_data_new(struct Stack* stack) {
 }
 
 struct Module* stack_import_new(struct Stack* stack) {
-    void* tmp;
     struct Module* new;
 
-    if (!(tmp = realloc(stack->imports,
-                        (stack->numImports + 1) * sizeof(void*)))) {
+    if (!grow(&stack->imports, sizeof(*stack->imports),
+              stack->numImports, &stack->capImports)) {
         return NULL;
     }
-    stack->imports = tmp;
     if (!(new = calloc(1, sizeof(struct Module)))) return NULL;
     stack->imports[stack->numImports] = new;
     stack->numImports++;
@@ -143,24 +181,114 @@ struct Module* stack_import_new(struct Stack* stack) {
 }
 
 struct Node* stack_get_node(struct Stack* stack, const char* name) {
+    int i;
+
+    if ((i = symtab_get(&stack->nodeIndex, name)) < 0) {
+        return NULL;
+    }
+    return stack->nodes[i];
+}
+
+/* subnormal samples in the node's buffer outputs, exponent bits all 0 */
+static unsigned long count_subnormals(const struct Node* n) {
+    unsigned long count = 0;
+    unsigned int i, j;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        const struct Data* d = n->outputs[i];
+
+        if (!d || d->type != DATA_BUFFER || !d->content.buf.data) continue;
+        for (j = 0; j < d->content.buf.size; j++) {
+            uint32_t v;
+
+            memcpy(&v, d->content.buf.data + j, sizeof(v));
+            count += !(v & 0x7f800000UL) && (v & 0x007fffffUL);
+        }
+    }
+    return count;
+}
+
+/* the silent blocks of the buffer outputs kept as floats, for their readers
+ * to skip
+ */
+static void map_silence(const struct Node* n) {
     unsigned int i;
 
-    for (i = 0; i < stack->numNodes; i++) {
-        if (!strcmp(stack->nodes[i]->name, name)) {
-            return stack->nodes[i];
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        const struct Data* d = n->outputs[i];
+
+        if (d && d->type == DATA_BUFFER && d->storage == STORE_F32) {
+            buffer_map_silence(d->content.buf.data, d->content.buf.size);
         }
     }
-    return NULL;
+}
+
+/* inputs read by interpolation need a sample at least */
+static int check_empty_inputs(const struct Node* n) {
+    unsigned int i;
+
+    if (!n->module) return 1;
+    for (i = 0; i < MAX_INPUTS; i++) {
+        const struct Data* d = n->inputs[i];
+
+        if (       d && d->type == DATA_BUFFER && !d->content.buf.size
+                && (n->module->inputs[i].flags
+                    & (DESC_CONTROL | DESC_INTERP))) {
+            fprintf(stderr, "Error: %s: %s is an empty buffer\n",
+                    n->name, n->module->inputs[i].name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int stack_process_node(struct Stack* stack, struct Node* node) {
+    struct Data *saved[MAX_INPUTS], temp[MAX_INPUTS];
+    struct timespec start, end;
+    unsigned long fpState;
+    int ok;
+
+    if (stack->verbose) {
+        fprintf(stderr, "Processing %s\n", node->name);
+    }
+    if (!check_empty_inputs(node)) {
+        return 0;
+    } else if (!node_unpack_inputs(node, saved, temp)) {
+        return 0;
+    } else if (!node_match_rates(node, temp)) {
+        node_restore_inputs(node, saved, temp);
+        return 0;
+    }
+    if (stack->profile) clock_gettime(CLOCK_MONOTONIC, &start);
+    fpState = denormals_disable();
+    ok = node->process(node);
+    denormals_restore(fpState);
+    node_restore_inputs(node, saved, temp);
+    if (stack->profile && ok) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fprintf(stderr, "Profile: %s (%s%s%s): %.3f ms, "
+                        "%lu subnormal samples\n",
+                node->name,
+                node->module ? node->module->name : "?",
+                node->control ? ", control rate" : "",
+                node->curve && node->outputs[0]->type == DATA_CURVE
+                    ? ", curve" : "",
+                (end.tv_sec - start.tv_sec) * 1e3
+                + (end.tv_nsec - start.tv_nsec) / 1e6,
+                count_subnormals(node));
+    }
+    if (ok) {
+        map_silence(node);
+        node_pack_outputs(node);
+    }
+    return ok;
 }
 
 int stack_process(struct Stack* stack) {
     unsigned int i;
 
     for (i = 0; i < stack->numNodes; i++) {
-        if (stack->verbose) {
-            fprintf(stderr, "Processing %s\n", stack->nodes[i]->name);
-        }
-        if (!stack->nodes[i]->process(stack->nodes[i])) {
+        if (!stack_process_node(stack, stack->nodes[i])) {
             fprintf(stderr, "Error: processing failed\n");
             return 0;
         }
@@ -170,10 +298,14 @@ int stack_process(struct Stack* stack) {
 
 static int node_load(struct Stack* stack, struct Entry* e, struct Node* n);
 
+/* loads a field into the matching input of n, and stores in *type the type
+ * the input is known to have once upstream nodes are processed, 0 if unknown
+ */
 static int load_input(struct Stack* stack,
                       const struct Module* mod,
                       struct Node* n,
-                      struct Field* f) {
+                      struct Field* f,
+                      int* type) {
     int slot;
 
     if ((slot = module_get_input_slot(mod, f->name)) < 0) {
@@ -194,16 +326,22 @@ static int load_input(struct Stack* stack,
                     d->type = DATA_FLOAT;
                     d->content.f = f->data.f;
                     n->inputs[slot] = d;
+                    type[slot] = DATA_FLOAT;
                     return 1;
                 }
                 break;
             case FIELD_STRING:
                 if ((d = stack_data_new(stack))) {
                     d->type = DATA_STRING;
-                    if ((d->content.str = str_cpy(f->data.str))) {
-                        n->inputs[slot] = d;
-                        return 1;
+                    if (!(d->content.str = str_cpy(f->data.str))) {
+                        break;
+                    } else if (!data_parse_enum(d, mod->inputs + slot,
+                                                n->name)) {
+                        break;
                     }
+                    n->inputs[slot] = d;
+                    type[slot] = DATA_STRING;
+                    return 1;
                 }
                 break;
             case FIELD_REF:
@@ -224,6 +362,7 @@ static int load_input(struct Stack* stack,
                             n->name, r->name, f->data.ref.field);
                 } else {
                     n->inputs[slot] = r->outputs[refslot];
+                    type[slot] = refmod->outputs[refslot].type;
                     return 1;
                 }
                 break;
@@ -236,24 +375,44 @@ static int load_input(struct Stack* stack,
     return 0;
 }
 
-static struct Module* imported_module_find(struct Stack* s, const char* name) {
+/* a node is valid if each input is either absent and optional, or can only
+ * ever hold types accepted by the module
+ */
+static int node_check_static(const struct Node* n, const int* type) {
+    const struct Module* mod = n->module;
     unsigned int i;
 
-    for (i = 0; i < s->numImports; i++) {
-        if (s->imports[i]->name && !strcmp(s->imports[i]->name, name)) {
-            return s->imports[i];
+    for (i = 0; i < MAX_INPUTS; i++) {
+        const struct DataDesc* desc = mod->inputs + i;
+
+        if (!desc->name) {
+            if (n->inputs[i]) return 0;
+        } else if (!n->inputs[i]) {
+            if (desc->req) return 0;
+        } else if (!desc->type || !type[i] || (type[i] & ~desc->type)) {
+            return 0;
         }
     }
-    return NULL;
+    return 1;
+}
+
+static struct Module* imported_module_find(struct Stack* s, const char* name) {
+    int i;
+
+    if ((i = symtab_get(&s->importIndex, name)) < 0) {
+        return NULL;
+    }
+    return s->imports[i];
 }
 
 static int node_load(struct Stack* stack, struct Entry* e, struct Node* n) {
     const struct Module* mod;
     int ok = 1;
 
-    n->path = stack->path;
+    n->path = e->path ? e->path : stack->path;
 
-    if (       !(mod = imported_module_find(stack, e->type))
+    /* the imports of spliced entries are flattened too */
+    if (       (e->path || !(mod = imported_module_find(stack, e->type)))
             && !(mod = module_find(e->type))) {
         fprintf(stderr, "Error: %s: no such module\n", e->type);
         ok = 0;
@@ -261,19 +420,22 @@ static int node_load(struct Stack* stack, struct Entry* e, struct Node* n) {
         fprintf(stderr, "Error: can't create new node\n");
         ok = 0;
     } else {
+        int types[MAX_INPUTS] = {0};
         unsigned int j;
 
         for (j = 0; j < e->numFields; j++) {
-            if (!(load_input(stack, mod, n, e->fields + j))) {
+            if (!(load_input(stack, mod, n, e->fields + j, types))) {
                 ok = 0;
                 break;
             }
         }
+        n->isValid = ok && node_check_static(n, types);
     }
     return ok;
 }
 
 int stack_load(struct Stack* stack, struct SNDCFile* file) {
+    struct SNDCFile flat;
     unsigned int i;
     int ok = 1;
 
@@ -292,11 +454,24 @@ int stack_load(struct Stack* stack, struct SNDCFile* file) {
         } else if (!module_import(new, imp->importName, imp->fileName)) {
             fprintf(stderr, "Error: module import failed\n");
             return 0;
+        } else if (!symtab_set(&stack->importIndex,
+                               new->name,
+                               stack->numImports - 1)) {
+            fprintf(stderr, "Error: can't index module\n");
+            return 0;
         }
     }
 
-    for (i = 0; i < file->numEntries && ok; i++) {
-        struct Entry* e = &file->entries[i];
+    if (!stack_flatten(stack, file, &flat)) {
+        stack_free(stack);
+        return 0;
+    } else if (!stack_merge(stack, &flat)) {
+        free_sndc(&flat);
+        stack_free(stack);
+        return 0;
+    }
+    for (i = 0; i < flat.numEntries && ok; i++) {
+        struct Entry* e = &flat.entries[i];
         struct Node* new;
 
         if (!(new = stack_node_new(stack, e->name))) {
@@ -310,6 +485,13 @@ int stack_load(struct Stack* stack, struct SNDCFile* file) {
             ok = 0;
         }
     }
+    if (ok && (       !stack_plan_control(stack, &flat)
+                   || !stack_plan_range(stack, &flat)
+                   || !stack_plan_storage(stack, &flat)
+                   || !stack_plan_inplace(stack, &flat))) {
+        ok = 0;
+    }
+    free_sndc(&flat);
     if (!ok) stack_free(stack);
     return ok;
 }
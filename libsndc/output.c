@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "sndc.h"
+
+/* Output stage
+ *
+ * Samples are encoded by the caller in chunks and pushed into a single
+ * producer / single consumer ring, a writer thread pops them and writes them
+ * to the file, so that encoding and I/O overlap, and the caller can go on
+ * (tearing down the stack, rendering the next file) while the last chunks are
+ * being written. The writer is started by the first write and sleeps while the
+ * ring is empty, as does the caller while it is full.
+ */
+
+#define CHUNK_SAMPLES   8192
+#define RING_SLOTS      8
+
+struct Chunk {
+    unsigned char data[CHUNK_SAMPLES * 4];
+    unsigned int size;
+};
+
+struct Output {
+    FILE* file;
+    char* name;
+    enum OutputFormat format;
+    uint32_t dither[KERNEL_DITHER_LANES];
+
+    struct Chunk ring[RING_SLOTS];
+    /* head is only written by the producer, tail by the writer, both under
+     * lock, filled being signaled on push and freed on pop
+     */
+    unsigned int head, tail;
+    int done, error;
+    pthread_mutex_t lock;
+    pthread_cond_t filled, freed;
+    pthread_t writer;
+    char sync, started, written;
+};
+
+static const char* formatNames[] = {"raw", "f32", "s16", "s24", NULL};
+static const unsigned int formatBytes[] = {4, 4, 2, 3};
+
+int output_format(const char* name, enum OutputFormat* format) {
+    unsigned int i;
+
+    for (i = 0; formatNames[i]; i++) {
+        if (!strcmp(formatNames[i], name)) {
+            *format = i;
+            return 1;
+        }
+    }
+    fprintf(stderr, "Error: unknown output format: %s "
+                    "(expected raw, f32, s16 or s24)\n", name);
+    return 0;
+}
+
+/*** Ring ***/
+
+static void* writer_run(void* arg) {
+    struct Output* out = arg;
+    unsigned int tail = 0;
+    int error = 0;
+
+    for (;;) {
+        struct Chunk* c;
+
+        pthread_mutex_lock(&out->lock);
+        while (tail == out->head && !out->done) {
+            pthread_cond_wait(&out->filled, &out->lock);
+        }
+        if (tail == out->head) {
+            pthread_mutex_unlock(&out->lock);
+            break;
+        }
+        pthread_mutex_unlock(&out->lock);
+
+        /* the producer doesn't touch the chunk until tail moves past it */
+        c = out->ring + tail % RING_SLOTS;
+        if (!error && fwrite(c->data, 1, c->size, out->file) != c->size) {
+            error = 1;
+        }
+        tail++;
+
+        pthread_mutex_lock(&out->lock);
+        out->tail = tail;
+        out->error = error;
+        pthread_cond_signal(&out->freed);
+        pthread_mutex_unlock(&out->lock);
+    }
+    return NULL;
+}
+
+static int ring_error(struct Output* out) {
+    int error;
+
+    pthread_mutex_lock(&out->lock);
+    error = out->error;
+    pthread_mutex_unlock(&out->lock);
+    return error;
+}
+
+/* returns the next free chunk, waiting for the writer if the ring is full */
+static struct Chunk* ring_reserve(struct Output* out) {
+    unsigned int head;
+
+    pthread_mutex_lock(&out->lock);
+    head = out->head;
+    while (head - out->tail >= RING_SLOTS) {
+        pthread_cond_wait(&out->freed, &out->lock);
+    }
+    pthread_mutex_unlock(&out->lock);
+    return out->ring + head % RING_SLOTS;
+}
+
+static void ring_push(struct Output* out) {
+    pthread_mutex_lock(&out->lock);
+    out->head++;
+    pthread_cond_signal(&out->filled);
+    pthread_mutex_unlock(&out->lock);
+}
+
+/*** Encoding ***/
+
+static void put_u16(unsigned char* p, unsigned int v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(unsigned char* p, unsigned long v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* the sizes are 32 bits, and chunks padded to an even size */
+#define WAV_MAX_DATA    (0xffffffffUL - 36 - 1)
+
+static unsigned int wav_header(unsigned char* h,
+                               enum OutputFormat format,
+                               unsigned int samplingRate,
+                               unsigned long numSamples) {
+    unsigned int bytes = formatBytes[format];
+    unsigned long dataSize = numSamples * bytes;
+
+    memcpy(h, "RIFF", 4);
+    put_u32(h + 4, 36 + dataSize + (dataSize & 1));
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_u32(h + 16, 16);
+    put_u16(h + 20, format == OUTPUT_F32 ? 3 : 1); /* IEEE float or PCM */
+    put_u16(h + 22, 1);
+    put_u32(h + 24, samplingRate);
+    put_u32(h + 28, (unsigned long) samplingRate * bytes);
+    put_u16(h + 32, bytes);
+    put_u16(h + 34, 8 * bytes);
+    memcpy(h + 36, "data", 4);
+    put_u32(h + 40, dataSize);
+    return 44;
+}
+
+/*** API ***/
+
+struct Output* output_open(const char* filename, enum OutputFormat format) {
+    struct Output* out;
+    unsigned int i;
+
+    if (!(out = calloc(1, sizeof(*out)))) {
+        fprintf(stderr, "Error: output_open: can't allocate output\n");
+        return NULL;
+    }
+    out->format = format;
+    for (i = 0; i < KERNEL_DITHER_LANES; i++) {
+        out->dither[i] = 0x9e3779b9UL * (i + 1);
+    }
+    if (!filename) {
+        out->file = stdout;
+    } else if (!(out->name = str_cpy(filename))
+               || !(out->file = fopen(filename, "wb"))) {
+        fprintf(stderr, "Error: can't open %s for writing\n", filename);
+        free(out->name);
+        free(out);
+        return NULL;
+    }
+    if (pthread_mutex_init(&out->lock, NULL)) {
+        fprintf(stderr, "Error: output_open: can't init lock\n");
+        output_close(out);
+        return NULL;
+    }
+    if (pthread_cond_init(&out->filled, NULL)) {
+        fprintf(stderr, "Error: output_open: can't init condition\n");
+        pthread_mutex_destroy(&out->lock);
+        output_close(out);
+        return NULL;
+    }
+    if (pthread_cond_init(&out->freed, NULL)) {
+        fprintf(stderr, "Error: output_open: can't init condition\n");
+        pthread_cond_destroy(&out->filled);
+        pthread_mutex_destroy(&out->lock);
+        output_close(out);
+        return NULL;
+    }
+    out->sync = 1;
+    return out;
+}
+
+int output_write(struct Output* out, const struct Buffer* buf) {
+    const struct Kernels* k = kernels_get();
+    unsigned int bytes = formatBytes[out->format], i;
+    struct Chunk* c;
+
+    if (out->written) {
+        fprintf(stderr, "Error: output_write: output already written\n");
+        return 0;
+    }
+    out->written = 1;
+    if (out->format != OUTPUT_RAW && buf->size > WAV_MAX_DATA / bytes) {
+        fprintf(stderr, "Error: output_write: %lu bytes of samples, "
+                        "a WAV file holds 4GB at most (use -f raw)\n",
+                (unsigned long) buf->size * bytes);
+        return 0;
+    }
+    if (pthread_create(&out->writer, NULL, writer_run, out)) {
+        fprintf(stderr, "Error: output_write: can't start writer thread\n");
+        return 0;
+    }
+    out->started = 1;
+    if (out->format != OUTPUT_RAW) {
+        c = ring_reserve(out);
+        c->size = wav_header(c->data, out->format,
+                             buf->samplingRate, buf->size);
+        ring_push(out);
+    }
+    for (i = 0; i < buf->size; i += CHUNK_SAMPLES) {
+        unsigned int n = buf->size - i;
+
+        n = n < CHUNK_SAMPLES ? n : CHUNK_SAMPLES;
+        c = ring_reserve(out);
+        if (out->format == OUTPUT_RAW) {
+            memcpy(c->data, buf->data + i, n * sizeof(float));
+        } else if (bytes == 4) {
+            k->encode_f32(c->data, buf->data + i, n);
+        } else {
+            k->encode_int(c->data, buf->data + i, n, bytes, out->dither);
+        }
+        c->size = n * bytes;
+        ring_push(out);
+        if (ring_error(out)) break;
+    }
+    if (out->format != OUTPUT_RAW && (buf->size * bytes) & 1) {
+        c = ring_reserve(out);
+        c->data[0] = 0;
+        c->size = 1;
+        ring_push(out);
+    }
+    return !ring_error(out);
+}
+
+int output_close(struct Output* out) {
+    int ok;
+
+    if (out->started) {
+        pthread_mutex_lock(&out->lock);
+        out->done = 1;
+        pthread_cond_signal(&out->filled);
+        pthread_mutex_unlock(&out->lock);
+        pthread_join(out->writer, NULL);
+    }
+    ok = !out->error && !ferror(out->file);
+    if (out->sync) {
+        pthread_cond_destroy(&out->freed);
+        pthread_cond_destroy(&out->filled);
+        pthread_mutex_destroy(&out->lock);
+    }
+    if (out->file == stdout) {
+        ok = !fflush(stdout) && ok;
+    } else if (fclose(out->file)) {
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: can't write %s\n",
+                out->name ? out->name : "output");
+    }
+    free(out->name);
+    free(out);
+    return ok;
+}
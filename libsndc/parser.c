@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "sndc.h"
 #include "tokens.h"
@@ -61,35 +62,35 @@ char* str_cpy(const char* s) {
     return res;
 }
 
-static int get_node(const struct SNDCFile* f, const char* name) {
-    int i = 0;
-
-    for (i = 0; i < f->numEntries; i++) {
-        if (!strcmp(f->entries[i].name, name)) {
-            return i;
-        }
-    }
-    return -1;
+static char* intern(struct SNDCFile* f, const char* s) {
+    return strpool_add(&f->strings, s, strlen(s));
 }
 
 #define NEW_ELEM_FUNC(n, t1, t2, a, c, m) \
 static struct t2* new_##n(struct t1* container) { \
     struct t2* res = NULL; \
-    if (container->c < m) { \
-        res = container->a + (container->c ++); \
-        memset(res, 0, sizeof(*res)); \
+    if (container->c >= container->m) { \
+        unsigned int size = container->m ? 2 * container->m : 16; \
+        void* tmp; \
+        if (!(tmp = realloc(container->a, size * sizeof(struct t2)))) { \
+            return NULL; \
+        } \
+        container->a = tmp; \
+        container->m = size; \
     } \
+    res = container->a + (container->c ++); \
+    memset(res, 0, sizeof(*res)); \
     return res; \
 }
 
-NEW_ELEM_FUNC(field, Entry, Field, fields, numFields, MAX_FIELDS)
+NEW_ELEM_FUNC(field, SNDCFile, Field, fields, numFields, capFields)
 
-NEW_ELEM_FUNC(import, SNDCFile, Import, imports, numImport, MAX_IMPORT)
-NEW_ELEM_FUNC(export, SNDCFile, Export, exports, numExport, MAX_EXPORT)
-NEW_ELEM_FUNC(entry, SNDCFile, Entry, entries, numEntries, MAX_ENTRIES)
+NEW_ELEM_FUNC(import, SNDCFile, Import, imports, numImport, capImport)
+NEW_ELEM_FUNC(export, SNDCFile, Export, exports, numExport, capExport)
+NEW_ELEM_FUNC(entry, SNDCFile, Entry, entries, numEntries, capEntries)
 
 
-static int parse_ref(struct Field* field, char* name) {
+static int parse_ref(struct SNDCFile* f, struct Field* field, char* name) {
     int token;
 
     field->type = FIELD_REF;
@@ -97,7 +98,7 @@ static int parse_ref(struct Field* field, char* name) {
 
     if ((token = yylex()) != IDENT) {
         invalid_token(token, IDENT);
-    } else if (!(field->data.ref.field = str_cpy(strVal))) {
+    } else if (!(field->data.ref.field = intern(f, strVal))) {
         fprintf(stderr, "Error: parse_data: can't alloc string\n");
     } else {
         return 1;
@@ -133,17 +134,18 @@ static int parse_data(struct SNDCFile* f,
             ok = 1;
             break;
         case STRING_LIT:
-            if ((field->data.str = str_cpy(yytext + 1))) {
+            if ((field->data.str = strpool_add(&f->strings,
+                                               yytext + 1,
+                                               strlen(yytext) - 2))) {
                 field->type = FIELD_STRING;
-                field->data.str[strlen(field->data.str) - 1] = '\0';
                 ok = 1;
             }
             break;
         case IDENT:
-            if ((sv = str_cpy(strVal))) {
+            if ((sv = intern(f, strVal))) {
                 switch ((token = yylex())) {
                     case DOT:
-                        ok = parse_ref(field, sv);
+                        ok = parse_ref(f, field, sv);
                         break;
                     default:
                         invalid_token(token, UNKNOWN);
@@ -159,9 +161,6 @@ static int parse_data(struct SNDCFile* f,
         invalid_token(token, SEMICOLON);
         ok = 0;
     }
-    if (!ok) {
-        free(sv);
-    }
     return ok;
 }
 
@@ -178,9 +177,9 @@ static int parse_field(struct SNDCFile* f,
         }
         invalid_token(token, IDENT);
         *err = ERR_TOKEN;
-    } else if (!(field = new_field(n))) {
+    } else if (!(field = new_field(f))) {
         *err = ERR_OTHER;
-    } else if (!(field->name = str_cpy(strVal))) {
+    } else if (!(field->name = intern(f, strVal))) {
         *err = ERR_OTHER;
     } else if ((token = yylex()) != COLON) {
         invalid_token(token, COLON);
@@ -188,8 +187,10 @@ static int parse_field(struct SNDCFile* f,
     } else if (!parse_data(f, n, field)) {
         *err = ERR_OTHER;
     }
-    if (*err != ERR_NO && field) {
-        n->numFields--;
+    if (*err == ERR_NO) {
+        n->numFields++;
+    } else if (field) {
+        f->numFields--;
     }
     return *err == ERR_NO;
 }
@@ -199,11 +200,11 @@ static int parse_node(struct SNDCFile* f, int* err) {
     struct Entry* node;
     int token;
 
-    if (get_node(f, strVal) >= 0) {
+    if (symtab_get(&f->entryIndex, strVal) >= 0) {
         fprintf(stderr, "Error: line %d: redefinition of node %s\n",
                         yylineno, strVal);
         *err = ERR_OTHER;
-    } else if (!(name = str_cpy(strVal))) {
+    } else if (!(name = intern(f, strVal))) {
         *err = ERR_OTHER;
     } else if ((token = yylex()) != COLON) {
         invalid_token(token, COLON);
@@ -211,13 +212,16 @@ static int parse_node(struct SNDCFile* f, int* err) {
     } else if ((token = yylex()) != IDENT) {
         invalid_token(token, IDENT);
         *err = ERR_TOKEN;
-    } else if (!(type = str_cpy(strVal))) {
+    } else if (!(type = intern(f, strVal))) {
         *err = ERR_OTHER;
     } else if ((token = yylex()) != OBRACE) {
         invalid_token(token, OBRACE);
         *err = ERR_TOKEN;
     } else if (!(node = new_entry(f))) {
         *err = ERR_OTHER;
+    } else if (!symtab_set(&f->entryIndex, name, f->numEntries - 1)) {
+        f->numEntries--;
+        *err = ERR_OTHER;
     } else {
         node->name = name;
         node->type = type;
@@ -230,8 +234,6 @@ static int parse_node(struct SNDCFile* f, int* err) {
                 break;
         }
     }
-    free(name);
-    free(type);
     return 0;
 }
 
@@ -292,10 +294,13 @@ static char* find_import(struct SNDCFile* f) {
 static int parse_import(struct SNDCFile* f, int* err) {
     int token;
     struct Import* imp = NULL;
+    char* fileName = NULL;
 
     if (!(imp = new_import(f))) {
-        fprintf(stderr, "Error: can't add import, too many imports?\n");
-    } else if (!(imp->fileName = find_import(f))) {
+        fprintf(stderr, "Error: can't add import\n");
+        *err = ERR_OTHER;
+    } else if (!(fileName = find_import(f))
+            || !(imp->fileName = intern(f, fileName))) {
         *err = ERR_OTHER;
     } else if ((token = yylex()) != AS) {
         invalid_token(token, AS);
@@ -303,14 +308,16 @@ static int parse_import(struct SNDCFile* f, int* err) {
     } else if ((token = yylex()) != IDENT) {
         invalid_token(token, IDENT);
         *err = ERR_TOKEN;
-    } else if (!(imp->importName = str_cpy(strVal))) {
+    } else if (!(imp->importName = intern(f, strVal))) {
         *err = ERR_OTHER;
     } else if ((token = yylex()) != SEMICOLON) {
         invalid_token(token, SEMICOLON);
         *err = ERR_TOKEN;
     } else {
+        free(fileName);
         return 1;
     }
+    free(fileName);
     return 0;
 }
 
@@ -319,14 +326,15 @@ static int parse_export(struct SNDCFile* f, int* err) {
     struct Export* e = NULL;
 
     if (!(e = new_export(f))) {
-        fprintf(stderr, "Error: can't add export field, too many exports?\n");
+        fprintf(stderr, "Error: can't add export field\n");
+        *err = ERR_OTHER;
     } else if ((token = yylex()) != INPUT && token != OUTPUT) {
         invalid_token(token, UNKNOWN);
         *err = ERR_TOKEN;
     } else if ((type = token, (token = yylex()) != IDENT)) {
         invalid_token(token, IDENT);
         *err = ERR_TOKEN;
-    } else if (!(e->ref.name = str_cpy(strVal))) {
+    } else if (!(e->ref.name = intern(f, strVal))) {
         *err = ERR_OTHER;
     } else if ((token = yylex()) != DOT) {
         invalid_token(token, DOT);
@@ -334,7 +342,7 @@ static int parse_export(struct SNDCFile* f, int* err) {
     } else if ((token = yylex()) != IDENT) {
         invalid_token(token, IDENT);
         *err = ERR_TOKEN;
-    } else if (!(e->ref.field = str_cpy(strVal))) {
+    } else if (!(e->ref.field = intern(f, strVal))) {
         *err = ERR_OTHER;
     } else if ((token = yylex()) != AS) {
         invalid_token(token, AS);
@@ -342,7 +350,7 @@ static int parse_export(struct SNDCFile* f, int* err) {
     } else if ((token = yylex()) != IDENT) {
         invalid_token(token, IDENT);
         *err = ERR_TOKEN;
-    } else if (!(e->symbol = str_cpy(strVal))) {
+    } else if (!(e->symbol = intern(f, strVal))) {
         *err = ERR_OTHER;
     } else if ((token = yylex()) != SEMICOLON) {
         invalid_token(token, SEMICOLON);
@@ -352,19 +360,33 @@ static int parse_export(struct SNDCFile* f, int* err) {
         return 1;
     }
     if (e) {
-        free(e->symbol);
-        free(e->ref.name);
-        free(e->ref.field);
         f->numExport--;
     }
     return 0;
 }
 
-int parse_sndc(struct SNDCFile* file, const char* name) {
+/* fields are appended to a single array while parsing, which may move it: only
+ * point entries to their fields once the whole file is read
+ */
+static void link_fields(struct SNDCFile* file) {
+    unsigned int i, offset = 0;
+
+    for (i = 0; i < file->numEntries; i++) {
+        file->entries[i].fields = file->fields + offset;
+        offset += file->entries[i].numFields;
+    }
+}
+
+/* the lexer state is global, only one file is parsed at a time */
+static pthread_mutex_t parseLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int parse_file(struct SNDCFile* file, const char* name) {
     int err, token, ok = 1;
     FILE* in;
 
     memset(file, 0, sizeof(*file));
+    strpool_init(&file->strings);
+    symtab_init(&file->entryIndex);
     if (!(in = fopen(name, "r"))) {
         fprintf(stderr, "Error: can't open file: %s\n", name);
     } else if (!(file->path = str_cpy(name))) {
@@ -408,6 +430,7 @@ int parse_sndc(struct SNDCFile* file, const char* name) {
             case ERR_NO:
             case ERR_EOF:
                 fclose(in);
+                link_fields(file);
                 return 1;
             default:
                 fprintf(stderr,
@@ -422,47 +445,24 @@ int parse_sndc(struct SNDCFile* file, const char* name) {
     return 0;
 }
 
-static void free_entry(struct Entry* entry) {
-    unsigned int i;
-
-    if (entry) {
-        free(entry->name);
-        free(entry->type);
-        for (i = 0; i < entry->numFields; i++) {
-            struct Field* f = &entry->fields[i];
+int parse_sndc(struct SNDCFile* file, const char* name) {
+    int ok;
 
-            free(f->name);
-            switch (f->type) {
-                case FIELD_STRING:
-                    free(f->data.str);
-                    break;
-                case FIELD_REF:
-                    free(f->data.ref.name);
-                    free(f->data.ref.field);
-                    break;
-                default:
-                    break;
-            }
-        }
-    }
+    pthread_mutex_lock(&parseLock);
+    ok = parse_file(file, name);
+    pthread_mutex_unlock(&parseLock);
+    return ok;
 }
 
 void free_sndc(struct SNDCFile* file) {
-    unsigned int i;
-
-    for (i = 0; i < file->numImport; i++) {
-        free(file->imports[i].fileName);
-        free(file->imports[i].importName);
-    }
-
-    for (i = 0; i < file->numExport; i++) {
-        free(file->exports[i].symbol);
-        free(file->exports[i].ref.name);
-        free(file->exports[i].ref.field);
-    }
-
-    for (i = 0; i < file->numEntries; i++) {
-        free_entry(file->entries + i);
-    }
+    free(file->imports);
+    free(file->exports);
+    free(file->entries);
+    free(file->fields);
+    strpool_free(&file->strings);
+    symtab_free(&file->entryIndex);
     free(file->path);
+    if (file->binary) {
+        sndcb_release(file->binary);
+    }
 }
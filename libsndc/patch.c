@@ -0,0 +1,435 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sndc.h"
+
+/* Render handle
+ *
+ * A patch is loaded once, then rendered as many times as needed. Between
+ * renders, var nodes and exported inputs can be overridden, and only the
+ * overridden nodes and the nodes downstream of them are processed again.
+ * Nodes are stored in load order, which is a valid processing order, so the
+ * dirty flags are propagated in a single pass over the nodes.
+ *
+ * A variant of a patch holds copies of the nodes downstream of some of its
+ * inputs, and shares the outputs of all the other nodes with its base patch,
+ * which are rendered once. Variants can be rendered concurrently, and must
+ * be freed before their base.
+ */
+
+/* input replaced by a value set through the API, owned by the stack */
+struct Override {
+    struct Node* node;
+    unsigned int index, slot;
+    struct Data* data;
+};
+
+struct Patch {
+    struct SNDCFile file;   /* unused in variants */
+    struct Stack stack;
+    struct Patch* base;
+
+    /* index of the node producing each input, -1 for literals and overrides */
+    int (*producer)[MAX_INPUTS];
+    char* dirty;
+
+    struct Override* overrides;
+    unsigned int numOverrides, capOverrides;
+};
+
+struct Producer {
+    const struct Data* data;
+    unsigned int node;
+};
+
+static int producer_comp(const void* a, const void* b) {
+    const struct Producer *p1 = a, *p2 = b;
+
+    if (p1->data < p2->data) return -1;
+    if (p1->data > p2->data) return 1;
+    return 0;
+}
+
+/* maps every input to the node whose output it is */
+static int find_producers(struct Patch* p) {
+    struct Stack* s = &p->stack;
+    struct Producer *outputs, key, *found;
+    unsigned int numOutputs = 0, i, j;
+
+    if (!(outputs = malloc(s->numNodes * MAX_OUTPUTS * sizeof(*outputs) + 1))
+            || !(p->producer = malloc(s->numNodes * sizeof(*p->producer) + 1))
+            || !(p->dirty = malloc(s->numNodes + 1))) {
+        free(outputs);
+        return 0;
+    }
+    for (i = 0; i < s->numNodes; i++) {
+        for (j = 0; j < MAX_OUTPUTS; j++) {
+            if (s->nodes[i]->outputs[j]) {
+                outputs[numOutputs].data = s->nodes[i]->outputs[j];
+                outputs[numOutputs++].node = i;
+            }
+        }
+    }
+    qsort(outputs, numOutputs, sizeof(*outputs), producer_comp);
+    for (i = 0; i < s->numNodes; i++) {
+        for (j = 0; j < MAX_INPUTS; j++) {
+            p->producer[i][j] = -1;
+            if ((key.data = s->nodes[i]->inputs[j])
+                    && (found = bsearch(&key, outputs, numOutputs,
+                                        sizeof(*outputs), producer_comp))) {
+                p->producer[i][j] = found->node;
+            }
+        }
+        p->dirty[i] = 1;
+    }
+    free(outputs);
+    return 1;
+}
+
+struct Patch* patch_load(const char* filename) {
+    struct Patch* p;
+    unsigned int i;
+
+    if (!(p = calloc(1, sizeof(*p)))) {
+        fprintf(stderr, "Error: patch_load: can't allocate patch\n");
+        return NULL;
+    }
+    stack_init(&p->stack);
+    if (!sndc_load(&p->file, filename)) {
+        fprintf(stderr, "Error: %s: parsing failed\n", filename);
+        free(p);
+        return NULL;
+    } else if (!stack_load(&p->stack, &p->file)) {
+        fprintf(stderr, "Error: %s: loading stack failed\n", filename);
+        free_sndc(&p->file);
+        free(p);
+        return NULL;
+    } else if (!find_producers(p)) {
+        fprintf(stderr, "Error: %s: can't allocate patch\n", filename);
+        patch_free(p);
+        return NULL;
+    }
+    /* nodes rendered again, and variants, read the outputs of the others */
+    for (i = 0; i < p->stack.numNodes; i++) {
+        p->stack.nodes[i]->inplace = 0;
+    }
+    return p;
+}
+
+void patch_free(struct Patch* p) {
+    if (p) {
+        stack_free(&p->stack);
+        if (!p->base) free_sndc(&p->file);
+        free(p->producer);
+        free(p->dirty);
+        free(p->overrides);
+        free(p);
+    }
+}
+
+/* finds the input a name refers to: an exported input, or the value of a
+ * var node
+ */
+static int find_input(struct Patch* p,
+                      const char* name,
+                      struct Node** node,
+                      int* slot) {
+    const struct SNDCFile* file = p->base ? &p->base->file : &p->file;
+    unsigned int i;
+
+    for (i = 0; i < file->numExport; i++) {
+        const struct Export* e = file->exports + i;
+
+        if (e->type == EXP_INPUT && !strcmp(e->symbol, name)) {
+            if (!(*node = stack_get_node(&p->stack, e->ref.name))
+                    || (*slot = module_get_input_slot((*node)->module,
+                                                      e->ref.field)) < 0) {
+                fprintf(stderr, "Error: patch: bad export %s\n", name);
+                return 0;
+            }
+            return 1;
+        }
+    }
+    if ((*node = stack_get_node(&p->stack, name))
+            && (*node)->module == module_find("var")) {
+        *slot = module_get_input_slot((*node)->module, "value");
+        return 1;
+    }
+    fprintf(stderr, "Error: patch: no exported input nor var named %s\n",
+            name);
+    return 0;
+}
+
+/* returns the override of the input, creating it on first use, with its
+ * previous value freed
+ */
+static struct Override* get_override(struct Patch* p,
+                                     const char* name,
+                                     int type) {
+    struct Node* node;
+    struct Override* o;
+    int slot;
+    unsigned int i;
+
+    if (!find_input(p, name, &node, &slot)) {
+        return NULL;
+    } else if (!(node->module->inputs[slot].type & type)) {
+        fprintf(stderr, "Error: patch: %s: wrong type\n", name);
+        return NULL;
+    }
+    for (i = 0; i < p->numOverrides; i++) {
+        if (p->overrides[i].node == node && p->overrides[i].slot == slot) {
+            data_free(p->overrides[i].data);
+            return p->overrides + i;
+        }
+    }
+    if (p->numOverrides >= p->capOverrides) {
+        unsigned int cap = p->capOverrides ? 2 * p->capOverrides : 8;
+        void* tmp;
+
+        if (!(tmp = realloc(p->overrides, cap * sizeof(*p->overrides)))) {
+            fprintf(stderr, "Error: patch: can't allocate override\n");
+            return NULL;
+        }
+        p->overrides = tmp;
+        p->capOverrides = cap;
+    }
+    o = p->overrides + p->numOverrides;
+    if (!(o->data = stack_data_new(&p->stack))) {
+        fprintf(stderr, "Error: patch: can't allocate override\n");
+        return NULL;
+    }
+    p->numOverrides++;
+    o->node = node;
+    o->slot = slot;
+    o->index = symtab_get(&p->stack.nodeIndex, node->name);
+    node->inputs[slot] = o->data;
+    /* the input isn't statically known anymore */
+    node->isValid = 0;
+    p->producer[o->index][slot] = -1;
+    return o;
+}
+
+int patch_set_float(struct Patch* p, const char* name, float value) {
+    struct Override* o;
+
+    if (!(o = get_override(p, name, DATA_FLOAT))) {
+        return 0;
+    }
+    o->data->type = DATA_FLOAT;
+    o->data->content.f = value;
+    p->dirty[o->index] = 1;
+    return 1;
+}
+
+int patch_set_string(struct Patch* p, const char* name, const char* value) {
+    struct Override* o;
+
+    if (!(o = get_override(p, name, DATA_STRING))) {
+        return 0;
+    }
+    p->dirty[o->index] = 1;
+    if (!(o->data->content.str = str_cpy(value))) {
+        o->data->type = DATA_UNKNOWN;
+        fprintf(stderr, "Error: patch: can't copy %s\n", name);
+        return 0;
+    }
+    o->data->type = DATA_STRING;
+    return data_parse_enum(o->data,
+                           o->node->module->inputs + o->slot,
+                           o->node->name);
+}
+
+static void propagate_dirty(struct Patch* p) {
+    unsigned int i, j;
+
+    for (i = 0; i < p->stack.numNodes; i++) {
+        for (j = 0; j < MAX_INPUTS && !p->dirty[i]; j++) {
+            if (p->producer[i][j] >= 0 && p->dirty[p->producer[i][j]]) {
+                p->dirty[i] = 1;
+            }
+        }
+    }
+}
+
+static int render_node(struct Patch* p, unsigned int i) {
+    struct Node* n = p->stack.nodes[i];
+
+    node_flush_output(n);
+    if (!stack_process_node(&p->stack, n)) {
+        fprintf(stderr, "Error: %s: processing failed\n", n->name);
+        return 0;
+    }
+    p->dirty[i] = 0;
+    return 1;
+}
+
+int patch_render(struct Patch* p) {
+    unsigned int i;
+
+    propagate_dirty(p);
+    for (i = 0; i < p->stack.numNodes; i++) {
+        if (p->dirty[i] && !render_node(p, i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* copies node i of the base into the variant, with its inputs coming from
+ * the copies of the nodes downstream, and the base's data otherwise
+ */
+static struct Node* clone_node(struct Patch* v,
+                               unsigned int i,
+                               struct Node** clones) {
+    const struct Patch* base = v->base;
+    struct Node *n = base->stack.nodes[i], *c;
+    unsigned int j, k;
+
+    if (       !(c = stack_node_new(&v->stack, n->name))
+            || !stack_node_set_module(&v->stack, c, n->module)) {
+        return NULL;
+    }
+    c->path = n->path;
+    for (j = 0; j < MAX_INPUTS; j++) {
+        int up = base->producer[i][j];
+
+        c->inputs[j] = n->inputs[j];
+        if (up >= 0 && clones[up]) {
+            for (k = 0; k < MAX_OUTPUTS; k++) {
+                if (base->stack.nodes[up]->outputs[k] == n->inputs[j]) {
+                    c->inputs[j] = clones[up]->outputs[k];
+                }
+            }
+        }
+    }
+    c->isValid = n->isValid;
+    c->control = n->control;
+    c->curve = n->curve;
+    c->from = n->from;
+    c->to = n->to;
+    if (!c->isSetup && c->setup && !c->setup(c)) {
+        return NULL;
+    }
+    return c;
+}
+
+struct Patch* patch_variant(struct Patch* base,
+                            const char** names,
+                            unsigned int numNames) {
+    struct Stack* bs = &base->stack;
+    struct Patch* v = NULL;
+    struct Node** clones = NULL;
+    char* down = NULL;
+    unsigned int i, j;
+    int ok = 0;
+
+    if (base->base) {
+        fprintf(stderr, "Error: patch: can't make a variant of a variant\n");
+        return NULL;
+    } else if (       !(down = calloc(bs->numNodes + 1, 1))
+                   || !(clones = calloc(bs->numNodes + 1, sizeof(*clones)))
+                   || !(v = calloc(1, sizeof(*v)))) {
+        fprintf(stderr, "Error: patch: can't allocate variant\n");
+        goto exit;
+    }
+    stack_init(&v->stack);
+    v->base = base;
+
+    for (i = 0; i < numNames; i++) {
+        struct Node* n;
+        int slot;
+
+        if (!find_input(base, names[i], &n, &slot)) goto exit;
+        down[symtab_get(&bs->nodeIndex, n->name)] = 1;
+    }
+    for (i = 0; i < bs->numNodes; i++) {
+        for (j = 0; j < MAX_INPUTS && !down[i]; j++) {
+            if (base->producer[i][j] >= 0 && down[base->producer[i][j]]) {
+                down[i] = 1;
+            }
+        }
+    }
+
+    /* everything upstream is rendered once, by the base */
+    propagate_dirty(base);
+    for (i = 0; i < bs->numNodes; i++) {
+        if (!down[i] && base->dirty[i] && !render_node(base, i)) goto exit;
+    }
+
+    if (!(v->stack.path = str_cpy(bs->path))) {
+        fprintf(stderr, "Error: patch: can't allocate variant\n");
+        goto exit;
+    }
+    for (i = 0; i < bs->numNodes; i++) {
+        if (down[i] && !(clones[i] = clone_node(v, i, clones))) {
+            fprintf(stderr, "Error: patch: can't copy node %s\n",
+                    bs->nodes[i]->name);
+            goto exit;
+        }
+    }
+    if (!find_producers(v)) {
+        fprintf(stderr, "Error: patch: can't allocate variant\n");
+        goto exit;
+    }
+    ok = 1;
+
+exit:
+    free(down);
+    free(clones);
+    if (!ok && v) {
+        patch_free(v);
+        v = NULL;
+    }
+    return v;
+}
+
+/* the output a name refers to: an exported output, or the first output of a
+ * node, or the first output of the last node if name is NULL. Variants
+ * return the base's output for nodes they don't copy.
+ */
+const struct Buffer* patch_output(struct Patch* p, const char* name) {
+    const struct Patch* base = p->base ? p->base : p;
+    const char *nodeName = name, *field = NULL;
+    struct Node* node = NULL;
+    struct Data* d = NULL;
+    unsigned int i;
+    int slot = 0;
+
+    if (!name) {
+        if (base->stack.numNodes) {
+            nodeName = base->stack.nodes[base->stack.numNodes - 1]->name;
+        }
+    } else {
+        for (i = 0; i < base->file.numExport; i++) {
+            const struct Export* e = base->file.exports + i;
+
+            if (e->type == EXP_OUTPUT && !strcmp(e->symbol, name)) {
+                nodeName = e->ref.name;
+                field = e->ref.field;
+                break;
+            }
+        }
+    }
+    if (nodeName) {
+        if (!(node = stack_get_node(&p->stack, nodeName)) && p->base) {
+            node = stack_get_node(&p->base->stack, nodeName);
+        }
+    }
+    if (node && field) {
+        slot = module_get_output_slot(node->module, field);
+    }
+    if (node && slot >= 0) {
+        d = node->outputs[slot];
+    }
+    if (!d || d->type != DATA_BUFFER) {
+        fprintf(stderr, "Error: patch: no buffer output %s\n",
+                name ? name : "");
+        return NULL;
+    }
+    /* read by other nodes of the stack, unpacked for good */
+    if (d->packed.data && !data_unpack(d, d)) {
+        return NULL;
+    }
+    return &d->content.buf;
+}
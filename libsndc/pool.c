@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sndc.h"
+
+/* Fixed size pool of worker threads running jobs in submission order */
+
+struct Job {
+    void (*run)(void* arg);
+    void* arg;
+    struct Job* next;
+};
+
+struct Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t hasJob, idle;
+    struct Job *first, *last;
+    unsigned int numThreads, numStarted, numRunning;
+    char quit;
+    pthread_t* threads;
+};
+
+static void* worker_run(void* arg) {
+    struct Pool* pool = arg;
+    struct Job* job;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->first && !pool->quit) {
+            pthread_cond_wait(&pool->hasJob, &pool->lock);
+        }
+        if (!(job = pool->first)) break;
+        if (!(pool->first = job->next)) pool->last = NULL;
+        pool->numRunning++;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->run(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&pool->lock);
+        if (!--pool->numRunning && !pool->first) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+unsigned int pool_default_size(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? n : 1;
+}
+
+struct Pool* pool_new(unsigned int numThreads) {
+    struct Pool* pool;
+
+    if (!numThreads) numThreads = pool_default_size();
+    if (!(pool = calloc(1, sizeof(*pool)))
+            || !(pool->threads = malloc(numThreads * sizeof(pthread_t)))) {
+        fprintf(stderr, "Error: pool_new: can't allocate pool\n");
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->hasJob, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pool->numThreads = numThreads;
+    for (; pool->numStarted < numThreads; pool->numStarted++) {
+        if (pthread_create(pool->threads + pool->numStarted, NULL,
+                           worker_run, pool)) {
+            fprintf(stderr, "Error: pool_new: can't start worker thread\n");
+            break;
+        }
+    }
+    if (!pool->numStarted) {
+        pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int pool_submit(struct Pool* pool, void (*run)(void*), void* arg) {
+    struct Job* job;
+
+    if (!(job = malloc(sizeof(*job)))) {
+        fprintf(stderr, "Error: pool_submit: can't allocate job\n");
+        return 0;
+    }
+    job->run = run;
+    job->arg = arg;
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->last) {
+        pool->last->next = job;
+    } else {
+        pool->first = job;
+    }
+    pool->last = job;
+    pthread_cond_signal(&pool->hasJob);
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+void pool_wait(struct Pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->first || pool->numRunning) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(struct Pool* pool) {
+    unsigned int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->hasJob);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->numStarted; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->hasJob);
+    pthread_cond_destroy(&pool->idle);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
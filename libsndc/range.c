@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "sndc.h"
+
+/* Time ranges
+ *
+ * To listen to a few seconds of a long file, only the samples of the result
+ * in stack->range are needed. Each node is given the range of its outputs
+ * its readers need, nodes being planned from the last, so that the readers
+ * of a node are planned before it. The nodes of MOD_RANGED modules render
+ * only their range, the samples outside it being zero.
+ *
+ * A DESC_TIMED input is read at the time of the sample rendered, so a node
+ * needs it over its own range, widened a little for the resamplers reading
+ * around each sample. MOD_LOOKBACK nodes also need the RANGE_LOOKBACK
+ * seconds before their range, for their feedback to settle: longer tails are
+ * cut. Other inputs, read by normalized position or as a whole, are needed
+ * entirely, as are the inputs of nodes that don't render ranges and of nodes
+ * at the control rate. Exported outputs are needed entirely.
+ */
+
+/* seconds */
+#define RANGE_MARGIN    0.05
+#define RANGE_LOOKBACK  10.
+
+static int ranged(const struct Node* n) {
+    return (n->module->flags & MOD_RANGED) && !n->control;
+}
+
+static void need(float* range, float from, float to) {
+    if (from < 0) from = 0;
+    if (from < range[0]) range[0] = from;
+    if (to > range[1]) range[1] = to;
+}
+
+int stack_plan_range(struct Stack* stack, const struct SNDCFile* file) {
+    float (*ranges)[2];
+    unsigned int i, j;
+
+    if (stack->range[1] <= 0 || !stack->numNodes) {
+        return 1;
+    }
+    if (!(ranges = malloc(stack->numNodes * sizeof(*ranges)))) {
+        fprintf(stderr, "Error: can't allocate range plan\n");
+        return 0;
+    }
+    /* nothing needed yet */
+    for (i = 0; i < stack->numNodes; i++) {
+        ranges[i][0] = FLT_MAX;
+        ranges[i][1] = 0;
+    }
+    for (i = 0; i < file->numExport; i++) {
+        const struct Export* e = file->exports + i;
+        int r;
+
+        if (       e->type == EXP_OUTPUT
+                && (r = symtab_get(&stack->nodeIndex, e->ref.name)) >= 0) {
+            need(ranges[r], 0, FLT_MAX);
+        }
+    }
+    /* draft results are upsampled */
+    need(ranges[stack->numNodes - 1], stack->range[0] - RANGE_MARGIN,
+         stack->range[1] + RANGE_MARGIN);
+
+    /* nodes are created in the order of the file's entries */
+    for (i = stack->numNodes; i--;) {
+        struct Node* n = stack->nodes[i];
+        const struct Module* mod = n->module;
+
+        if (ranged(n)) {
+            n->from = ranges[i][0];
+            n->to = ranges[i][1];
+        }
+        if (i >= file->numEntries) continue;
+        for (j = 0; j < file->entries[i].numFields; j++) {
+            const struct Field* f = file->entries[i].fields + j;
+            int r, in;
+
+            if (       f->type != FIELD_REF
+                    || (r = symtab_get(&stack->nodeIndex,
+                                       f->data.ref.name)) < 0
+                    || (in = module_get_input_slot(mod, f->name)) < 0) {
+                continue;
+            }
+            if (!ranged(n)) {
+                need(ranges[r], 0, FLT_MAX);
+            } else if (n->from > n->to) {
+                continue;
+            } else if (!(mod->inputs[in].flags & DESC_TIMED)) {
+                need(ranges[r], 0, FLT_MAX);
+            } else if (mod->flags & MOD_LOOKBACK) {
+                need(ranges[r], n->from - RANGE_LOOKBACK - RANGE_MARGIN,
+                     n->to + RANGE_MARGIN);
+            } else {
+                need(ranges[r], n->from - RANGE_MARGIN, n->to + RANGE_MARGIN);
+            }
+        }
+    }
+    free(ranges);
+    return 1;
+}
+
+void node_range(const struct Node* n, float rate, unsigned int size,
+                unsigned int* lo, unsigned int* hi) {
+    double from = floor((double) n->from * rate);
+    double to = ceil((double) n->to * rate);
+
+    *lo = from <= 0 ? 0 : from < size ? from : size;
+    *hi = to >= size ? size : to > *lo ? to : *lo;
+}
+
+int node_slice_run(const struct Node* n, const struct Buffer* out,
+                   unsigned int warmup,
+                   int (*run)(void* ctx, unsigned int warm,
+                              unsigned int start, unsigned int end),
+                   void* ctx) {
+    unsigned int lo, hi, lookback;
+
+    node_range(n, out->samplingRate, out->size, &lo, &hi);
+    if (!lo && hi == out->size) {
+        return slice_run(out->size, warmup, run, ctx);
+    }
+    lookback = RANGE_LOOKBACK * out->samplingRate;
+    if (warmup > lookback) warmup = lookback;
+    if (lo < hi && !slice_run_range(lo, hi, warmup, run, ctx)) {
+        return 0;
+    }
+    /* after rendering, warm-ups can read the input an output is written over */
+    memset(out->data, 0, lo * sizeof(float));
+    memset(out->data + hi, 0, (out->size - hi) * sizeof(float));
+    return 1;
+}
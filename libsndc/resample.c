@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sndc.h"
+
+/* Polyphase resampling
+ *
+ * Converting from rate M to rate L, both divided by their GCD, output sample
+ * k falls at input position k * M / L, between two input samples and at
+ * phase (k * M) mod L. Each phase has its own set of taps of a Kaiser
+ * windowed sinc low pass, cutting below the lower of the two Nyquist
+ * frequencies, which the fir kernel applies to the input samples around the
+ * position. Ratios with more than MAX_PHASES phases use the closest of
+ * MAX_PHASES + 1 evenly spaced phases.
+ */
+
+#define MAX_PHASES  4096
+#define RES_PI      3.14159265358979
+/* outputs computed per fir call */
+#define RES_BLOCK   256
+
+static const struct Quality {
+    unsigned int half;  /* taps on each side at ratio >= 1 */
+    double beta;        /* of the Kaiser window */
+    double rolloff;     /* cutoff relative to the Nyquist frequency */
+} qualities[] = {
+    {8, 5., .85},   /* RESAMPLE_FAST */
+    {32, 8., .92}   /* RESAMPLE_BEST */
+};
+
+/* modified Bessel function of the first kind, order 0 */
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    unsigned int k;
+
+    for (k = 1; k < 50 && term > 1e-12 * sum; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b) {
+    while (b) {
+        unsigned int t = a % b;
+
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* numPhases + 1 phases of taps, each summing to 1 */
+static float* make_bank(const struct Quality* q,
+                        double scale,
+                        unsigned int taps,
+                        unsigned int numPhases) {
+    float* bank;
+    double i0beta = bessel_i0(q->beta), cutoff = scale * q->rolloff;
+    unsigned int half = taps / 2, p, t;
+
+    if (!(bank = malloc((numPhases + 1) * taps * sizeof(float)))) {
+        return NULL;
+    }
+    for (p = 0; p <= numPhases; p++) {
+        float* h = bank + p * taps;
+        double sum = 0;
+
+        for (t = 0; t < taps; t++) {
+            double d = (double) t - (half - 1) - (double) p / numPhases;
+            double x = d / half, w, s;
+
+            w = x > -1 && x < 1 ? bessel_i0(q->beta * sqrt(1 - x * x))
+                                  / i0beta : 0;
+            s = d ? sin(RES_PI * cutoff * d) / (RES_PI * d) : cutoff;
+            sum += h[t] = s * w;
+        }
+        for (t = 0; t < taps; t++) {
+            h[t] /= sum;
+        }
+    }
+    return bank;
+}
+
+struct Resampler {
+    const float* in;    /* padded with half - 1 zeros before, half after */
+    float* out;
+    const float* bank;
+    unsigned int taps;
+    unsigned int l, m, numPhases;
+};
+
+static int resample_slice(void* ctx, unsigned int warm,
+                          unsigned int start, unsigned int end) {
+    const struct Resampler* r = ctx;
+    const struct Kernels* k = kernels_get();
+    uint32_t offsets[RES_BLOCK], phases[RES_BLOCK];
+    unsigned long pos, phase;
+    unsigned int i, j;
+
+    /* position of the first output of the slice, then stepped exactly */
+    pos = (double) start * r->m / r->l;
+    phase = (unsigned long) fmod((double) start * r->m, r->l);
+    for (i = start; i < end; i += RES_BLOCK) {
+        unsigned int n = end - i < RES_BLOCK ? end - i : RES_BLOCK;
+
+        for (j = 0; j < n; j++) {
+            offsets[j] = pos;
+            phases[j] = r->numPhases == r->l
+                      ? phase
+                      : (phase * r->numPhases + r->l / 2) / r->l;
+            pos += r->m / r->l;
+            phase += r->m % r->l;
+            if (phase >= r->l) {
+                phase -= r->l;
+                pos++;
+            }
+        }
+        k->fir(r->out + i, r->in, r->bank, r->taps, offsets, phases, n);
+    }
+    return 1;
+}
+
+int resample_buffer(struct Buffer* dest,
+                    const struct Buffer* src,
+                    unsigned int rate,
+                    enum ResampleQuality quality) {
+    const struct Quality* q = qualities + quality;
+    struct Resampler r;
+    float *in = NULL, *bank = NULL;
+    double scale;
+    unsigned int g, half, size, inSize;
+    int ok = 0;
+
+    if (!rate || !src->samplingRate) {
+        fprintf(stderr, "Error: resample: invalid sampling rate\n");
+        return 0;
+    }
+    g = gcd(rate, src->samplingRate);
+    r.l = rate / g;
+    r.m = src->samplingRate / g;
+    r.numPhases = r.l < MAX_PHASES ? r.l : MAX_PHASES;
+    /* downsampling cuts lower, over as many periods of the cutoff */
+    scale = rate < src->samplingRate ? (double) r.l / r.m : 1;
+    half = ceil(q->half / scale / (KERNEL_LANES / 2)) * (KERNEL_LANES / 2);
+    r.taps = 2 * half;
+
+    dest->data = NULL;
+    if (       !buffer_size("resample", ceil((double) src->size * r.l / r.m),
+                            &size)
+            || !buffer_size("resample", (double) src->size + 2 * half,
+                            &inSize)) {
+        return 0;
+    }
+    dest->samplingRate = rate;
+    dest->interp = src->interp;
+    dest->size = size;
+    if (       !(in = calloc(inSize, sizeof(float)))
+            || !(bank = make_bank(q, scale, r.taps, r.numPhases))
+            || !(dest->data = buffer_alloc(size))) {
+        fprintf(stderr, "Error: resample: can't allocate buffers\n");
+    } else {
+        memcpy(in + half - 1, src->data, src->size * sizeof(float));
+        r.in = in;
+        r.out = dest->data;
+        r.bank = bank;
+        ok = slice_run(size, 0, resample_slice, &r);
+    }
+    free(in);
+    free(bank);
+    if (!ok) {
+        buffer_free(dest->data);
+        dest->data = NULL;
+    }
+    return ok;
+}
+
+/* buffer inputs flagged DESC_SAME_RATE are resampled to the highest rate
+ * among them
+ */
+int node_match_rates(struct Node* node, struct Data* resampled) {
+    const struct Module* mod = node->module;
+    unsigned int i, rate = 0;
+
+    for (i = 0; i < MAX_INPUTS; i++) {
+        const struct Data* d = node->inputs[i];
+
+        if (       d && d->type == DATA_BUFFER
+                && (mod->inputs[i].flags & DESC_SAME_RATE)
+                && d->content.buf.samplingRate > rate) {
+            rate = d->content.buf.samplingRate;
+        }
+    }
+    for (i = 0; i < MAX_INPUTS; i++) {
+        struct Data* d = node->inputs[i];
+        struct Buffer buf;
+
+        if (       !d || d->type != DATA_BUFFER
+                || !(mod->inputs[i].flags & DESC_SAME_RATE)
+                || d->content.buf.samplingRate == rate) {
+            continue;
+        } else if (!resample_buffer(&buf, &d->content.buf, rate,
+                                    RESAMPLE_BEST)) {
+            fprintf(stderr, "Error: %s: can't resample %s\n",
+                    node->name, mod->inputs[i].name);
+            return 0;
+        }
+        buffer_map_silence(buf.data, buf.size);
+        if (d == resampled + i) {
+            buffer_free(d->content.buf.data);
+        } else {
+            resampled[i] = *d;
+            resampled[i].storage = STORE_F32;
+            resampled[i].packed.data = NULL;
+            node->inputs[i] = resampled + i;
+        }
+        resampled[i].content.buf = buf;
+    }
+    return 1;
+}
@@ -0,0 +1,104 @@
+#include "sndc.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#define CSR_FLUSH   0x8040  /* FTZ | DAZ */
+#define CSR_GET()   _mm_getcsr()
+#define CSR_SET(v)  _mm_setcsr(v)
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define CSR_FLUSH   (1UL << 24)  /* FPCR.FZ */
+static unsigned long get_fpcr(void) {
+    unsigned long v;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(v));
+    return v;
+}
+static void set_fpcr(unsigned long v) {
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(v));
+}
+#define CSR_GET()   get_fpcr()
+#define CSR_SET(v)  set_fpcr(v)
+#endif
+
+struct Settings settings = {
+    1,      /* sliceThreads */
+    0,      /* keepDenormals */
+    0,      /* memLimit */
+    STORE_F32,  /* storage */
+    NULL,   /* storageRules */
+    0,      /* numStorageRules */
+    0,      /* draft */
+    0       /* controlRatio */
+};
+
+/* Subnormal floats, reached by decaying feedback tails, are up to a hundred
+ * times slower to compute on x86. Render threads run with them flushed to
+ * zero, which can't be heard.
+ */
+unsigned long denormals_disable(void) {
+#ifdef CSR_FLUSH
+    unsigned long state = CSR_GET();
+
+    if (!settings.keepDenormals) CSR_SET(state | CSR_FLUSH);
+    return state;
+#else
+    return 0;
+#endif
+}
+
+void denormals_restore(unsigned long state) {
+#ifdef CSR_FLUSH
+    CSR_SET(state);
+#endif
+}
+
+/* Draft renders preview a file quickly: generators render at a fraction of
+ * their default sampling rates, which the rest of the graph follows, and the
+ * costliest effects switch to cheaper approximations. Rates given in the file
+ * are kept, as a low rate divided could leave a buffer without samples.
+ */
+float render_rate(float rate) {
+    return settings.draft > 1 ? rate / settings.draft : rate;
+}
+
+float node_rate(struct Node* node,
+                const struct Data* sampling,
+                float def,
+                int control) {
+    node->control = node->control && control;
+    if (sampling) {
+        return sampling->content.f;
+    } else if (node->control && settings.controlRatio > 1) {
+        /* whole rates, so that the buffers' rates are exact */
+        unsigned int rate = render_rate(def) / settings.controlRatio;
+
+        return rate ? rate : 1;
+    }
+    return render_rate(def);
+}
+
+int node_size(const struct Node* node, double duration, double rate,
+              unsigned int* size) {
+    double s = duration * rate;
+
+    if (!(s >= 0) || s > (unsigned int) -1) {
+        fprintf(stderr, "Error: %s: invalid duration, %g seconds at %gHz\n",
+                node->name, duration, rate);
+        return 0;
+    } else if (duration > 0 && s < 1) {
+        fprintf(stderr, "Error: %s: %g seconds at %gHz is less than "
+                        "a sample\n", node->name, duration, rate);
+        return 0;
+    }
+    *size = s;
+    return 1;
+}
+
+int buffer_size(const char* name, double n, unsigned int* size) {
+    if (!(n >= 0) || n > (unsigned int) -1) {
+        fprintf(stderr, "Error: %s: %.0f samples don't fit a buffer\n",
+                name, n);
+        return 0;
+    }
+    *size = n;
+    return 1;
+}
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "sndc.h"
+
+/* Time slicing
+ *
+ * A long signal is split in contiguous slices rendered concurrently by the
+ * slice pool, the calling thread rendering the first one. Modules with state
+ * reset it at the start of each slice, after a warm-up prefix long enough for
+ * the state to converge, the first slice needing none is always exact.
+ * A range of a signal is sliced the same, its first slice warming up too.
+ *
+ * The slice pool is separate from the batch pool so that batch jobs can slice
+ * their signals without waiting on each other.
+ */
+
+/* slices shorter than this aren't worth a thread */
+#define SLICE_MIN_SIZE      65536
+/* level at which a decaying feedback loop is considered settled, -80dB */
+#define SLICE_SETTLED       1e-4
+
+struct SliceGroup {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    unsigned int pending;
+    int ok;
+};
+
+struct Slice {
+    struct SliceGroup* group;
+    int (*run)(void*, unsigned int, unsigned int, unsigned int);
+    void* ctx;
+    unsigned int warm, start, end;
+};
+
+static struct Pool* slicePool = NULL;
+static pthread_once_t slicePoolOnce = PTHREAD_ONCE_INIT;
+
+static void free_slice_pool(void) {
+    pool_free(slicePool);
+}
+
+static void new_slice_pool(void) {
+    if ((slicePool = pool_new(settings.sliceThreads - 1))) {
+        atexit(free_slice_pool);
+    }
+}
+
+static void slice_job(void* arg) {
+    struct Slice* s = arg;
+    unsigned long fpState = denormals_disable();
+    int ok;
+
+    ok = s->run(s->ctx, s->warm, s->start, s->end);
+    denormals_restore(fpState);
+    pthread_mutex_lock(&s->group->lock);
+    s->group->ok = s->group->ok && ok;
+    if (!--s->group->pending) pthread_cond_signal(&s->group->done);
+    pthread_mutex_unlock(&s->group->lock);
+}
+
+unsigned int slice_warmup(float gain, unsigned int period) {
+    double len;
+
+    gain = fabs(gain);
+    if (gain >= 1.) return (unsigned int) -1;
+    if (gain <= 0.) return period;
+    len = ceil(log(SLICE_SETTLED) / log(gain)) * period;
+    return len < (unsigned int) -1 ? len : (unsigned int) -1;
+}
+
+int slice_run(unsigned int size, unsigned int warmup,
+              int (*run)(void* ctx, unsigned int warm,
+                         unsigned int start, unsigned int end),
+              void* ctx) {
+    return slice_run_range(0, size, warmup, run, ctx);
+}
+
+int slice_run_range(unsigned int start, unsigned int end,
+                    unsigned int warmup,
+                    int (*run)(void* ctx, unsigned int warm,
+                               unsigned int start, unsigned int end),
+                    void* ctx) {
+    struct SliceGroup group;
+    struct Slice* slices;
+    unsigned int size = end - start;
+    unsigned int numSlices = settings.sliceThreads, len, i;
+    int ok;
+
+    if (numSlices > size / SLICE_MIN_SIZE) numSlices = size / SLICE_MIN_SIZE;
+    /* past that, slices spend more time warming up than rendering */
+    if (numSlices > 1 && warmup >= size / numSlices) numSlices = 1;
+    if (numSlices > 1) pthread_once(&slicePoolOnce, new_slice_pool);
+    if (numSlices <= 1 || !slicePool
+            || !(slices = malloc(numSlices * sizeof(*slices)))) {
+        return run(ctx, start > warmup ? start - warmup : 0, start, end);
+    }
+
+    pthread_mutex_init(&group.lock, NULL);
+    pthread_cond_init(&group.done, NULL);
+    group.pending = 0;
+    group.ok = 1;
+    len = size / numSlices;
+    for (i = 0; i < numSlices; i++) {
+        slices[i].group = &group;
+        slices[i].run = run;
+        slices[i].ctx = ctx;
+        slices[i].start = start + i * len;
+        slices[i].end = i + 1 < numSlices ? start + (i + 1) * len : end;
+        slices[i].warm = slices[i].start > warmup
+                       ? slices[i].start - warmup : 0;
+    }
+    ok = 1;
+    for (i = 1; i < numSlices; i++) {
+        pthread_mutex_lock(&group.lock);
+        group.pending++;
+        pthread_mutex_unlock(&group.lock);
+        if (!pool_submit(slicePool, slice_job, slices + i)) {
+            pthread_mutex_lock(&group.lock);
+            group.pending--;
+            pthread_mutex_unlock(&group.lock);
+            ok = run(ctx, slices[i].warm, slices[i].start, slices[i].end)
+              && ok;
+        }
+    }
+    ok = run(ctx, slices[0].warm, slices[0].start, slices[0].end) && ok;
+
+    pthread_mutex_lock(&group.lock);
+    while (group.pending) pthread_cond_wait(&group.done, &group.lock);
+    ok = ok && group.ok;
+    pthread_mutex_unlock(&group.lock);
+    pthread_cond_destroy(&group.done);
+    pthread_mutex_destroy(&group.lock);
+    free(slices);
+    return ok;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdint.h>
 
 #ifndef SDNC_H
 #define SDNC_H
@@ -10,11 +11,6 @@
 #define MAX_PATH_LENGTH     128
 #define MAX_MOD_NAME_LEN    16
 
-#define MAX_ENTRIES 128
-#define MAX_FIELDS  128
-#define MAX_IMPORT  128
-#define MAX_EXPORT  128
-
 
 /*** SNDC_PATH management ***/
 
@@ -25,6 +21,35 @@ int path_init();
 /****************/
 
 
+/*** Symbol tables ***/
+
+/* open addressing hash table mapping strings to indices, keys are not owned */
+struct SymTab {
+    struct Symbol {
+        const char* key;
+        unsigned int value;
+    }* symbols;
+    unsigned int size, count;
+};
+
+void symtab_init(struct SymTab* table);
+void symtab_free(struct SymTab* table);
+int symtab_set(struct SymTab* table, const char* key, unsigned int value);
+int symtab_get(const struct SymTab* table, const char* key);
+
+/* interned strings, stored in large blocks and freed all at once */
+struct StrPool {
+    struct SymTab table;
+    struct StrBlock* blocks;
+};
+
+void strpool_init(struct StrPool* pool);
+void strpool_free(struct StrPool* pool);
+char* strpool_add(struct StrPool* pool, const char* s, unsigned int len);
+
+/****************/
+
+
 /*** Parser ***/
 
 struct Ref {
@@ -50,8 +75,10 @@ struct Field {
 struct Entry {
     char* name;
     char* type;
-    struct Field fields[MAX_FIELDS];
+    struct Field* fields;
     unsigned int numFields;
+    const char* path;   /* of the imported file the entry was spliced from,
+                         * NULL for the file's own entries, see flatten.c */
 };
 
 struct Export {
@@ -68,13 +95,23 @@ struct Import {
     char* importName;
 };
 
+/* All strings of a parsed file are interned in its string pool, fields of all
+ * entries are stored contiguously, entry i's fields following entry i-1's.
+ */
 struct SNDCFile {
-    struct Import imports[MAX_IMPORT];
-    struct Export exports[MAX_EXPORT];
-    struct Entry entries[MAX_ENTRIES];
-    unsigned int numEntries, numImport, numExport;
-
+    struct Import* imports;
+    struct Export* exports;
+    struct Entry* entries;
+    struct Field* fields;
+    unsigned int numEntries, numImport, numExport, numFields;
+    unsigned int capEntries, capImport, capExport, capFields;
+
+    struct StrPool strings;
+    struct SymTab entryIndex;
     char* path;
+
+    /* mapped .sndcb the strings point into when loaded by sndcb_load() */
+    void* binary;
 };
 
 char* str_cpy(const char* s);
@@ -84,6 +121,23 @@ void free_sndc(struct SNDCFile* file);
 /****************/
 
 
+/*** Precompiled files ***/
+
+/* A .sndcb holds a parsed file and all the files it imports, see sndcb.c.
+ * Loading it puts the imported files in the import cache.
+ */
+int sndcb_probe(const char* filename);
+int sndcb_write(const char* filename,
+                const char* mainKey,
+                const struct SNDCFile* main);
+int sndcb_load(struct SNDCFile* file, const char* filename);
+void sndcb_release(void* map);
+/* parses a .sndc or loads a .sndcb, depending on the file's content */
+int sndc_load(struct SNDCFile* file, const char* filename);
+
+/****************/
+
+
 /*** Data and Buffer ***/
 
 enum InterpType {
@@ -99,24 +153,132 @@ struct Buffer {
     enum InterpType interp;
 };
 
+/* shapes of curve segments, the first ones matching enum InterpType */
+enum CurveShape {
+    CURVE_STEP,
+    CURVE_LINEAR,
+    CURVE_SINE,
+    CURVE_EXP       /* geometric, linear between values of different signs */
+};
+
+struct CurvePoint {
+    float time;     /* in seconds, sorted */
+    float value;
+    enum CurveShape shape;  /* of the segment from the previous point */
+};
+
+/* breakpoints of a signal read like a buffer spanning duration seconds,
+ * holding the first and last values outside of the points
+ */
+struct Curve {
+    struct CurvePoint* points;
+    unsigned int numPoints;
+    float duration;
+};
+
+/* format of buffer samples between the node producing them and the nodes
+ * reading them, see storage.c
+ */
+enum Storage {
+    STORE_F32,      /* floats */
+    STORE_F16,      /* half floats, saturated to +-65504 */
+    STORE_S16,      /* 16 bits integers scaled to the buffer's range */
+    STORE_AUTO      /* F16 or S16, whichever is more accurate */
+};
+
 struct Data {
     enum DataType {
         DATA_UNKNOWN    = 0,
         DATA_BUFFER     = 1 << 0,
         DATA_FLOAT      = 1 << 1,
-        DATA_STRING     = 1 << 2
+        DATA_STRING     = 1 << 2,
+        DATA_CURVE      = 1 << 3
     } type;
     union DataContent {
         struct Buffer buf;
         float f;
         char* str;
+        struct Curve curve;
     } content;
     char ready;
+
+    /* parsed value of a string input taking one of a fixed set of values,
+     * valid when enumSet matches the set, see data_parse_enum()
+     */
+    const char** enumSet;
+    int enumVal;
+
+    /* storage of the buffer once processed, and its samples when packed,
+     * content.buf.data being NULL then
+     */
+    enum Storage storage;
+    struct Packed {
+        void* data;
+        enum Storage format;
+        float step, offset;     /* of S16 samples */
+    } packed;
 };
 
+/* types of the inputs read as control signals */
+#define DATA_CONTROL    (DATA_FLOAT | DATA_BUFFER | DATA_CURVE)
+
+struct DataDesc;
+
 void data_init(struct Data* data);
 void data_free(struct Data* data);
 
+/* storage of Buffer samples, which data_free() releases: on the heap, or in
+ * temporary files mapped in memory past settings.memLimit
+ */
+float* buffer_alloc(unsigned int n);
+float* buffer_calloc(unsigned int n);
+float* buffer_realloc(float* data, unsigned int n);
+/* another reference to the samples, for a buffer of at most their size,
+ * each reference being released by buffer_free()
+ */
+float* buffer_share(float* data);
+/* the first n samples, writable: data if it isn't shared, else a copy,
+ * releasing the reference to data
+ */
+float* buffer_own(float* data, unsigned int n);
+void buffer_free(float* data);
+
+/* samples per block of the silence maps of buffers */
+#define SILENT_BLOCK    1024
+/* records which blocks of the first n samples, written, are all zeros */
+void buffer_map_silence(float* data, unsigned int n);
+/* the end, at most end, of the run of samples from start that are all known
+ * to be zeros, silent being set, or all not known to be
+ */
+unsigned int buffer_silent_run(const float* data,
+                               unsigned int start, unsigned int end,
+                               int* silent);
+
+enum ResampleQuality {
+    RESAMPLE_FAST,
+    RESAMPLE_BEST
+};
+
+/* resamples src into a new buffer at the given rate */
+int resample_buffer(struct Buffer* dest,
+                    const struct Buffer* src,
+                    unsigned int rate,
+                    enum ResampleQuality quality);
+
+/* packs a processed buffer as its storage asks, keeping the floats if it
+ * can't, and unpacks into dest, which can be src
+ */
+int data_pack(struct Data* data);
+int data_unpack(struct Data* dest, struct Data* src);
+/* unpacks the samples start to start + n - 1 of a packed buffer */
+void data_unpack_range(const struct Data* data, float* dest,
+                       unsigned int start, unsigned int n);
+int storage_parse(const char* name, enum Storage* storage);
+
+int data_parse_enum(struct Data* data,
+                    const struct DataDesc* desc,
+                    const char* ctx);
+
 /****************/
 
 
@@ -135,6 +297,12 @@ struct Node {
     const char* name;
     const char* path;
     char isSetup;
+    char isValid;   /* inputs statically known to match the module's spec */
+    char control;   /* renders at the control rate, see control.c */
+    char curve;     /* outputs may be curves, see control.c */
+    unsigned int inplace;   /* input slots read by this node only, a bit
+                             * each, see node_take_input() */
+    float from, to; /* seconds of the outputs to render, see range.c */
     const struct Module* module;
     void* data;
 };
@@ -142,6 +310,37 @@ struct Node {
 void node_init(struct Node* node);
 void node_free(struct Node* node);
 void node_flush_output(struct Node* node);
+/* replaces the packed inputs by unpacked copies while the node processes,
+ * except the DESC_PACKED ones, saving the inputs for node_restore_inputs()
+ */
+int node_unpack_inputs(struct Node* node,
+                       struct Data** saved,
+                       struct Data* unpacked);
+void node_restore_inputs(struct Node* node,
+                         struct Data** saved,
+                         struct Data* unpacked);
+void node_pack_outputs(struct Node* node);
+/* the samples of a buffer input the node is the only reader of, for it to
+ * write its output over, NULL if it can't, the input being left empty
+ */
+float* node_take_input(struct Node* node, unsigned int slot);
+/* replaces the inputs to resample by resampled copies in resampled, which
+ * can hold unpacked copies already, see resample.c
+ */
+int node_match_rates(struct Node* node, struct Data* resampled);
+/* the samples lo to hi - 1 of an output of given rate and size the node has
+ * to render, see range.c
+ */
+void node_range(const struct Node* node, float rate, unsigned int size,
+                unsigned int* lo, unsigned int* hi);
+/* slice_run() on the samples of out the node has to render, the others being
+ * zeroed once rendered
+ */
+int node_slice_run(const struct Node* node, const struct Buffer* out,
+                   unsigned int warmup,
+                   int (*run)(void* ctx, unsigned int warm,
+                              unsigned int start, unsigned int end),
+                   void* ctx);
 
 /****************/
 
@@ -159,7 +358,19 @@ struct DataDesc {
 
     float min;
     float max;
-    const char* values;
+    const char** values;    /* accepted strings, NULL terminated */
+    int flags;
+};
+
+enum DescFlags {
+    DESC_CONTROL    = 1 << 0,   /* control signal, read by interpolation */
+    DESC_SAME_RATE  = 1 << 1,   /* resampled to the highest rate of the
+                                 * node's DESC_SAME_RATE inputs */
+    DESC_INTERP     = 1 << 2,   /* read by interpolation, at any rate */
+    DESC_TIMED      = 1 << 3,   /* read at the time of the sample rendered,
+                                 * see range.c */
+    DESC_PACKED     = 1 << 4    /* only read through data_float() and co,
+                                 * left packed, see storage.c */
 };
 
 struct Module {
@@ -172,10 +383,24 @@ struct Module {
     int (*setup)(struct Node* node);
     int (*process)(struct Node* node);
     int (*teardown)(struct Node* node);
+    int flags;
 
     struct SNDCFile* file;
 };
 
+enum ModFlags {
+    MOD_CONTROL     = 1 << 0,   /* renders at the control rate when its
+                                 * outputs are only read as control signals */
+    MOD_INPLACE     = 1 << 1,   /* can write its output over an input buffer
+                                 * no other node reads */
+    MOD_UNIQUE      = 1 << 2,   /* never merged with identical nodes, see
+                                 * merge.c */
+    MOD_RANGED      = 1 << 3,   /* can render a time range of its outputs,
+                                 * see range.c */
+    MOD_LOOKBACK    = 1 << 4    /* reads its DESC_TIMED inputs before the
+                                 * range it renders, to settle its state */
+};
+
 extern const struct Module* modules[];
 extern const unsigned int numModules;
 
@@ -184,6 +409,9 @@ int module_get_input_slot(const struct Module* module, const char* name);
 int module_get_output_slot(const struct Module* module, const char* name);
 int module_import(struct Module* module, const char* name, const char* file);
 void module_free_import(struct Module* module);
+void import_cache_clear(void);
+int import_cache_put(const char* path, struct SNDCFile* file);
+const struct SNDCFile* import_cache_file(unsigned int i, const char** path);
 
 /****************/
 
@@ -194,9 +422,13 @@ struct Stack {
     struct Data** data;
     struct Node** nodes;
     unsigned int numNodes, numData, numImports;
+    unsigned int capNodes, capData, capImports;
+    struct SymTab nodeIndex, importIndex;
 
     char* path;
     char verbose;
+    char profile;   /* print the time and subnormal outputs of each node */
+    float range[2]; /* seconds of the result to render, all if range[1] is 0 */
 };
 
 void stack_init(struct Stack* stack);
@@ -211,12 +443,256 @@ struct Data* stack_data_new(struct Stack* stack);
 struct Module* stack_import_new(struct Stack* stack);
 struct Node* stack_get_node(struct Stack* stack, const char* name);
 int stack_process(struct Stack* stack);
+/* processes a single node, as stack_process() does */
+int stack_process_node(struct Stack* stack, struct Node* node);
 int stack_load(struct Stack* stack, struct SNDCFile* file);
+/* copies file into flat with the entries of imported files spliced in place
+ * of the nodes importing them, see flatten.c
+ */
+int stack_flatten(struct Stack* stack,
+                  const struct SNDCFile* file,
+                  struct SNDCFile* flat);
+/* drops the entries identical to earlier ones, see merge.c */
+int stack_merge(struct Stack* stack, struct SNDCFile* file);
+/* sets the storage of the buffers of a loaded stack, see storage.c */
+int stack_plan_storage(struct Stack* stack, const struct SNDCFile* file);
+/* finds the inputs nodes can write their outputs over, see storage.c */
+int stack_plan_inplace(struct Stack* stack, const struct SNDCFile* file);
+/* picks the nodes rendering at the control rate, see control.c */
+int stack_plan_control(struct Stack* stack, const struct SNDCFile* file);
+/* sets the time range each node renders, see range.c */
+int stack_plan_range(struct Stack* stack, const struct SNDCFile* file);
 void stack_reset(struct Stack* stack);
 
 /****************/
 
 
+/*** Render handle ***/
+
+/* A patch is loaded once and can be rendered many times, with var nodes and
+ * exported inputs overridden between renders. Only the nodes affected by
+ * the overrides are processed again, see patch.c.
+ */
+struct Patch;
+
+struct Patch* patch_load(const char* filename);
+void patch_free(struct Patch* patch);
+/* name is an exported input or a var node */
+int patch_set_float(struct Patch* patch, const char* name, float value);
+int patch_set_string(struct Patch* patch, const char* name, const char* value);
+int patch_render(struct Patch* patch);
+/* name is an exported output, a node (first output), or NULL for the last
+ * node. The buffer is owned by the patch and valid until the next render.
+ * Buffers stored packed are unpacked, not concurrently with the renders of
+ * the patch's variants.
+ */
+const struct Buffer* patch_output(struct Patch* patch, const char* name);
+/* Copies the nodes downstream of the named inputs into a new patch sharing
+ * the other nodes' outputs, after rendering them in the base. Variants of a
+ * patch can be overridden and rendered concurrently, and are freed with
+ * patch_free() before their base.
+ */
+struct Patch* patch_variant(struct Patch* base,
+                            const char** names,
+                            unsigned int numNames);
+
+/****************/
+
+
+/*** Output ***/
+
+/* raw is native float32 without header, the others are WAV files */
+enum OutputFormat {
+    OUTPUT_RAW,
+    OUTPUT_F32,
+    OUTPUT_S16,
+    OUTPUT_S24
+};
+
+struct Output;
+
+int output_format(const char* name, enum OutputFormat* format);
+/* filename NULL means stdout, the file is written by a dedicated thread */
+struct Output* output_open(const char* filename, enum OutputFormat format);
+/* writes the buffer to the output, only once per output */
+int output_write(struct Output* out, const struct Buffer* buf);
+/* waits for the pending writes, closes and frees the output */
+int output_close(struct Output* out);
+
+/****************/
+
+
+/*** Worker pool ***/
+
+struct Pool;
+
+/* number of online CPUs */
+unsigned int pool_default_size(void);
+/* 0 threads means pool_default_size() */
+struct Pool* pool_new(unsigned int numThreads);
+int pool_submit(struct Pool* pool, void (*run)(void*), void* arg);
+/* waits until all the submitted jobs are done */
+void pool_wait(struct Pool* pool);
+/* runs the remaining jobs, then stops the threads and frees the pool */
+void pool_free(struct Pool* pool);
+
+/****************/
+
+
+/*** SIMD kernels ***/
+
+/* independent accumulators of the reductions */
+#define KERNEL_LANES        16
+#define KERNEL_DITHER_LANES 8
+
+/* indexed like binop's operators */
+enum KernelOp {
+    KERNEL_ADD,
+    KERNEL_SUB,
+    KERNEL_MUL,
+    KERNEL_DIV,
+    KERNEL_MIN,
+    KERNEL_MAX
+};
+
+/* Hot loops, compiled for several instruction sets, see kernels.c */
+struct Kernels {
+    const char* name;
+    /* dest += src */
+    void (*add)(float* dest, const float* src, unsigned int n);
+    /* dest += gains * src, or gain * src if gains is NULL */
+    void (*mix)(float* dest, const float* src,
+                const float* gains, float gain, unsigned int n);
+    /* dest = a op b, or a op c if b is NULL */
+    void (*binop)(int op, float* dest, const float* a,
+                  const float* b, float c, unsigned int n);
+    /* dest = interp(buf, t), for n positions */
+    void (*interp)(float* dest, const struct Buffer* buf,
+                   const float* t, unsigned int n);
+    /* dest = interp_at(buf, start + i, size), for i < n */
+    void (*interp_at)(float* dest, const struct Buffer* buf,
+                      unsigned int start, unsigned int size, unsigned int n);
+    /* dest[g * KERNEL_LANES + j] = a[g] * p[j] + b[g] * q[j] + c for n
+     * groups, curve segments evaluated from values anchored on each group
+     * and tables of lane offsets
+     */
+    void (*segment)(float* dest, const float* a, const float* b,
+                    const float* p, const float* q, float c, unsigned int n);
+    /* n interleaved complex values scaled by real gains */
+    void (*cscale)(float* dest, const float* gains, unsigned int n);
+    /* samples to little endian float32 and 16 or 24 bits dithered PCM,
+     * state holding KERNEL_DITHER_LANES generators
+     */
+    void (*encode_f32)(unsigned char* dest, const float* src, unsigned int n);
+    void (*encode_int)(unsigned char* dest, const float* src, unsigned int n,
+                       unsigned int bytes, uint32_t* state);
+    /* smallest and largest of n > 0 samples */
+    void (*range)(const float* src, unsigned int n, float* min, float* max);
+    /* samples to and from half floats, and from and to 16 bits integers,
+     * as src = dest * step + offset
+     */
+    void (*pack_f16)(uint16_t* dest, const float* src, unsigned int n);
+    void (*unpack_f16)(float* dest, const uint16_t* src, unsigned int n);
+    void (*pack_s16)(int16_t* dest, const float* src,
+                     float step, float offset, unsigned int n);
+    void (*unpack_s16)(float* dest, const int16_t* src,
+                       float step, float offset, unsigned int n);
+    /* dest[i] = sum of src[offsets[i] + t] * bank[phases[i] * taps + t] over
+     * the taps, a multiple of KERNEL_LANES
+     */
+    void (*fir)(float* dest, const float* src, const float* bank,
+                unsigned int taps, const uint32_t* offsets,
+                const uint32_t* phases, unsigned int n);
+};
+
+/* variant for the running CPU, selected on first call */
+const struct Kernels* kernels_get(void);
+/* prints the CPU features and the selected variant */
+void kernels_info(FILE* f);
+
+/****************/
+
+
+/*** Settings ***/
+
+/* process wide, set before rendering anything */
+struct Settings {
+    unsigned int sliceThreads;  /* threads rendering slices of a signal */
+    char keepDenormals;         /* don't flush subnormal floats to zero */
+    unsigned long memLimit;     /* bytes of buffer samples kept on the heap
+                                 * before spilling to disk, 0 for no limit */
+    enum Storage storage;       /* of buffers only read as control signals */
+    const struct StorageRule {
+        const char* node;       /* storage of the outputs of nodes so named */
+        enum Storage storage;
+    }* storageRules;
+    unsigned int numStorageRules;
+    unsigned int draft;         /* sampling rates divided by, with cheaper
+                                 * effects, 0 for a final render */
+    unsigned int controlRatio;  /* sampling rates of control signals divided
+                                 * by, 0 to render them at full rate */
+};
+
+/* sampling rate divisor of draft renders */
+#define DRAFT_RATIO 4
+
+extern struct Settings settings;
+
+/* flushes subnormals to zero on the calling thread, unless keepDenormals,
+ * returns the previous floating point state for denormals_restore()
+ */
+unsigned long denormals_disable(void);
+void denormals_restore(unsigned long state);
+
+/* sampling rate generators render at when asked for the given rate */
+float render_rate(float rate);
+/* sampling rate of a generator node given its sampling input, if any, and
+ * default rate: the control rate if the node was planned so and control is
+ * set, otherwise the node is taken off the control rate. Only the default
+ * rate is lowered by draft renders.
+ */
+float node_rate(struct Node* node,
+                const struct Data* sampling,
+                float def,
+                int control);
+/* samples of a signal lasting duration seconds at rate, computed in double
+ * for long signals to get their exact size, 0 if negative, over the 2^32
+ * samples a buffer holds, 27 hours at 44100Hz, or if a positive duration
+ * comes out as no sample
+ */
+int node_size(const struct Node* node, double duration, double rate,
+              unsigned int* size);
+/* n samples as a buffer size, 0 if negative or over 2^32 samples, for sizes
+ * summed or scaled from others, name prefixing the error
+ */
+int buffer_size(const char* name, double n, unsigned int* size);
+
+/****************/
+
+
+/*** Time slicing ***/
+
+/* Renders samples 0 to size - 1 of a signal, split in time slices rendered
+ * concurrently when settings.sliceThreads > 1 and the signal is long enough.
+ * run(ctx, warm, start, end) renders samples start to end - 1, from a reset
+ * state at sample warm: start - warmup, or 0. Returns 0 if a slice failed.
+ */
+int slice_run(unsigned int size, unsigned int warmup,
+              int (*run)(void* ctx, unsigned int warm,
+                         unsigned int start, unsigned int end),
+              void* ctx);
+/* slice_run() on samples start to end - 1 only */
+int slice_run_range(unsigned int start, unsigned int end,
+                    unsigned int warmup,
+                    int (*run)(void* ctx, unsigned int warm,
+                               unsigned int start, unsigned int end),
+                    void* ctx);
+/* warm-up length of a feedback loop of given gain and period in samples */
+unsigned int slice_warmup(float gain, unsigned int period);
+
+/****************/
+
+
 /*** sndk file format ***/
 struct Note {
     unsigned int beat;
@@ -0,0 +1,581 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "sndc.h"
+
+/* Precompiled sndc files (.sndcb)
+ *
+ * A .sndcb holds a parsed file along with every file it depends on (imports
+ * and keyboard instruments, recursively), in native byte order:
+ *
+ *   header:     magic, version, numFiles, strSize
+ *   strings:    strSize bytes of NUL terminated strings, padded to 4 bytes
+ *   numFiles times:
+ *     file:     key, path, numImport, numExport, numEntries, numFields
+ *     imports:  numImport  * {fileName, importName}
+ *     exports:  numExport  * {symbol, refName, refField, type}
+ *     entries:  numEntries * {name, type, numFields}
+ *     fields:   numFields  * {name, type, value0, value1}
+ *
+ * All values are 32 bits unsigned ints, strings are offsets in the string
+ * table. The first file is the main one, the others are put in the import
+ * cache under their key, so that importing them doesn't read any source.
+ * Loading maps the file in memory and points all strings to the mapping.
+ *
+ * Keys, paths and imported file names that aren't absolute are relative to
+ * the directory of the .sndcb, so that it runs from any directory and finds
+ * the data files (.sndk, .sndl) next to the sources it was compiled from.
+ */
+
+#define SNDCB_MAGIC     "SNDB"
+#define SNDCB_VERSION   2
+
+struct SNDCBHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t numFiles;
+    uint32_t strSize;
+};
+
+struct SNDCBFile {
+    uint32_t key, path;
+    uint32_t numImport, numExport, numEntries, numFields;
+};
+
+struct SNDCBMap {
+    void* data;
+    size_t size;
+    unsigned int refs;
+};
+
+/*** Writing ***/
+
+struct StrTable {
+    struct SymTab index;
+    const char** strings;
+    unsigned int num, cap;
+    uint32_t size;
+
+    /* path from the .sndcb to the current directory, and paths prefixed */
+    char* base;
+    struct StrPool paths;
+};
+
+static int str_id(struct StrTable* t, const char* s, uint32_t* id) {
+    int i;
+
+    if ((i = symtab_get(&t->index, s)) < 0) {
+        if (t->num >= t->cap) {
+            unsigned int cap = t->cap ? 2 * t->cap : 64;
+            void* tmp;
+
+            if (!(tmp = realloc(t->strings, cap * sizeof(*t->strings)))) {
+                return 0;
+            }
+            t->strings = tmp;
+            t->cap = cap;
+        }
+        if (!symtab_set(&t->index, s, t->size)) return 0;
+        t->strings[t->num++] = s;
+        i = t->size;
+        t->size += strlen(s) + 1;
+    }
+    *id = i;
+    return 1;
+}
+
+static int path_id(struct StrTable* t, const char* s, uint32_t* id) {
+    char* p;
+    size_t len;
+
+    if (s[0] == '/' || !t->base[0]) return str_id(t, s, id);
+    len = strlen(t->base) + strlen(s);
+    if (!(p = malloc(len + 1))) return 0;
+    strcpy(p, t->base);
+    strcpy(p + strlen(t->base), s);
+    s = strpool_add(&t->paths, p, len);
+    free(p);
+    return s && str_id(t, s, id);
+}
+
+static char* get_cwd(void) {
+    char *buf = NULL, *tmp;
+    size_t size = 256;
+
+    for (;;) {
+        if (!(tmp = realloc(buf, size))) break;
+        buf = tmp;
+        if (getcwd(buf, size)) return buf;
+        if (errno != ERANGE) break;
+        size *= 2;
+    }
+    free(buf);
+    return NULL;
+}
+
+/* resolves "." and ".." in an absolute path, without a trailing slash */
+static void normalize(char* p) {
+    char *r = p, *w = p;
+    size_t n;
+
+    while (*r) {
+        while (*r == '/') r++;
+        n = strcspn(r, "/");
+        if (n == 2 && r[0] == '.' && r[1] == '.') {
+            while (w > p && *--w != '/');
+        } else if (n && !(n == 1 && r[0] == '.')) {
+            *w++ = '/';
+            memmove(w, r, n);
+            w += n;
+        }
+        r += n;
+    }
+    *w = 0;
+}
+
+/* path from the directory of filename to the current directory, the paths of
+ * the parsed files being relative to the latter: "../src/" for out/a.sndcb
+ * compiled from src/, "" for a .sndcb written in the current directory
+ */
+static char* cwd_from(const char* filename) {
+    char *cwd, *dir = NULL, *res = NULL;
+    const char* slash = strrchr(filename, '/');
+    size_t len = slash ? slash - filename : 0, i, common, ups = 0;
+
+    if (!(cwd = get_cwd())
+            || !(dir = malloc(strlen(cwd) + len + 2))) {
+        free(cwd);
+        return NULL;
+    }
+    dir[0] = 0;
+    if (filename[0] != '/') {
+        strcpy(dir, cwd);
+        strcat(dir, "/");
+    }
+    strncat(dir, filename, len);
+    normalize(dir);
+    normalize(cwd);
+
+    for (i = 0; cwd[i] && cwd[i] == dir[i]; i++);
+    if ((cwd[i] && cwd[i] != '/') || (dir[i] && dir[i] != '/')) {
+        while (i && cwd[i] != '/') i--;
+    }
+    common = i;
+    for (i = common; dir[i]; i++) {
+        ups += dir[i] == '/';
+    }
+    if ((res = malloc(3 * ups + strlen(cwd + common) + 2))) {
+        res[0] = 0;
+        while (ups--) strcat(res, "../");
+        if (cwd[common]) {
+            strcat(res, cwd + common + 1);
+            strcat(res, "/");
+        }
+    }
+    free(cwd);
+    free(dir);
+    return res;
+}
+
+static int write_u32(FILE* out, uint32_t v) {
+    return fwrite(&v, sizeof(v), 1, out) == 1;
+}
+
+#define W(v) if (!write_u32(out, (v))) return 0
+#define S(s, id) if (!str_id(strings, (s), &(id))) return 0
+#define P(s, id) if (!path_id(strings, (s), &(id))) return 0
+
+static int write_file(FILE* out, struct StrTable* strings,
+                      const char* key, const struct SNDCFile* f) {
+    struct SNDCBFile hdr;
+    unsigned int i, j;
+    uint32_t a, b, c;
+
+    P(key, hdr.key);
+    P(f->path, hdr.path);
+    hdr.numImport = f->numImport;
+    hdr.numExport = f->numExport;
+    hdr.numEntries = f->numEntries;
+    hdr.numFields = 0;
+    for (i = 0; i < f->numEntries; i++) {
+        hdr.numFields += f->entries[i].numFields;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) return 0;
+
+    for (i = 0; i < f->numImport; i++) {
+        P(f->imports[i].fileName, a);
+        S(f->imports[i].importName, b);
+        W(a); W(b);
+    }
+    for (i = 0; i < f->numExport; i++) {
+        S(f->exports[i].symbol, a);
+        S(f->exports[i].ref.name, b);
+        S(f->exports[i].ref.field, c);
+        W(a); W(b); W(c); W(f->exports[i].type);
+    }
+    for (i = 0; i < f->numEntries; i++) {
+        S(f->entries[i].name, a);
+        S(f->entries[i].type, b);
+        W(a); W(b); W(f->entries[i].numFields);
+    }
+    for (i = 0; i < f->numEntries; i++) {
+        for (j = 0; j < f->entries[i].numFields; j++) {
+            const struct Field* field = f->entries[i].fields + j;
+
+            S(field->name, a);
+            b = c = 0;
+            switch (field->type) {
+                case FIELD_FLOAT:
+                    memcpy(&b, &field->data.f, sizeof(b));
+                    break;
+                case FIELD_STRING:
+                    S(field->data.str, b);
+                    break;
+                case FIELD_REF:
+                    S(field->data.ref.name, b);
+                    S(field->data.ref.field, c);
+                    break;
+            }
+            W(a); W(field->type); W(b); W(c);
+        }
+    }
+    return 1;
+}
+
+#undef W
+#undef S
+#undef P
+
+/* the main file and its dependencies are written to a temporary file first,
+ * as the string table that precedes them is only known once they're done
+ */
+static int write_all(FILE* out, FILE* body, struct StrTable* strings,
+                     const char* mainKey, const struct SNDCFile* main) {
+    struct SNDCBHeader hdr;
+    const struct SNDCFile* f;
+    const char* key;
+    unsigned int i;
+    char buf[4096];
+    size_t n;
+
+    memcpy(hdr.magic, SNDCB_MAGIC, 4);
+    hdr.version = SNDCB_VERSION;
+    hdr.numFiles = 1;
+    if (!write_file(body, strings, mainKey, main)) return 0;
+    for (i = 0; (f = import_cache_file(i, &key)); i++) {
+        if (!write_file(body, strings, key, f)) return 0;
+        hdr.numFiles++;
+    }
+    hdr.strSize = strings->size;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) return 0;
+    for (i = 0; i < strings->num; i++) {
+        const char* s = strings->strings[i];
+
+        if (fwrite(s, strlen(s) + 1, 1, out) != 1) return 0;
+    }
+    for (i = strings->size; i % 4; i++) {
+        if (putc(0, out) == EOF) return 0;
+    }
+    rewind(body);
+    while ((n = fread(buf, 1, sizeof(buf), body))) {
+        if (fwrite(buf, 1, n, out) != n) return 0;
+    }
+    return !ferror(body);
+}
+
+int sndcb_write(const char* filename,
+                const char* mainKey,
+                const struct SNDCFile* main) {
+    struct StrTable strings = {0};
+    FILE *out = NULL, *body = NULL;
+    int ok = 0;
+
+    symtab_init(&strings.index);
+    strpool_init(&strings.paths);
+    if (!(strings.base = cwd_from(filename))) {
+        fprintf(stderr, "Error: sndcb_write: can't get current directory\n");
+    } else if (!(out = fopen(filename, "wb"))) {
+        fprintf(stderr, "Error: sndcb_write: can't open %s for writing\n",
+                filename);
+    } else if (!(body = tmpfile())) {
+        fprintf(stderr, "Error: sndcb_write: can't create temporary file\n");
+    } else if (!(ok = write_all(out, body, &strings, mainKey, main))) {
+        fprintf(stderr, "Error: sndcb_write: can't write %s\n", filename);
+    }
+    if (body) fclose(body);
+    if (out && fclose(out)) ok = 0;
+    symtab_free(&strings.index);
+    strpool_free(&strings.paths);
+    free(strings.strings);
+    free(strings.base);
+    return ok;
+}
+
+/*** Loading ***/
+
+struct Reader {
+    const uint32_t* cur;
+    const uint32_t* end;
+    const char* strings;
+    uint32_t strSize;
+    char* dir;
+};
+
+static int read_u32(struct Reader* r, uint32_t* v) {
+    if (r->cur >= r->end) return 0;
+    *v = *r->cur++;
+    return 1;
+}
+
+static int read_str(struct Reader* r, char** s) {
+    uint32_t id;
+
+    if (!read_u32(r, &id) || id >= r->strSize) return 0;
+    *s = (char*) r->strings + id;
+    return 1;
+}
+
+/* prefixes a relative path with the directory of the .sndcb */
+static int read_path(struct Reader* r, struct SNDCFile* f, char** s) {
+    char* p;
+    size_t len;
+
+    if (!read_str(r, s)) return 0;
+    if ((*s)[0] == '/' || !r->dir[0]) return 1;
+    len = strlen(r->dir) + strlen(*s);
+    if (!(p = malloc(len + 1))) return 0;
+    strcpy(p, r->dir);
+    strcpy(p + strlen(r->dir), *s);
+    *s = strpool_add(&f->strings, p, len);
+    free(p);
+    return *s != NULL;
+}
+
+#define R(v) if (!read_u32(r, &(v))) return 0
+#define RS(s) if (!read_str(r, &(s))) return 0
+#define RP(s) if (!read_path(r, f, &(s))) return 0
+
+static int read_file(struct Reader* r, struct SNDCFile* f, char** key) {
+    struct SNDCBFile hdr;
+    unsigned int i, j, k = 0;
+    char* path;
+    uint32_t v;
+
+    RP(*key);
+    RP(path);
+    R(hdr.numImport);
+    R(hdr.numExport);
+    R(hdr.numEntries);
+    R(hdr.numFields);
+    if (!(f->path = str_cpy(path))) return 0;
+
+    if (       (hdr.numImport
+                && !(f->imports = calloc(hdr.numImport, sizeof(*f->imports))))
+            || (hdr.numExport
+                && !(f->exports = calloc(hdr.numExport, sizeof(*f->exports))))
+            || (hdr.numEntries
+                && !(f->entries = calloc(hdr.numEntries, sizeof(*f->entries))))
+            || (hdr.numFields
+                && !(f->fields = calloc(hdr.numFields, sizeof(*f->fields))))) {
+        return 0;
+    }
+    f->numImport = f->capImport = hdr.numImport;
+    f->numExport = f->capExport = hdr.numExport;
+    f->numEntries = f->capEntries = hdr.numEntries;
+    f->numFields = f->capFields = hdr.numFields;
+
+    for (i = 0; i < f->numImport; i++) {
+        RP(f->imports[i].fileName);
+        RS(f->imports[i].importName);
+    }
+    for (i = 0; i < f->numExport; i++) {
+        RS(f->exports[i].symbol);
+        RS(f->exports[i].ref.name);
+        RS(f->exports[i].ref.field);
+        R(v);
+        if (v != EXP_INPUT && v != EXP_OUTPUT) return 0;
+        f->exports[i].type = v;
+    }
+    for (i = 0; i < f->numEntries; i++) {
+        RS(f->entries[i].name);
+        RS(f->entries[i].type);
+        R(v);
+        if (v > f->numFields - k) return 0;
+        f->entries[i].numFields = v;
+        f->entries[i].fields = f->fields + k;
+        k += v;
+        if (!symtab_set(&f->entryIndex, f->entries[i].name, i)) return 0;
+    }
+    for (i = 0; i < f->numEntries; i++) {
+        for (j = 0; j < f->entries[i].numFields; j++) {
+            struct Field* field = f->entries[i].fields + j;
+
+            RS(field->name);
+            R(v);
+            field->type = v;
+            switch (field->type) {
+                case FIELD_FLOAT:
+                    R(v);
+                    memcpy(&field->data.f, &v, sizeof(v));
+                    R(v);
+                    break;
+                case FIELD_STRING:
+                    RS(field->data.str);
+                    R(v);
+                    break;
+                case FIELD_REF:
+                    RS(field->data.ref.name);
+                    RS(field->data.ref.field);
+                    break;
+                default:
+                    return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+#undef R
+#undef RS
+#undef RP
+
+static void map_release(struct SNDCBMap* map) {
+    if (map && !--map->refs) {
+        munmap(map->data, map->size);
+        free(map);
+    }
+}
+
+static struct SNDCBMap* map_file(const char* filename) {
+    struct SNDCBMap* map = NULL;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        fprintf(stderr, "Error: can't open file: %s\n", filename);
+        return NULL;
+    }
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(struct SNDCBHeader)) {
+        fprintf(stderr, "Error: %s: invalid file\n", filename);
+    } else if (!(map = malloc(sizeof(*map)))) {
+        fprintf(stderr, "Error: %s: can't allocate map\n", filename);
+    } else if ((map->data = mmap(NULL, st.st_size, PROT_READ,
+                                 MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "Error: %s: can't map file\n", filename);
+        free(map);
+        map = NULL;
+    } else {
+        map->size = st.st_size;
+        map->refs = 0;
+    }
+    close(fd);
+    return map;
+}
+
+static int new_file(struct SNDCFile* f, struct SNDCBMap* map) {
+    memset(f, 0, sizeof(*f));
+    strpool_init(&f->strings);
+    symtab_init(&f->entryIndex);
+    f->binary = map;
+    map->refs++;
+    return 1;
+}
+
+int sndcb_load(struct SNDCFile* file, const char* filename) {
+    struct SNDCBMap* map;
+    const struct SNDCBHeader* hdr;
+    struct Reader r;
+    size_t body;
+    unsigned int i;
+    char* key;
+    const char* slash;
+    int ok = 1;
+
+    if (!(map = map_file(filename))) return 0;
+    hdr = map->data;
+    map->refs++;
+    if (       memcmp(hdr->magic, SNDCB_MAGIC, 4)
+            || hdr->version != SNDCB_VERSION
+            || hdr->strSize > map->size - sizeof(*hdr)
+            || !hdr->numFiles) {
+        fprintf(stderr, "Error: %s: not a valid sndcb file\n", filename);
+        map_release(map);
+        return 0;
+    }
+    r.strings = (const char*) (hdr + 1);
+    r.strSize = hdr->strSize;
+    body = sizeof(*hdr) + ((r.strSize + 3) & ~3UL);
+    body = body < map->size ? body : map->size;
+    r.cur = (const uint32_t*) ((const char*) map->data + body);
+    r.end = r.cur + (map->size - body) / sizeof(uint32_t);
+    if (r.strSize && r.strings[r.strSize - 1]) {
+        fprintf(stderr, "Error: %s: corrupted string table\n", filename);
+        map_release(map);
+        return 0;
+    }
+    slash = strrchr(filename, '/');
+    if (!(r.dir = malloc(slash ? slash - filename + 2 : 1))) {
+        fprintf(stderr, "Error: %s: can't allocate path\n", filename);
+        map_release(map);
+        return 0;
+    }
+    r.dir[0] = 0;
+    if (slash) strncat(r.dir, filename, slash - filename + 1);
+
+    new_file(file, map);
+    if (!read_file(&r, file, &key)) {
+        fprintf(stderr, "Error: %s: corrupted file\n", filename);
+        ok = 0;
+    }
+    for (i = 1; ok && i < hdr->numFiles; i++) {
+        struct SNDCFile dep;
+
+        new_file(&dep, map);
+        if (!read_file(&r, &dep, &key)) {
+            fprintf(stderr, "Error: %s: corrupted file\n", filename);
+            free_sndc(&dep);
+            ok = 0;
+        } else if (!import_cache_put(key, &dep)) {
+            fprintf(stderr, "Error: %s: can't cache %s\n", filename, key);
+            free_sndc(&dep);
+            ok = 0;
+        }
+    }
+    if (!ok) {
+        free_sndc(file);
+    }
+    free(r.dir);
+    map_release(map);
+    return ok;
+}
+
+void sndcb_release(void* map) {
+    map_release(map);
+}
+
+int sndcb_probe(const char* filename) {
+    char magic[4];
+    FILE* f;
+    int res = 0;
+
+    if ((f = fopen(filename, "rb"))) {
+        res = fread(magic, 4, 1, f) == 1 && !memcmp(magic, SNDCB_MAGIC, 4);
+        fclose(f);
+    }
+    return res;
+}
+
+int sndc_load(struct SNDCFile* file, const char* filename) {
+    if (sndcb_probe(filename)) {
+        return sndcb_load(file, filename);
+    }
+    return parse_sndc(file, filename);
+}
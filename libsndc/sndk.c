@@ -15,8 +15,10 @@ int sndk_load(const char* filename,
     if (!(kfile = fopen(filename, "r"))) {
         fprintf(stderr, "Error: sndk_load: can't open notes file: %s\n",
                 filename);
+        ok = 0;
     } else if (!(*notes = calloc(noteSize, sizeof(struct Note)))) {
         fprintf(stderr, "Error: load_notes: can't allocate notes\n");
+        ok = 0;
     } else {
         struct Note* curNote = *notes;
         int n;
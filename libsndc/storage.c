@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sndc.h"
+
+/* Buffer storage
+ *
+ * Buffers can be kept as 16 bits samples between the node producing them and
+ * the nodes reading them, halving the memory they hold: half floats, or
+ * integers scaled to the range of the buffer. A buffer is packed once its
+ * node is processed. The inputs flagged DESC_PACKED are left packed, the
+ * readers of utils.c unpacking the few samples they interpolate, the others
+ * are unpacked into a temporary buffer while their node processes.
+ *
+ * By default, only the buffers read as control signals (frequencies,
+ * cutoffs, gains...) by all the nodes they are input of are packed, as
+ * settings.storage asks. The outputs of the nodes named in
+ * settings.storageRules are packed as the rules ask. The buffers no other
+ * node of the stack reads, and the exported ones, are the results of the
+ * stack and always stay floats.
+ *
+ * The nodes of MOD_INPLACE modules can also write their output over the
+ * samples of an input buffer no other node reads, instead of allocating a
+ * new one, see node_take_input().
+ */
+
+/* uses of an output within its stack */
+#define USE_CONTROL     (1 << 0)
+#define USE_SIGNAL      (1 << 1)
+#define USE_RESULT      (1 << 2)
+
+static const char* storageNames[] = {"f32", "f16", "s16", "auto", NULL};
+
+int storage_parse(const char* name, enum Storage* storage) {
+    unsigned int i;
+
+    for (i = 0; storageNames[i]; i++) {
+        if (!strcmp(name, storageNames[i])) {
+            *storage = i;
+            return 1;
+        }
+    }
+    fprintf(stderr, "Error: storage must be one of: f32 f16 s16 auto\n");
+    return 0;
+}
+
+int stack_plan_storage(struct Stack* stack, const struct SNDCFile* file) {
+    unsigned char* use;
+    unsigned int i, j, k;
+
+    if (settings.storage == STORE_F32 && !settings.numStorageRules) {
+        return 1;
+    }
+    if (!(use = calloc(stack->numNodes * MAX_OUTPUTS + 1, 1))) {
+        fprintf(stderr, "Error: can't allocate storage plan\n");
+        return 0;
+    }
+    /* nodes are created in the order of the file's entries */
+    for (i = 0; i < file->numEntries && i < stack->numNodes; i++) {
+        const struct Entry* e = file->entries + i;
+        const struct Module* mod = stack->nodes[i]->module;
+
+        for (j = 0; j < e->numFields; j++) {
+            const struct Field* f = e->fields + j;
+            int r, slot, in;
+
+            if (       f->type != FIELD_REF
+                    || (r = symtab_get(&stack->nodeIndex,
+                                       f->data.ref.name)) < 0
+                    || (slot = module_get_output_slot(stack->nodes[r]->module,
+                                                      f->data.ref.field)) < 0
+                    || (in = module_get_input_slot(mod, f->name)) < 0) {
+                continue;
+            }
+            use[r * MAX_OUTPUTS + slot] |= mod->inputs[in].flags & DESC_CONTROL
+                                         ? USE_CONTROL : USE_SIGNAL;
+        }
+    }
+    for (i = 0; i < file->numExport; i++) {
+        const struct Export* e = file->exports + i;
+        int r, slot;
+
+        if (       e->type == EXP_OUTPUT
+                && (r = symtab_get(&stack->nodeIndex, e->ref.name)) >= 0
+                && (slot = module_get_output_slot(stack->nodes[r]->module,
+                                                  e->ref.field)) >= 0) {
+            use[r * MAX_OUTPUTS + slot] |= USE_RESULT;
+        }
+    }
+    if (stack->numNodes) {
+        memset(use + (stack->numNodes - 1) * MAX_OUTPUTS, USE_RESULT,
+               MAX_OUTPUTS);
+    }
+
+    for (i = 0; i < stack->numNodes; i++) {
+        const struct Node* n = stack->nodes[i];
+
+        for (j = 0; j < MAX_OUTPUTS; j++) {
+            unsigned char u = use[i * MAX_OUTPUTS + j];
+            enum Storage s;
+
+            if (!n->outputs[j] || !u || (u & USE_RESULT)) continue;
+            s = u == USE_CONTROL ? settings.storage : STORE_F32;
+            for (k = 0; k < settings.numStorageRules; k++) {
+                if (!strcmp(settings.storageRules[k].node, n->name)) {
+                    s = settings.storageRules[k].storage;
+                }
+            }
+            n->outputs[j]->storage = s;
+        }
+    }
+    free(use);
+    return 1;
+}
+
+int stack_plan_inplace(struct Stack* stack, const struct SNDCFile* file) {
+    unsigned char* reads;
+    unsigned int i, j;
+
+    if (!(reads = calloc(stack->numNodes * MAX_OUTPUTS + 1, 1))) {
+        fprintf(stderr, "Error: can't allocate in place plan\n");
+        return 0;
+    }
+    /* results are read after the stack is processed */
+    for (i = 0; i < file->numExport; i++) {
+        const struct Export* e = file->exports + i;
+        int r, slot;
+
+        if (       e->type == EXP_OUTPUT
+                && (r = symtab_get(&stack->nodeIndex, e->ref.name)) >= 0
+                && (slot = module_get_output_slot(stack->nodes[r]->module,
+                                                  e->ref.field)) >= 0) {
+            reads[r * MAX_OUTPUTS + slot] = 2;
+        }
+    }
+    if (stack->numNodes) {
+        memset(reads + (stack->numNodes - 1) * MAX_OUTPUTS, 2, MAX_OUTPUTS);
+    }
+    for (i = 0; i < file->numEntries && i < stack->numNodes; i++) {
+        const struct Entry* e = file->entries + i;
+
+        for (j = 0; j < e->numFields; j++) {
+            const struct Field* f = e->fields + j;
+            int r, slot;
+
+            if (       f->type == FIELD_REF
+                    && (r = symtab_get(&stack->nodeIndex,
+                                       f->data.ref.name)) >= 0
+                    && (slot = module_get_output_slot(stack->nodes[r]->module,
+                                                      f->data.ref.field)) >= 0
+                    && reads[r * MAX_OUTPUTS + slot] < 2) {
+                reads[r * MAX_OUTPUTS + slot]++;
+            }
+        }
+    }
+    for (i = 0; i < file->numEntries && i < stack->numNodes; i++) {
+        const struct Entry* e = file->entries + i;
+        struct Node* n = stack->nodes[i];
+
+        if (!(n->module->flags & MOD_INPLACE)) continue;
+        for (j = 0; j < e->numFields; j++) {
+            const struct Field* f = e->fields + j;
+            int r, slot, in;
+
+            if (       f->type == FIELD_REF
+                    && (r = symtab_get(&stack->nodeIndex,
+                                       f->data.ref.name)) >= 0
+                    && (slot = module_get_output_slot(stack->nodes[r]->module,
+                                                      f->data.ref.field)) >= 0
+                    && (in = module_get_input_slot(n->module, f->name)) >= 0
+                    && reads[r * MAX_OUTPUTS + slot] == 1) {
+                n->inplace |= 1U << in;
+            }
+        }
+    }
+    free(reads);
+    return 1;
+}
+
+float* node_take_input(struct Node* node, unsigned int slot) {
+    struct Data* in = node->inputs[slot];
+    float *data, *own;
+
+    if (       !(node->inplace & (1U << slot))
+            || !in
+            || in->type != DATA_BUFFER
+            || !(data = in->content.buf.data)) {
+        return NULL;
+    }
+    /* the samples can still be shared with a node passing them through */
+    if (!(own = buffer_own(data, in->content.buf.size))) {
+        return NULL;
+    }
+    in->content.buf.data = NULL;
+    return own;
+}
+
+/* worst errors: S16 a half step, F16 a 2^-11 relative error. Signals keeping
+ * their sign, such as frequencies, are compared at their smallest magnitude,
+ * the others, such as audio, at their full scale where S16 always wins.
+ */
+static enum Storage choose_format(float min, float max) {
+    float step = (max - min) / 65534;
+
+    if (min > 0 && step / 2 > min / 2048 && max <= 65504) {
+        return STORE_F16;
+    } else if (max < 0 && step / 2 > -max / 2048 && min >= -65504) {
+        return STORE_F16;
+    }
+    return STORE_S16;
+}
+
+int data_pack(struct Data* data) {
+    const struct Kernels* k = kernels_get();
+    struct Buffer* buf = &data->content.buf;
+    enum Storage format = data->storage;
+    float min = 0, max = 0;
+    void* packed;
+
+    if (       format == STORE_F32
+            || data->type != DATA_BUFFER
+            || !buf->data
+            || !buf->size) {
+        return 1;
+    }
+    if (format != STORE_F16) {
+        k->range(buf->data, buf->size, &min, &max);
+        /* inf or NaN */
+        if (!(max - min < 1e30)) return 1;
+    }
+    if (format == STORE_AUTO) {
+        format = choose_format(min, max);
+    }
+    /* 2 samples per float */
+    if (!(packed = buffer_alloc(buf->size / 2 + 1))) {
+        return 0;
+    }
+    data->packed.format = format;
+    if (format == STORE_F16) {
+        k->pack_f16(packed, buf->data, buf->size);
+    } else {
+        data->packed.step = (max - min) / 65534;
+        data->packed.offset = min + (max - min) / 2;
+        k->pack_s16(packed, buf->data,
+                    data->packed.step, data->packed.offset, buf->size);
+    }
+    buffer_free(buf->data);
+    buf->data = NULL;
+    data->packed.data = packed;
+    return 1;
+}
+
+void data_unpack_range(const struct Data* data, float* dest,
+                       unsigned int start, unsigned int n) {
+    const struct Kernels* k = kernels_get();
+
+    if (data->packed.format == STORE_F16) {
+        k->unpack_f16(dest, (const uint16_t*) data->packed.data + start, n);
+    } else {
+        k->unpack_s16(dest, (const int16_t*) data->packed.data + start,
+                      data->packed.step, data->packed.offset, n);
+    }
+}
+
+int data_unpack(struct Data* dest, struct Data* src) {
+    unsigned int size = src->content.buf.size;
+    float* samples;
+
+    if (!(samples = buffer_alloc(size))) {
+        fprintf(stderr, "Error: can't unpack buffer\n");
+        return 0;
+    }
+    data_unpack_range(src, samples, 0, size);
+    if (dest == src) {
+        buffer_free(src->packed.data);
+    } else {
+        *dest = *src;
+        dest->storage = STORE_F32;
+    }
+    dest->packed.data = NULL;
+    dest->content.buf.data = samples;
+    return 1;
+}
+
+int node_unpack_inputs(struct Node* node,
+                       struct Data** saved,
+                       struct Data* unpacked) {
+    unsigned int i, j;
+
+    for (i = 0; i < MAX_INPUTS; i++) {
+        saved[i] = node->inputs[i];
+    }
+    /* imported modules' nodes read the inputs, and unpack them */
+    if (node->module && node->module->file) return 1;
+    for (i = 0; i < MAX_INPUTS; i++) {
+        if (       !saved[i] || !saved[i]->packed.data
+                || (node->module
+                    && (node->module->inputs[i].flags & DESC_PACKED))) {
+            continue;
+        }
+        /* an input unpacked already for another slot */
+        for (j = 0; j < i && (saved[j] != saved[i]
+                              || node->inputs[j] == saved[j]); j++);
+        if (j < i) {
+            node->inputs[i] = node->inputs[j];
+        } else if (data_unpack(unpacked + i, saved[i])) {
+            node->inputs[i] = unpacked + i;
+        } else {
+            node_restore_inputs(node, saved, unpacked);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void node_restore_inputs(struct Node* node,
+                         struct Data** saved,
+                         struct Data* unpacked) {
+    unsigned int i;
+
+    for (i = 0; i < MAX_INPUTS; i++) {
+        if (node->inputs[i] == unpacked + i) {
+            data_free(unpacked + i);
+        }
+        node->inputs[i] = saved[i];
+    }
+}
+
+void node_pack_outputs(struct Node* node) {
+    unsigned int i;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if (node->outputs[i] && !data_pack(node->outputs[i])) {
+            fprintf(stderr, "Warning: %s: can't pack output, kept as float\n",
+                    node->name);
+        }
+    }
+}
@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sndc.h"
+
+#define SYMTAB_MIN_SIZE     16
+#define STRPOOL_BLOCK_SIZE  4096
+
+struct StrBlock {
+    struct StrBlock* next;
+    unsigned int used, size;
+    char data[1];
+};
+
+/* FNV-1a */
+static unsigned long hash(const char* s, unsigned int len) {
+    unsigned long h = 2166136261UL;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h = (h * 16777619UL) & 0xffffffffUL;
+    }
+    return h;
+}
+
+/* returns the slot holding key, or the empty slot where it should go */
+static struct Symbol* lookup(const struct SymTab* table,
+                             const char* key,
+                             unsigned int len) {
+    unsigned long i = hash(key, len) & (table->size - 1);
+
+    while (table->symbols[i].key) {
+        const char* cur = table->symbols[i].key;
+
+        if (!strncmp(cur, key, len) && !cur[len]) {
+            break;
+        }
+        i = (i + 1) & (table->size - 1);
+    }
+    return table->symbols + i;
+}
+
+static int grow(struct SymTab* table) {
+    struct Symbol *old = table->symbols, *new;
+    unsigned int oldSize = table->size, size, i;
+
+    size = oldSize ? 2 * oldSize : SYMTAB_MIN_SIZE;
+    if (!(new = calloc(size, sizeof(*new)))) {
+        return 0;
+    }
+    table->symbols = new;
+    table->size = size;
+    for (i = 0; i < oldSize; i++) {
+        if (old[i].key) {
+            *lookup(table, old[i].key, strlen(old[i].key)) = old[i];
+        }
+    }
+    free(old);
+    return 1;
+}
+
+void symtab_init(struct SymTab* table) {
+    table->symbols = NULL;
+    table->size = 0;
+    table->count = 0;
+}
+
+void symtab_free(struct SymTab* table) {
+    free(table->symbols);
+    symtab_init(table);
+}
+
+int symtab_set(struct SymTab* table, const char* key, unsigned int value) {
+    struct Symbol* sym;
+
+    if (4 * (table->count + 1) > 3 * table->size && !grow(table)) {
+        return 0;
+    }
+    sym = lookup(table, key, strlen(key));
+    if (!sym->key) {
+        sym->key = key;
+        table->count++;
+    }
+    sym->value = value;
+    return 1;
+}
+
+int symtab_get(const struct SymTab* table, const char* key) {
+    struct Symbol* sym;
+
+    if (!table->size) return -1;
+    sym = lookup(table, key, strlen(key));
+    return sym->key ? (int) sym->value : -1;
+}
+
+void strpool_init(struct StrPool* pool) {
+    symtab_init(&pool->table);
+    pool->blocks = NULL;
+}
+
+void strpool_free(struct StrPool* pool) {
+    struct StrBlock* cur = pool->blocks;
+
+    while (cur) {
+        struct StrBlock* next = cur->next;
+
+        free(cur);
+        cur = next;
+    }
+    symtab_free(&pool->table);
+    pool->blocks = NULL;
+}
+
+static char* pool_alloc(struct StrPool* pool, unsigned int len) {
+    struct StrBlock* block = pool->blocks;
+    char* res;
+
+    if (!block || block->size - block->used < len) {
+        unsigned int size = len > STRPOOL_BLOCK_SIZE ? len : STRPOOL_BLOCK_SIZE;
+
+        if (!(block = malloc(sizeof(*block) + size))) {
+            return NULL;
+        }
+        block->used = 0;
+        block->size = size;
+        block->next = pool->blocks;
+        pool->blocks = block;
+    }
+    res = block->data + block->used;
+    block->used += len;
+    return res;
+}
+
+char* strpool_add(struct StrPool* pool, const char* s, unsigned int len) {
+    struct Symbol* sym;
+    char* res;
+
+    if (pool->table.size) {
+        sym = lookup(&pool->table, s, len);
+        if (sym->key) {
+            return (char*) sym->key;
+        }
+    }
+    if (!(res = pool_alloc(pool, len + 1))) {
+        return NULL;
+    }
+    memcpy(res, s, len);
+    res[len] = '\0';
+    if (!symtab_set(&pool->table, res, 0)) {
+        return NULL;
+    }
+    return res;
+}
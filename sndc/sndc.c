@@ -1,5 +1,7 @@
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+#include <limits.h>
 
 #include "sndc.h"
 
@@ -53,6 +55,11 @@ static int print_type(int type) {
         l += 6 + strlen(sep);
         sep = " | ";
     }
+    if (type & DATA_CURVE) {
+        printf("%sCURVE", sep);
+        l += 5 + strlen(sep);
+        sep = " | ";
+    }
     putc(']', stdout);
     return l;
 }
@@ -65,8 +72,9 @@ static void print_module(const struct Module* module) {
         if (module->inputs[i].name) {
             printf("    %s ", module->inputs[i].name);
             print_type(module->inputs[i].type);
-            printf(" [%s]\n        %s\n",
+            printf(" [%s]%s\n        %s\n",
                     module->inputs[i].req ? "REQUIRED" : "OPTIONAL",
+                    module->inputs[i].flags & DESC_CONTROL ? " [CONTROL]" : "",
                     module->inputs[i].description);
         }
     }
@@ -97,13 +105,64 @@ static int help(int argc, char** argv) {
     if (argc <= 2) {
         printf("Usage: %s [-l]\n"
                "       %s [-h [module]]\n"
-               "       %s inFile [outFile]\n",
-               argv[0], argv[0], argv[0]);
+               "       %s --cpu-info\n"
+               "       %s inFile [-o outFile] [-f format] [-s threads] [--profile]\n"
+               "           [--mem-limit size] [--storage format|node=format]\n"
+               "           [--draft] [--control-rate ratio]\n"
+               "           [--range from-to]\n"
+               "       %s --compile inFile -o outFile\n"
+               "       %s --batch jobFile [-j threads]\n"
+               "       %s inFile -o outFile --sweep var=v1,v2... "
+               "[--sweep ...] [-j threads]\n",
+               argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
         printf("Options:\n");
         printf("    -l: list available modules\n");
         printf("    -h: print this help\n");
         printf("    -h <module>: print module specification\n");
+        printf("    --cpu-info: print the CPU features and the SIMD kernels "
+               "selected\n");
+        printf("    -o <file>: output file\n");
+        printf("    -f <format>: output format, raw (float32 without header), "
+               "or WAV with f32, s16 or s24 samples\n");
+        printf("    --compile: precompile inFile and its imports "
+               "to a .sndcb file\n");
+        printf("    --batch <file>: render all the jobs of the file ('-' for "
+               "stdin),\n"
+               "        one 'inFile outFile [format]' per line\n");
+        printf("    --sweep <var=v1,v2...>: render one output per value of a "
+               "var node\n"
+               "        or exported input, or per combination of values if "
+               "repeated,\n"
+               "        to outFile with -var=value appended to its name\n");
+        printf("    -j <n>: number of batch or sweep worker threads, "
+               "def number of CPUs\n");
+        printf("    -s <n>: number of threads rendering time slices of long "
+               "signals, def 1\n");
+        printf("    --profile: print the processing time and the number of "
+               "subnormal\n"
+               "        output samples of each node\n");
+        printf("    --keep-denormals: don't flush subnormal floats to zero "
+               "while rendering\n");
+        printf("    --mem-limit <size>: bytes of samples kept in memory, "
+               "with K, M or G\n"
+               "        suffix, past which buffers are spilled to disk\n");
+        printf("    --storage <format>: format of buffers only read as "
+               "control signals,\n"
+               "        f32 (def), f16, s16 or auto\n");
+        printf("    --storage <node=format>: format of the outputs of a node, "
+               "can be repeated\n");
+        printf("    --draft: quick preview, rendered at 1/%d of the sampling "
+               "rates with\n"
+               "        cheaper effects, then upsampled\n", DRAFT_RATIO);
+        printf("    --control-rate <ratio>: render signals only read as "
+               "parameters at their\n"
+               "        sampling rate divided by ratio, such as 64\n");
+        printf("    --range <from-to>: render only the given seconds of "
+               "the result,\n"
+               "        as [[h:]m:]s, such as 3:20-3:40\n");
         printf("If no output file specified, will write to stdout.\n");
+        printf("Default format is f32 for .wav output files, raw otherwise.\n");
+        printf("inFile can be a .sndc file or a precompiled .sndcb file.\n");
         return 0;
     } else if (argc > 2) {
         return help_module(argv[2]);
@@ -111,58 +170,682 @@ static int help(int argc, char** argv) {
     return 1;
 }
 
-int main(int argc, char** argv) {
+static int compile(const char* inName, const char* outName) {
     struct Stack s;
     struct SNDCFile file = {0};
-    FILE *out = NULL;
     char ok = 0, sndcInit = 0, stackInit = 0;
 
-    if (argc < 2) {
-        help(argc, argv);
-        return 1;
-    } else if (!strcmp(argv[1], "-l")) {
-        qsort(modules, numModules, sizeof(struct Module*), comp_module);
-        list_modules();
+    path_init();
+    stack_init(&s);
+    /* loading the stack brings all imports and instruments in the cache */
+    if (!(sndcInit = sndc_load(&file, inName))) {
+        fprintf(stderr, "Error: parsing failed\n");
+    } else if (!(stackInit = stack_load(&s, &file))) {
+        fprintf(stderr, "Error: loading stack failed\n");
+    } else if (!sndcb_write(outName, inName, &file)) {
+        fprintf(stderr, "Error: compiling failed\n");
+    } else {
+        ok = 1;
+    }
+    if (stackInit) stack_free(&s);
+    if (sndcInit) free_sndc(&file);
+    import_cache_clear();
+
+    return !ok;
+}
+
+/* WAV when the output file has a .wav extension, raw float32 otherwise */
+static enum OutputFormat default_format(const char* outName) {
+    size_t len;
+
+    if (outName && (len = strlen(outName)) >= 4
+            && !strcmp(outName + len - 4, ".wav")) {
+        return OUTPUT_F32;
+    }
+    return OUTPUT_RAW;
+}
+
+/* restricts buf to the samples of the seconds range[0] to range[1] */
+static void range_view(struct Buffer* buf, const float* range) {
+    double from = floor((double) range[0] * buf->samplingRate);
+    double to = ceil((double) range[1] * buf->samplingRate);
+    unsigned int lo, hi;
+
+    lo = from < buf->size ? from : buf->size;
+    hi = to < buf->size ? to : buf->size;
+    buf->data += lo;
+    buf->size = hi - lo;
+}
+
+/* draft renders are upsampled back to the rate and length of a final
+ * render, before the range is cut so that it starts at the same sample
+ */
+static int write_output(struct Output* out,
+                        const struct Buffer* buf,
+                        const float* range) {
+    struct Buffer up, view;
+    unsigned long size;
+    int ok;
+
+    if (settings.draft <= 1) {
+        view = *buf;
+        if (range) range_view(&view, range);
+        return output_write(out, &view);
+    } else if ((size = (unsigned long) buf->size * settings.draft)
+               > UINT_MAX) {
+        fprintf(stderr, "Error: draft output too long to upsample\n");
+        return 0;
+    } else if (!resample_buffer(&up, buf, buf->samplingRate * settings.draft,
+                                RESAMPLE_FAST)) {
         return 0;
-    } else if (!strcmp(argv[1], "-h")) {
-        return help(argc, argv);
     }
+    if (up.size < size) {
+        float* tmp;
 
-    if (argc < 3) {
-        out = stdout;
-    } else {
-        if (!(out = fopen(argv[2], "r"))) {
-            fprintf(stderr, "Error: can't open %s for writing\n", argv[2]);
-            return 1;
+        if (!(tmp = buffer_realloc(up.data, size))) {
+            fprintf(stderr, "Error: can't pad draft output\n");
+            buffer_free(up.data);
+            return 0;
         }
+        memset(tmp + up.size, 0, (size - up.size) * sizeof(float));
+        up.data = tmp;
+    }
+    up.size = size;
+    view = up;
+    if (range) range_view(&view, range);
+    ok = output_write(out, &view);
+    buffer_free(up.data);
+    return ok;
+}
+
+/* renders inName to outName (stdout if NULL), only the seconds range[0] to
+ * range[1] of the result if range isn't NULL
+ */
+static int render(const char* inName,
+                  const char* outName,
+                  enum OutputFormat format,
+                  const float* range,
+                  int verbose,
+                  int profile) {
+    struct Stack s;
+    struct SNDCFile file = {0};
+    struct Output* out = NULL;
+    char ok = 0, sndcInit = 0, stackInit = 0;
+
+    if (!(out = output_open(outName, format))) {
+        return 0;
     }
 
-    path_init();
     stack_init(&s);
-    s.verbose = 1;
-    if (!(sndcInit = parse_sndc(&file, argv[1]))) {
-        fprintf(stderr, "Error: parsing failed\n");
+    s.verbose = verbose;
+    s.profile = profile;
+    if (range) {
+        s.range[0] = range[0];
+        s.range[1] = range[1];
+    }
+    if (!(sndcInit = sndc_load(&file, inName))) {
+        fprintf(stderr, "Error: %s: parsing failed\n", inName);
     } else if (!(stackInit = stack_load(&s, &file))) {
-        fprintf(stderr, "Error: loading stack failed\n");
+        fprintf(stderr, "Error: %s: loading stack failed\n", inName);
     } else if (!stack_process(&s)) {
-        fprintf(stderr, "Error: processing stack failed\n");
+        fprintf(stderr, "Error: %s: processing stack failed\n", inName);
     } else {
+        ok = 1;
         if (s.numNodes) {
             struct Node* n = s.nodes[s.numNodes - 1];
             struct Data* data;
 
             if ((data = n->outputs[0]) && data->type == DATA_BUFFER) {
-                fwrite(data->content.buf.data,
-                        sizeof(float),
-                        data->content.buf.size,
-                        out);
+                ok = write_output(out, &data->content.buf, range);
             }
         }
-        ok = 1;
     }
+    /* the writer thread drains the last chunks while the stack is freed */
     if (stackInit) stack_free(&s);
     if (sndcInit) free_sndc(&file);
-    if (out) fclose(out);
+    if (!output_close(out)) ok = 0;
+
+    return ok;
+}
+
+/*** Batch mode ***/
+
+#define MAX_JOB_LINE    4096
+
+struct RenderJob {
+    char *inName, *outName;
+    enum OutputFormat format;
+    unsigned int line;
+    int ok;
+};
+
+static void render_job(void* arg) {
+    struct RenderJob* job = arg;
+
+    job->ok = render(job->inName, job->outName, job->format, NULL, 0, 0);
+}
+
+static char* next_word(char** cur) {
+    char* word;
+
+    *cur += strspn(*cur, " \t\r\n");
+    if (!**cur) return NULL;
+    word = *cur;
+    *cur += strcspn(*cur, " \t\r\n");
+    if (**cur) *(*cur)++ = '\0';
+    return word;
+}
+
+/* job lines are "inFile outFile [format]", '#' starts a comment */
+static int parse_job(char* line, unsigned int lineNo, struct RenderJob* job) {
+    char *in, *out, *format, *cur = line;
+
+    job->inName = job->outName = NULL;
+    job->line = lineNo;
+    job->ok = 0;
+    if (!(in = next_word(&cur)) || *in == '#') {
+        return 1;
+    }
+    if (!(out = next_word(&cur))) {
+        fprintf(stderr, "Error: job line %u: missing output file\n", lineNo);
+        return 0;
+    }
+    job->format = default_format(out);
+    if ((format = next_word(&cur)) && !output_format(format, &job->format)) {
+        fprintf(stderr, "Error: job line %u: bad format\n", lineNo);
+        return 0;
+    }
+    if (next_word(&cur)) {
+        fprintf(stderr, "Error: job line %u: trailing garbage\n", lineNo);
+        return 0;
+    }
+    if (!(job->inName = str_cpy(in)) || !(job->outName = str_cpy(out))) {
+        fprintf(stderr, "Error: job line %u: can't allocate job\n", lineNo);
+        free(job->inName);
+        job->inName = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+static int read_jobs(FILE* f, struct RenderJob** jobs, unsigned int* numJobs) {
+    char line[MAX_JOB_LINE];
+    unsigned int lineNo = 0, cap = 0;
+    struct RenderJob job;
+
+    *jobs = NULL;
+    *numJobs = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        if (!strchr(line, '\n') && !feof(f)) {
+            fprintf(stderr, "Error: job line %u: too long\n", lineNo);
+            return 0;
+        }
+        if (!parse_job(line, lineNo, &job)) {
+            return 0;
+        } else if (!job.inName) {
+            continue;
+        }
+        if (*numJobs >= cap) {
+            void* tmp;
+
+            cap = cap ? 2 * cap : 64;
+            if (!(tmp = realloc(*jobs, cap * sizeof(**jobs)))) {
+                fprintf(stderr, "Error: can't allocate jobs\n");
+                free(job.inName);
+                free(job.outName);
+                return 0;
+            }
+            *jobs = tmp;
+        }
+        (*jobs)[(*numJobs)++] = job;
+    }
+    return !ferror(f);
+}
+
+/* parsed files, imports and FFT plans are shared by all the jobs */
+static int batch(const char* jobsName, unsigned int numThreads) {
+    struct RenderJob* jobs = NULL;
+    struct Pool* pool = NULL;
+    FILE* f;
+    unsigned int numJobs = 0, numFailed = 0, i;
+    int ok = 0;
+
+    if (!strcmp(jobsName, "-")) {
+        f = stdin;
+    } else if (!(f = fopen(jobsName, "r"))) {
+        fprintf(stderr, "Error: can't open job file: %s\n", jobsName);
+        return 1;
+    }
+    if (!read_jobs(f, &jobs, &numJobs)) {
+        fprintf(stderr, "Error: can't read job file: %s\n", jobsName);
+    } else if (!(pool = pool_new(numThreads))) {
+        fprintf(stderr, "Error: can't create worker pool\n");
+    } else {
+        ok = 1;
+        for (i = 0; i < numJobs; i++) {
+            if (!pool_submit(pool, render_job, jobs + i)) {
+                /* run it here rather than skipping it */
+                render_job(jobs + i);
+            }
+        }
+        pool_free(pool);
+        for (i = 0; i < numJobs; i++) {
+            if (!jobs[i].ok) {
+                fprintf(stderr, "Error: job line %u: %s failed\n",
+                        jobs[i].line, jobs[i].inName);
+                numFailed++;
+            }
+        }
+        if (numFailed) {
+            fprintf(stderr, "Error: %u/%u jobs failed\n", numFailed, numJobs);
+            ok = 0;
+        }
+    }
+    for (i = 0; i < numJobs; i++) {
+        free(jobs[i].inName);
+        free(jobs[i].outName);
+    }
+    free(jobs);
+    if (f != stdin) fclose(f);
+    import_cache_clear();
+
+    return !ok;
+}
+
+/****************/
+
+/*** Sweep mode ***/
+
+#define MAX_SWEEPS      8
+
+struct Sweep {
+    char* name;
+    char** values;
+    unsigned int numValues;
+};
+
+struct Variant {
+    struct Patch* patch;
+    char* outName;
+    enum OutputFormat format;
+    int ok;
+};
+
+/* "name=a,b,c", the argument is split in place */
+static int parse_sweep(char* arg, struct Sweep* sweep) {
+    char *cur, *eq;
+    unsigned int n = 1;
+
+    if (!(eq = strchr(arg, '=')) || eq == arg || !eq[1]) {
+        fprintf(stderr, "Error: --sweep expects name=value,value...\n");
+        return 0;
+    }
+    *eq = '\0';
+    sweep->name = arg;
+    for (cur = eq + 1; *cur; cur++) {
+        if (*cur == ',') n++;
+    }
+    if (!(sweep->values = malloc(n * sizeof(char*)))) {
+        fprintf(stderr, "Error: can't allocate sweep\n");
+        return 0;
+    }
+    sweep->numValues = 0;
+    for (cur = eq + 1; cur; ) {
+        char* next = strchr(cur, ',');
+
+        if (next) *next++ = '\0';
+        sweep->values[sweep->numValues++] = cur;
+        cur = next;
+    }
+    return 1;
+}
+
+/* floats are set as floats, anything else as a string */
+static int set_value(struct Patch* patch, const char* name, const char* val) {
+    char* end;
+    double f = strtod(val, &end);
+
+    if (*val && !*end) {
+        return patch_set_float(patch, name, f);
+    }
+    return patch_set_string(patch, name, val);
+}
+
+/* out.wav -> out-name=value-name=value.wav */
+static char* variant_name(const char* outName,
+                          const struct Sweep* sweeps,
+                          const unsigned int* idx,
+                          unsigned int numSweeps) {
+    const char *ext, *slash;
+    char *res, *cur;
+    size_t len = strlen(outName) + 1;
+    unsigned int i;
+
+    slash = strrchr(outName, '/');
+    if (!(ext = strrchr(outName, '.')) || (slash && ext < slash)) {
+        ext = outName + strlen(outName);
+    }
+    for (i = 0; i < numSweeps; i++) {
+        len += strlen(sweeps[i].name) + strlen(sweeps[i].values[idx[i]]) + 2;
+    }
+    if (!(res = malloc(len))) return NULL;
+    memcpy(res, outName, ext - outName);
+    cur = res + (ext - outName);
+    for (i = 0; i < numSweeps; i++) {
+        cur += sprintf(cur, "-%s=%s", sweeps[i].name,
+                       sweeps[i].values[idx[i]]);
+    }
+    strcpy(cur, ext);
+    for (cur = res + (ext - outName); *cur; cur++) {
+        if (*cur == '/') *cur = '_';
+    }
+    return res;
+}
+
+static void render_variant(void* arg) {
+    struct Variant* v = arg;
+    const struct Buffer* buf;
+    struct Output* out;
+
+    v->ok = 0;
+    if (!patch_render(v->patch) || !(buf = patch_output(v->patch, NULL))) {
+        fprintf(stderr, "Error: %s: rendering failed\n", v->outName);
+    } else if ((out = output_open(v->outName, v->format))) {
+        v->ok = write_output(out, buf, NULL);
+        v->ok = output_close(out) && v->ok;
+    }
+    patch_free(v->patch);
+    v->patch = NULL;
+}
+
+/* renders every combination of the swept values, sharing all the nodes that
+ * don't depend on them
+ */
+static int sweep(const char* inName,
+                 const char* outName,
+                 enum OutputFormat format,
+                 struct Sweep* sweeps,
+                 unsigned int numSweeps,
+                 unsigned int numThreads) {
+    const char* names[MAX_SWEEPS];
+    unsigned int idx[MAX_SWEEPS] = {0};
+    struct Patch* base = NULL;
+    struct Variant* variants = NULL;
+    struct Pool* pool = NULL;
+    unsigned int numVariants = 1, numFailed = 0, i, j;
+    int ok = 0;
+
+    for (i = 0; i < numSweeps; i++) {
+        names[i] = sweeps[i].name;
+        numVariants *= sweeps[i].numValues;
+    }
+    if (!(variants = calloc(numVariants, sizeof(*variants)))) {
+        fprintf(stderr, "Error: can't allocate variants\n");
+        return 1;
+    } else if (!(base = patch_load(inName))) {
+        free(variants);
+        return 1;
+    }
+
+    for (i = 0; i < numVariants; i++) {
+        struct Variant* v = variants + i;
+
+        v->format = format;
+        if (!(v->patch = patch_variant(base, names, numSweeps))
+                || !(v->outName = variant_name(outName, sweeps,
+                                               idx, numSweeps))) {
+            fprintf(stderr, "Error: can't create variant\n");
+            goto exit;
+        }
+        for (j = 0; j < numSweeps; j++) {
+            if (!set_value(v->patch, names[j], sweeps[j].values[idx[j]])) {
+                fprintf(stderr, "Error: %s: can't set value\n", v->outName);
+                goto exit;
+            }
+        }
+        /* next combination */
+        for (j = numSweeps; j-- && ++idx[j] == sweeps[j].numValues; ) {
+            idx[j] = 0;
+        }
+    }
+
+    if (!(pool = pool_new(numThreads))) {
+        fprintf(stderr, "Error: can't create worker pool\n");
+        goto exit;
+    }
+    for (i = 0; i < numVariants; i++) {
+        if (!pool_submit(pool, render_variant, variants + i)) {
+            render_variant(variants + i);
+        }
+    }
+    pool_free(pool);
+    for (i = 0; i < numVariants; i++) {
+        if (!variants[i].ok) numFailed++;
+    }
+    if (numFailed) {
+        fprintf(stderr, "Error: %u/%u variants failed\n",
+                numFailed, numVariants);
+    } else {
+        ok = 1;
+    }
+
+exit:
+    for (i = 0; i < numVariants; i++) {
+        patch_free(variants[i].patch);
+        free(variants[i].outName);
+    }
+    free(variants);
+    patch_free(base);
+    return !ok;
+}
+
+/****************/
+
+#define MAX_STORAGE_RULES   64
+#define MAX_CONTROL_RATIO   1024
+
+/* "format" or "node=format", the argument is split in place */
+static int parse_storage(char* arg,
+                         struct StorageRule* rules,
+                         unsigned int* numRules) {
+    char* eq;
+
+    if (!(eq = strchr(arg, '='))) {
+        return storage_parse(arg, &settings.storage);
+    } else if (*numRules >= MAX_STORAGE_RULES) {
+        fprintf(stderr, "Error: at most %d storage rules\n",
+                MAX_STORAGE_RULES);
+        return 0;
+    }
+    *eq = '\0';
+    rules[*numRules].node = arg;
+    if (!storage_parse(eq + 1, &rules[*numRules].storage)) return 0;
+    settings.storageRules = rules;
+    settings.numStorageRules = ++*numRules;
+    return 1;
+}
+
+/* seconds as [[h:]m:]s */
+static int parse_time(const char* arg, char** end, float* t) {
+    double v = 0, part;
+    unsigned int i;
+
+    for (i = 0; i < 3; i++) {
+        part = strtod(arg, end);
+        if (*end == arg || part < 0) return 0;
+        v = 60. * v + part;
+        if (**end != ':') break;
+        arg = *end + 1;
+    }
+    *t = v;
+    return 1;
+}
+
+/* "from-to" */
+static int parse_range(const char* arg, float* range) {
+    char* end;
+
+    if (       !parse_time(arg, &end, range)
+            || *end != '-'
+            || !parse_time(end + 1, &end, range + 1)
+            || *end
+            || range[1] <= range[0]) {
+        fprintf(stderr, "Error: --range expects from-to, "
+                        "as [[h:]m:]s, such as 3:20-3:40\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* bytes, with an optional K, M or G suffix */
+static int parse_size(const char* arg, unsigned long* size) {
+    char* end;
+    unsigned long v = strtoul(arg, &end, 10);
+
+    switch (*end) {
+        case 'G': case 'g': v <<= 10;
+        case 'M': case 'm': v <<= 10;
+        case 'K': case 'k': v <<= 10; end++;
+        default: break;
+    }
+    if (end == arg || *end) {
+        fprintf(stderr, "Error: invalid size: %s\n", arg);
+        return 0;
+    }
+    *size = v;
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    enum OutputFormat format;
+    const char *inName = NULL, *outName = NULL, *formatName = NULL;
+    const char* jobsName = NULL;
+    struct Sweep sweeps[MAX_SWEEPS];
+    struct StorageRule rules[MAX_STORAGE_RULES];
+    unsigned int numSweeps = 0, numRules = 0;
+    float range[2] = {0, 0};
+    char ok, compileOnly = 0, profile = 0;
+    int i, numThreads = 0, numSlices;
+
+    if (argc < 2) {
+        help(argc, argv);
+        return 1;
+    } else if (!strcmp(argv[1], "-l")) {
+        qsort(modules, numModules, sizeof(struct Module*), comp_module);
+        list_modules();
+        return 0;
+    } else if (!strcmp(argv[1], "-h")) {
+        return help(argc, argv);
+    } else if (!strcmp(argv[1], "--cpu-info")) {
+        kernels_info(stdout);
+        return 0;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--compile")) {
+            compileOnly = 1;
+        } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            jobsName = argv[++i];
+        } else if (!strcmp(argv[i], "--sweep") && i + 1 < argc) {
+            if (numSweeps >= MAX_SWEEPS) {
+                fprintf(stderr, "Error: at most %d sweeps\n", MAX_SWEEPS);
+                return 1;
+            } else if (!parse_sweep(argv[++i], sweeps + numSweeps)) {
+                return 1;
+            }
+            numSweeps++;
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            if ((numThreads = atoi(argv[++i])) <= 0) {
+                fprintf(stderr, "Error: -j needs a positive number\n");
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if ((numSlices = atoi(argv[++i])) <= 0) {
+                fprintf(stderr, "Error: -s needs a positive number\n");
+                return 1;
+            }
+            settings.sliceThreads = numSlices;
+        } else if (!strcmp(argv[i], "--profile")) {
+            profile = 1;
+        } else if (!strcmp(argv[i], "--keep-denormals")) {
+            settings.keepDenormals = 1;
+        } else if (!strcmp(argv[i], "--mem-limit") && i + 1 < argc) {
+            if (!parse_size(argv[++i], &settings.memLimit)) return 1;
+        } else if (!strcmp(argv[i], "--storage") && i + 1 < argc) {
+            if (!parse_storage(argv[++i], rules, &numRules)) return 1;
+        } else if (!strcmp(argv[i], "--draft")) {
+            settings.draft = DRAFT_RATIO;
+        } else if (!strcmp(argv[i], "--control-rate") && i + 1 < argc) {
+            int ratio = atoi(argv[++i]);
+
+            if (ratio <= 0 || ratio > MAX_CONTROL_RATIO) {
+                fprintf(stderr, "Error: --control-rate needs a ratio "
+                                "between 1 and %d\n", MAX_CONTROL_RATIO);
+                return 1;
+            }
+            settings.controlRatio = ratio;
+        } else if (!strcmp(argv[i], "--range") && i + 1 < argc) {
+            if (!parse_range(argv[++i], range)) return 1;
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outName = argv[++i];
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            formatName = argv[++i];
+        } else if (!inName) {
+            inName = argv[i];
+        } else if (!outName) {
+            outName = argv[i];
+        } else {
+            help(1, argv);
+            return 1;
+        }
+    }
+
+    if (range[1] > 0 && (jobsName || compileOnly || numSweeps)) {
+        fprintf(stderr, "Error: --range only applies to a single render\n");
+        return 1;
+    }
+    if (jobsName) {
+        if (inName || outName || formatName || compileOnly || numSweeps) {
+            fprintf(stderr, "Error: --batch takes its files from the jobs\n");
+            return 1;
+        }
+        path_init();
+        return batch(jobsName, numThreads);
+    }
+    if (!inName) {
+        help(1, argv);
+        return 1;
+    }
+
+    if (compileOnly) {
+        if (!outName) {
+            fprintf(stderr, "Error: --compile needs an output file\n");
+            return 1;
+        }
+        return compile(inName, outName);
+    }
+
+    format = default_format(outName);
+    if (formatName && !output_format(formatName, &format)) {
+        return 1;
+    }
+
+    path_init();
+    if (numSweeps) {
+        if (!outName) {
+            fprintf(stderr, "Error: --sweep needs an output file\n");
+            return 1;
+        }
+        ok = !sweep(inName, outName, format, sweeps, numSweeps, numThreads);
+        for (i = 0; i < (int) numSweeps; i++) {
+            free(sweeps[i].values);
+        }
+    } else {
+        ok = render(inName, outName, format, range[1] > 0 ? range : NULL,
+                    1, profile);
+    }
+    import_cache_clear();
 
     return !ok;
 }